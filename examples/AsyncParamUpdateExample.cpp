@@ -13,25 +13,42 @@ bool mqttLog = true; // Change according to your setup
 // Create a global instance of the AsyncParamUpdate class
 AsyncParamUpdate asyncParamUpdater(ssid, password, mqttHost, mqttPort, mqttUser, mqttPassword, deviceName, mqttLog);
 
+// Parameters are updated in place, so they must outlive setup()
+int someIntParameter = 42;
+float someFloatParameter = 3.14;
+bool someBoolParameter = true;
+String someStringParameter = "Hello World";
+
+// Handles read the parameters safely while updates arrive
+ParamHandle<int> someInt;
+ParamHandle<float> someFloat;
+ParamHandle<bool> someBool;
+
 void setup()
 {
     // Initialize the instance
     asyncParamUpdater.begin();
 
-    // Define some parameters to add
-    int someIntParameter = 42;
-    float someFloatParameter = 3.14;
-    bool someBoolParameter = true;
-    String someStringParameter = "Hello World";
-
-    // Use addParameter to add the defined parameters
-    asyncParamUpdater.addParameter("someIntParameter", someIntParameter);
-    asyncParamUpdater.addParameter("someFloatParameter", someFloatParameter);
-    asyncParamUpdater.addParameter("someBoolParameter", someBoolParameter);
+    // Use addParameter to add the defined parameters; the registry is
+    // published once, on commit or when MQTT connects
+    asyncParamUpdater.beginRegistration();
+    someInt = asyncParamUpdater.addParameter("someIntParameter", someIntParameter);
+    someFloat = asyncParamUpdater.addParameter("someFloatParameter", someFloatParameter);
+    someBool = asyncParamUpdater.addParameter("someBoolParameter", someBoolParameter);
     asyncParamUpdater.addParameter("someStringParameter", someStringParameter);
+    asyncParamUpdater.commitRegistration();
 }
 
 void loop()
 {
-    // Code that makes use of the parameter values goes here
+    // Code that makes use of the parameter values goes here. Values read
+    // through one snapshot all come from the same update.
+    {
+        ParamSnapshot snapshot = asyncParamUpdater.snapshot();
+        if (snapshot.get(someBool))
+        {
+            Serial.println(snapshot.get(someInt) * snapshot.get(someFloat));
+        }
+    }
+    delay(1000);
 }
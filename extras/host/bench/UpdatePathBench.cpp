@@ -0,0 +1,370 @@
+// Pushes recorded update payloads through AsyncParamUpdate::OnMqttReceived on
+// the host HAL and reports per-stage latency and throughput.
+//
+//   update_path_bench [--iterations N] [--params N] [--chunk BYTES]
+//                     [--nvs-write-us US] [--coalesce-ms MS] [--msgpack]
+//                     [--mqtt-log] [--metrics] [--payloads FILE]
+//
+// --msgpack re-encodes the payloads as MessagePack and switches the device's
+// wire format to match. --metrics prints the device's own metrics document
+// at the end. Each iteration suffixes the payloads' ids so the device applies
+// them; the last iteration is then replayed to time the duplicate path.
+
+#include "AsyncParamUpdate.h"
+#include "HostHal.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifndef UPDATE_PATH_BENCH_PAYLOADS
+#define UPDATE_PATH_BENCH_PAYLOADS "payloads.jsonl"
+#endif
+
+#define BENCH_DEVICE "bench"
+
+namespace
+{
+    struct Options
+    {
+        size_t iterations = 2000;
+        size_t extraParams = 8;
+        size_t chunkSize = 0;
+        uint32_t nvsWriteMicros = 0;
+        uint32_t coalesceMillis = PERSIST_COALESCE_MS;
+        bool mqttLog = false;
+        bool msgpack = false;
+        bool metrics = false;
+        std::string payloads = UPDATE_PATH_BENCH_PAYLOADS;
+    };
+
+    class Series
+    {
+    public:
+        void add(uint64_t nanos) { samples.push_back(nanos / 1000.0); }
+
+        double sum() const
+        {
+            double total = 0;
+            for (double sample : samples)
+            {
+                total += sample;
+            }
+            return total;
+        }
+
+        void report(const char *stage)
+        {
+            if (samples.empty())
+            {
+                return;
+            }
+            std::sort(samples.begin(), samples.end());
+            printf("  %-22s %10.2f %10.2f %10.2f %10.2f\n", stage, sum() / samples.size(), percentile(0.50), percentile(0.99), samples.back());
+        }
+
+    private:
+        double percentile(double p) const { return samples[std::min(samples.size() - 1, (size_t)(p * samples.size()))]; }
+
+        std::vector<double> samples;
+    };
+
+    bool parseOptions(int argc, char **argv, Options &options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--iterations" && hasValue)
+            {
+                options.iterations = strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--params" && hasValue)
+            {
+                options.extraParams = strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--chunk" && hasValue)
+            {
+                options.chunkSize = strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--nvs-write-us" && hasValue)
+            {
+                options.nvsWriteMicros = strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--coalesce-ms" && hasValue)
+            {
+                options.coalesceMillis = strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--payloads" && hasValue)
+            {
+                options.payloads = argv[++i];
+            }
+            else if (arg == "--msgpack")
+            {
+                options.msgpack = true;
+            }
+            else if (arg == "--mqtt-log")
+            {
+                options.mqttLog = true;
+            }
+            else if (arg == "--metrics")
+            {
+                options.metrics = true;
+            }
+            else
+            {
+                fprintf(stderr, "usage: %s [--iterations N] [--params N] [--chunk BYTES] [--nvs-write-us US] [--coalesce-ms MS] [--msgpack] [--mqtt-log] [--metrics] [--payloads FILE]\n", argv[0]);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<std::string> loadPayloads(const std::string &path, bool msgpack)
+    {
+        std::vector<std::string> payloads;
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            if (line.empty())
+            {
+                continue;
+            }
+            if (msgpack)
+            {
+                JsonDocument doc;
+                deserializeJson(doc, line);
+                line.assign(measureMsgPack(doc), '\0');
+                serializeMsgPack(doc, &line[0], line.size());
+            }
+            payloads.push_back(line);
+        }
+        return payloads;
+    }
+
+    // payload with "-<iteration>" appended to its id, so the device handles
+    // the update instead of answering it from its duplicate cache. Payloads
+    // without an id are returned as they are.
+    std::string withId(const std::string &payload, bool msgpack, size_t iteration)
+    {
+        JsonDocument doc;
+        if (deserializePayload(doc, payload.data(), payload.size()) || doc["id"].isNull())
+        {
+            return payload;
+        }
+        doc["id"] = doc["id"].as<std::string>() + "-" + std::to_string(iteration);
+        std::string unique;
+        if (msgpack)
+        {
+            serializeMsgPack(doc, unique);
+        }
+        else
+        {
+            serializeJson(doc, unique);
+        }
+        return unique;
+    }
+
+    size_t countKeys(const std::string &payload)
+    {
+        JsonDocument doc;
+        if (deserializePayload(doc, payload.data(), payload.size()))
+        {
+            return 0;
+        }
+        return doc["parameters"].as<JsonObject>().size();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        return 2;
+    }
+
+    std::vector<std::string> payloads = loadPayloads(options.payloads, options.msgpack);
+    if (payloads.empty())
+    {
+        fprintf(stderr, "no payloads in %s\n", options.payloads.c_str());
+        return 1;
+    }
+
+    host::setNvsWriteLatency(options.nvsWriteMicros);
+
+    std::atomic<uint64_t> acksUpdated(0);
+    std::atomic<uint64_t> acksFailed(0);
+    std::atomic<uint64_t> registryPublishes(0);
+    std::atomic<uint64_t> registryBytes(0);
+    host::MqttBroker &broker = host::MqttBroker::instance();
+    broker.onPublish([&](const host::MqttMessage &message)
+                     {
+                         if (message.topic == REGISTRY_TOPIC)
+                         {
+                             registryPublishes++;
+                             registryBytes += message.payload.size();
+                             return;
+                         }
+                         if (message.topic != BOARDS_PREFIX BENCH_DEVICE CONFIRMATION_SUFFIX)
+                         {
+                             return;
+                         }
+                         if (message.payload.find("updated") != std::string::npos)
+                         {
+                             acksUpdated++;
+                         }
+                         else
+                         {
+                             acksFailed++;
+                         } });
+
+    static AsyncParamUpdate device("bench-ssid", "bench-password", "localhost", 1883, "bench", "bench", BENCH_DEVICE, options.mqttLog);
+    device.setPersistence(options.coalesceMillis);
+    device.setWireFormat(options.msgpack ? WIRE_FORMAT_MSGPACK : WIRE_FORMAT_JSON);
+    if (options.mqttLog)
+    {
+        device.setLogLevel(logging::LoggerLevel::LOGGER_LEVEL_DEBUG);
+    }
+    device.begin();
+
+    static int speed = 0;
+    static float gain = 1.0f;
+    static double offset = 0.0;
+    static bool enabled = false;
+    static String label = "default";
+    static std::vector<int> extras(options.extraParams);
+
+    uint64_t start = host::nowNanos();
+    device.beginRegistration();
+    device.addParameter("speed", speed);
+    device.addParameter("gain", gain);
+    device.addParameter("offset", offset);
+    device.addParameter("enabled", enabled);
+    device.addParameter("label", label);
+    for (size_t i = 0; i < extras.size(); i++)
+    {
+        device.addParameter("p" + std::to_string(i), extras[i]);
+    }
+    device.commitRegistration();
+    uint64_t registrationNanos = host::nowNanos() - start;
+
+    // Registration does not wait for the broker; the snapshot published on
+    // connect marks the device as subscribed.
+    for (int i = 0; i < 1000 && registryPublishes == 0; i++)
+    {
+        delay(10);
+    }
+    if (registryPublishes == 0)
+    {
+        fprintf(stderr, "device did not connect\n");
+        return 1;
+    }
+
+    for (const std::string &payload : payloads)
+    {
+        broker.inject(BOARDS_PREFIX BENCH_DEVICE, payload.c_str(), payload.size(), options.chunkSize);
+    }
+    acksUpdated = 0;
+    acksFailed = 0;
+    registryPublishes = 0;
+    registryBytes = 0;
+
+    Series parse;
+    for (size_t i = 0; i < options.iterations; i++)
+    {
+        for (const std::string &payload : payloads)
+        {
+            uint64_t t0 = host::nowNanos();
+            JsonDocument doc;
+            deserializePayload(doc, payload.data(), payload.size());
+            parse.add(host::nowNanos() - t0);
+        }
+    }
+
+    Series total;
+    Series applied;
+    Series persist;
+    Series publish;
+    size_t keys = 0;
+    std::vector<std::string> batch(payloads.size());
+    for (size_t i = 0; i < options.iterations; i++)
+    {
+        for (size_t p = 0; p < payloads.size(); p++)
+        {
+            batch[p] = withId(payloads[p], options.msgpack, i);
+        }
+        for (const std::string &payload : batch)
+        {
+            host::NvsStats nvsBefore = host::nvsStats();
+            host::MqttStats mqttBefore = broker.stats();
+            uint64_t t0 = host::nowNanos();
+
+            broker.inject(BOARDS_PREFIX BENCH_DEVICE, payload.c_str(), payload.size(), options.chunkSize);
+
+            uint64_t elapsed = host::nowNanos() - t0;
+            uint64_t nvsNanos = host::nvsStats().writeNanos - nvsBefore.writeNanos;
+            uint64_t publishNanos = broker.stats().publishNanos - mqttBefore.publishNanos;
+            total.add(elapsed);
+            persist.add(nvsNanos);
+            publish.add(publishNanos);
+            applied.add(elapsed - std::min(elapsed, nvsNanos + publishNanos));
+            keys += countKeys(payload);
+        }
+    }
+    uint64_t updated = acksUpdated;
+    uint64_t failed = acksFailed;
+
+    // The last batch is still in the cache as long as it holds no more than
+    // MESSAGE_ID_CACHE_SIZE ids, so every one of these is a duplicate.
+    Series duplicate;
+    for (size_t i = 0; i < options.iterations; i++)
+    {
+        for (size_t p = 0; p < payloads.size(); p++)
+        {
+            if (batch[p] == payloads[p])
+            {
+                continue;
+            }
+            uint64_t t0 = host::nowNanos();
+            broker.inject(BOARDS_PREFIX BENCH_DEVICE, batch[p].c_str(), batch[p].size(), options.chunkSize);
+            duplicate.add(host::nowNanos() - t0);
+        }
+    }
+
+    uint64_t flushStart = host::nowNanos();
+    device.flush();
+    uint64_t flushNanos = host::nowNanos() - flushStart;
+
+    host::NvsStats nvs = host::nvsStats();
+    double seconds = total.sum() / 1e6;
+    size_t messages = options.iterations * payloads.size();
+
+    printf("update path: %zu payloads x %zu iterations, %zu registered params, chunk %zu, nvs latency %u us, coalesce %u ms\n",
+           payloads.size(), options.iterations, 5 + extras.size(), options.chunkSize, options.nvsWriteMicros, options.coalesceMillis);
+    printf("  registration           %10.2f ms\n", registrationNanos / 1e6);
+    printf("  %-22s %10s %10s %10s %10s\n", "stage (us)", "mean", "p50", "p99", "max");
+    parse.report("parse (standalone)");
+    applied.report("parse + apply");
+    persist.report("nvs write");
+    publish.report("mqtt publish");
+    total.report("receive -> ack");
+    duplicate.report("duplicate -> ack");
+    printf("  throughput             %10.0f msg/s %10.0f keys/s\n", messages / seconds, keys / seconds);
+    printf("  acks                   %10llu updated %8llu failed %6llu repeated\n", (unsigned long long)updated, (unsigned long long)failed,
+           (unsigned long long)(acksUpdated + acksFailed - updated - failed));
+    printf("  registry               %10llu publishes %6llu bytes\n", (unsigned long long)registryPublishes, (unsigned long long)registryBytes);
+    printf("  nvs                    %10llu writes %9llu bytes %8zu keys received\n", (unsigned long long)nvs.writes, (unsigned long long)nvs.bytesWritten, keys);
+    printf("  final flush            %10.2f ms\n", flushNanos / 1e6);
+    if (options.metrics)
+    {
+        JsonDocument metrics;
+        device.writeMetrics(metrics);
+        std::string json;
+        serializeJson(metrics, json);
+        printf("  metrics                %s\n", json.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef HOST_CHECK_H
+#define HOST_CHECK_H
+
+// Assertions for the host checks under extras/host/checks. A failed CHECK
+// prints its location and expression and the run carries on; checkResult()
+// then gives the exit status ctest looks at.
+
+#include <cstdio>
+
+namespace host
+{
+    inline int &checkFailures()
+    {
+        static int failures = 0;
+        return failures;
+    }
+
+    inline int checkResult(const char *name)
+    {
+        int failures = checkFailures();
+        if (failures == 0)
+        {
+            printf("%s: ok\n", name);
+            return 0;
+        }
+        printf("%s: %d check(s) failed\n", name, failures);
+        return 1;
+    }
+}
+
+#define CHECK(condition)                                                          \
+    do                                                                            \
+    {                                                                             \
+        if (!(condition))                                                         \
+        {                                                                         \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            host::checkFailures()++;                                              \
+        }                                                                         \
+    } while (0)
+
+#endif
@@ -0,0 +1,81 @@
+// Behaviour checks for LatencyHistogram: bucket boundaries and counts that
+// stay consistent while several tasks record at once.
+
+#include "Metrics.h"
+#include "Check.h"
+#include <thread>
+#include <vector>
+
+namespace
+{
+    uint32_t bucketTotal(const LatencyHistogram &histogram)
+    {
+        uint32_t total = 0;
+        for (size_t i = 0; i < METRICS_BUCKETS; i++)
+        {
+            total += histogram.bucket(i);
+        }
+        return total;
+    }
+
+    void checkBoundaries()
+    {
+        const uint32_t *bounds = LatencyHistogram::bucketBoundsUs();
+        for (size_t i = 0; i < METRICS_BUCKETS - 1; i++)
+        {
+            // A bound belongs to its own bucket; one more is the next one's.
+            LatencyHistogram histogram;
+            histogram.record(bounds[i]);
+            histogram.record(bounds[i] + 1);
+            CHECK(histogram.bucket(i) == 1);
+            CHECK(histogram.bucket(i + 1) == 1);
+            CHECK(histogram.count() == 2);
+        }
+
+        LatencyHistogram histogram;
+        histogram.record(0);
+        histogram.record(UINT32_MAX);
+        CHECK(histogram.bucket(0) == 1);
+        CHECK(histogram.bucket(METRICS_BUCKETS - 1) == 1);
+    }
+
+    void checkBoundsAscend()
+    {
+        const uint32_t *bounds = LatencyHistogram::bucketBoundsUs();
+        for (size_t i = 1; i < METRICS_BUCKETS - 1; i++)
+        {
+            CHECK(bounds[i - 1] < bounds[i]);
+        }
+    }
+
+    void checkConcurrentRecording()
+    {
+        const size_t tasks = 4;
+        const uint32_t perTask = 20000;
+        LatencyHistogram histogram;
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < tasks; t++)
+        {
+            threads.emplace_back([&histogram, t, perTask]
+                                 {
+                                     for (uint32_t i = 0; i < perTask; i++)
+                                     {
+                                         histogram.record((i * 37 + t) % 200000);
+                                     } });
+        }
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+        CHECK(histogram.count() == tasks * perTask);
+        CHECK(bucketTotal(histogram) == histogram.count());
+    }
+}
+
+int main()
+{
+    checkBoundaries();
+    checkBoundsAscend();
+    checkConcurrentRecording();
+    return host::checkResult("latency_histogram_checks");
+}
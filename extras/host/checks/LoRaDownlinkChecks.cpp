@@ -0,0 +1,145 @@
+// Behaviour checks for LoRaDownlinkQueue: updates merged into a pending one
+// are confirmed along with it, and ones it replaces are reported as
+// superseded, so every id the backend sent gets an answer.
+
+#include "LoRaDownlink.h"
+#include "Check.h"
+
+namespace
+{
+    JsonDocument parse(const char *json)
+    {
+        JsonDocument doc;
+        CHECK(!deserializeJson(doc, json));
+        return doc;
+    }
+
+    bool enqueue(LoRaDownlinkQueue &queue, const char *json, uint32_t now, JsonDocument &superseded)
+    {
+        JsonDocument update = parse(json);
+        return queue.enqueue("node", update.as<JsonObjectConst>(), now, superseded);
+    }
+
+    // Sends whatever is due, as the gateway's LoRa task would.
+    JsonDocument *sendNext(LoRaDownlinkQueue &queue, uint32_t now)
+    {
+        uint32_t wait;
+        JsonDocument *update = queue.next(now, wait);
+        if (update != nullptr)
+        {
+            queue.sent(update, now);
+        }
+        return update;
+    }
+
+    void checkMergedUpdateIsConfirmed()
+    {
+        LoRaDownlinkQueue queue;
+        JsonDocument superseded;
+        CHECK(enqueue(queue, "{\"id\":\"A\",\"parameters\":{\"speed\":1,\"mode\":2}}", 0, superseded));
+        JsonDocument *sent = sendNext(queue, 0);
+        CHECK(sent != nullptr);
+
+        // B arrives while A waits for its ack and is merged into it.
+        CHECK(enqueue(queue, "{\"id\":\"B\",\"parameters\":{\"speed\":3}}", 10, superseded));
+        CHECK(superseded.isNull());
+        CHECK(queue.coalescedCount() == 1);
+        sent = sendNext(queue, 10);
+        CHECK(sent != nullptr);
+        if (sent != nullptr)
+        {
+            CHECK((*sent)["id"] == "B");
+            CHECK((*sent)["parameters"]["speed"].as<int>() == 3);
+            CHECK((*sent)["parameters"]["mode"].as<int>() == 2);
+        }
+
+        JsonDocument coalesced;
+        CHECK(queue.acknowledge("node", "B", coalesced));
+        CHECK(coalesced.size() == 1);
+        CHECK(coalesced[0] == "A");
+
+        uint32_t wait;
+        CHECK(queue.next(20, wait) == nullptr);
+    }
+
+    void checkEarlierAckIsNotRepeated()
+    {
+        LoRaDownlinkQueue queue;
+        JsonDocument superseded;
+        CHECK(enqueue(queue, "{\"id\":\"A\",\"parameters\":{\"speed\":1}}", 0, superseded));
+        sendNext(queue, 0);
+        CHECK(enqueue(queue, "{\"id\":\"B\",\"parameters\":{\"speed\":2}}", 10, superseded));
+        sendNext(queue, 10);
+
+        // The node confirms A itself; B's confirmation then stands alone.
+        JsonDocument coalesced;
+        CHECK(!queue.acknowledge("node", "A", coalesced));
+        CHECK(queue.acknowledge("node", "B", coalesced));
+        CHECK(coalesced.isNull());
+    }
+
+    void checkRedeliveredMergedUpdateIsIgnored()
+    {
+        LoRaDownlinkQueue queue;
+        JsonDocument superseded;
+        CHECK(enqueue(queue, "{\"id\":\"A\",\"parameters\":{\"speed\":1}}", 0, superseded));
+        CHECK(enqueue(queue, "{\"id\":\"B\",\"parameters\":{\"speed\":2}}", 0, superseded));
+        CHECK(enqueue(queue, "{\"id\":\"A\",\"parameters\":{\"speed\":1}}", 0, superseded));
+        CHECK(queue.coalescedCount() == 1);
+
+        JsonDocument *sent = sendNext(queue, 0);
+        CHECK(sent != nullptr);
+        if (sent != nullptr)
+        {
+            CHECK((*sent)["id"] == "B");
+            CHECK((*sent)["parameters"]["speed"].as<int>() == 2);
+        }
+    }
+
+    void checkReplacedUpdateIsSuperseded()
+    {
+        LoRaDownlinkQueue queue;
+        JsonDocument superseded;
+        CHECK(enqueue(queue, "{\"id\":\"A\",\"parameters\":{\"speed\":1}}", 0, superseded));
+        CHECK(enqueue(queue, "{\"id\":\"B\",\"parameters\":{\"mode\":2}}", 0, superseded));
+
+        // Parameters named by ID cannot be merged with named ones.
+        CHECK(enqueue(queue, "{\"id\":\"C\",\"keys\":\"id\",\"parameters\":{\"0\":3}}", 0, superseded));
+        CHECK(superseded.size() == 2);
+        CHECK(superseded[0] == "B");
+        CHECK(superseded[1] == "A");
+
+        sendNext(queue, 0);
+        JsonDocument coalesced;
+        CHECK(queue.acknowledge("node", "C", coalesced));
+        CHECK(coalesced.isNull());
+    }
+
+    void checkGatewayIdsAreMergedToo()
+    {
+        LoRaDownlinkQueue queue;
+        JsonDocument superseded;
+        CHECK(enqueue(queue, "{\"parameters\":{\"speed\":1}}", 0, superseded));
+        JsonDocument *sent = sendNext(queue, 0);
+        String first = sent != nullptr ? (*sent)["id"].as<String>() : String();
+        CHECK(enqueue(queue, "{\"parameters\":{\"speed\":2}}", 10, superseded));
+        sent = sendNext(queue, 10);
+        String second = sent != nullptr ? (*sent)["id"].as<String>() : String();
+        CHECK(first.length() > 0 && second.length() > 0 && first != second);
+
+        JsonDocument coalesced;
+        CHECK(queue.acknowledge("node", second, coalesced));
+        CHECK(coalesced.size() == 1);
+        CHECK(coalesced[0].as<String>() == first);
+    }
+}
+
+int main()
+{
+    checkMergedUpdateIsConfirmed();
+    checkEarlierAckIsNotRepeated();
+    checkRedeliveredMergedUpdateIsIgnored();
+    checkReplacedUpdateIsSuperseded();
+    checkGatewayIdsAreMergedToo();
+    return host::checkResult("lora_downlink_checks");
+}
@@ -0,0 +1,83 @@
+// Behaviour checks for the gateway's airtime budget: the time-on-air model
+// and the LoRaDutyCycle token bucket.
+
+#include "LoRaDownlink.h"
+#include "Check.h"
+
+namespace
+{
+    void checkAirtime()
+    {
+        // SF7, 125 kHz, 4/5: 1.024 ms symbols, 378 payload symbols for a
+        // full frame, as the Semtech calculator gives.
+        CHECK(loraPacketAirtimeUs(LORA_MAX_PACKET_SIZE) == 399616);
+        CHECK(loraPacketAirtimeUs(10) <= loraPacketAirtimeUs(11));
+        CHECK(loraMessageAirtimeUs(100) == loraPacketAirtimeUs(100));
+
+        // Fragmented: two full frames and a header with the rest.
+        size_t rest = 600 - 2 * LORA_FRAGMENT_DATA_SIZE;
+        CHECK(loraMessageAirtimeUs(600) == 2 * loraPacketAirtimeUs(LORA_MAX_PACKET_SIZE) + loraPacketAirtimeUs(LORA_FRAGMENT_HEADER_SIZE + rest));
+        CHECK(loraMessageAirtimeUs(2 * LORA_FRAGMENT_DATA_SIZE) == 2 * loraPacketAirtimeUs(LORA_MAX_PACKET_SIZE));
+    }
+
+    void checkBurstThenRefill()
+    {
+        LoRaDutyCycle budget;
+        uint32_t capacity = (uint32_t)LoRaDutyCycle::capacityUs();
+
+        // A fresh bucket holds the whole window's budget.
+        CHECK(budget.waitFor(capacity, 0) == 0);
+        CHECK(budget.waitFor(capacity + 1, 0) > 0);
+        budget.spend(capacity);
+
+        // Every ms earns LORA_DUTY_CYCLE_PERMILLE us; the wait rounds up.
+        CHECK(budget.waitFor(1000, 0) == 1000 / LORA_DUTY_CYCLE_PERMILLE);
+        CHECK(budget.waitFor(1001, 0) == 1000 / LORA_DUTY_CYCLE_PERMILLE + 1);
+        CHECK(budget.waitFor(1000, 50) == 50);
+        CHECK(budget.waitFor(1000, 100) == 0);
+        budget.spend(1000);
+        CHECK(budget.waitFor(1, 100) > 0);
+    }
+
+    void checkRefillIsCapped()
+    {
+        LoRaDutyCycle budget;
+        uint32_t capacity = (uint32_t)LoRaDutyCycle::capacityUs();
+        budget.spend(capacity);
+
+        // Idling for two windows still leaves only one window's budget.
+        uint32_t later = 2 * LORA_DUTY_CYCLE_WINDOW_MS;
+        CHECK(budget.waitFor(capacity, later) == 0);
+        CHECK(budget.waitFor(capacity + LORA_DUTY_CYCLE_PERMILLE, later) == 1);
+    }
+
+    void checkOverspendClampsToZero()
+    {
+        LoRaDutyCycle budget;
+        uint32_t capacity = (uint32_t)LoRaDutyCycle::capacityUs();
+        budget.spend(capacity + 5000);
+        CHECK(budget.waitFor(LORA_DUTY_CYCLE_PERMILLE, 0) == 1);
+    }
+
+    void checkMillisWraparound()
+    {
+        LoRaDutyCycle budget;
+        uint32_t capacity = (uint32_t)LoRaDutyCycle::capacityUs();
+        uint32_t beforeWrap = UINT32_MAX - 49;
+        CHECK(budget.waitFor(capacity, beforeWrap) == 0);
+        budget.spend(capacity);
+
+        // 100 ms pass across the wrap of millis().
+        CHECK(budget.waitFor(1000, beforeWrap + 100) == 0);
+    }
+}
+
+int main()
+{
+    checkAirtime();
+    checkBurstThenRefill();
+    checkRefillIsCapped();
+    checkOverspendClampsToZero();
+    checkMillisWraparound();
+    return host::checkResult("lora_duty_cycle_checks");
+}
@@ -0,0 +1,202 @@
+// Behaviour checks for LoRaFragmentWriter and LoRaReassembler: fragments in
+// and out of order, repeated, expired and evicted, and senders whose message
+// IDs collide.
+
+#include "LoRaFragments.h"
+#include "Check.h"
+#include "HostHal.h"
+#include <string>
+#include <vector>
+
+namespace
+{
+    typedef std::vector<std::string> Packets;
+
+    Packets transmitted;
+
+    Packets fragment(uint16_t source, uint16_t messageId, const std::string &message)
+    {
+        transmitted.clear();
+        LoRaFragmentWriter writer(source, messageId, message.size());
+        writer.write(reinterpret_cast<const uint8_t *>(message.data()), message.size());
+        CHECK(writer.end());
+        return transmitted;
+    }
+
+    std::string message(size_t length, char seed)
+    {
+        std::string text(length, '\0');
+        for (size_t i = 0; i < length; i++)
+        {
+            text[i] = (char)(seed + i % 23);
+        }
+        return text;
+    }
+
+    // Feeds packets in the given order; returns what completed, or "" if
+    // nothing did. Only the last packet may complete the message.
+    std::string feed(LoRaReassembler &reassembler, const Packets &packets, const std::vector<size_t> &order, uint32_t now)
+    {
+        std::string completed;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            const std::string &packet = packets[order[i]];
+            const char *data;
+            size_t length;
+            if (reassembler.accept(packet.data(), packet.size(), now, data, length))
+            {
+                CHECK(i + 1 == order.size());
+                completed.assign(data, length);
+            }
+        }
+        return completed;
+    }
+
+    void checkSinglePacketPassesThrough()
+    {
+        LoRaReassembler reassembler;
+        CHECK(reassembler.begin(1));
+        std::string text = "{\"Device\":\"node\"}";
+        Packets packets = fragment(1, 7, text);
+        CHECK(packets.size() == 1);
+        CHECK(packets[0] == text);
+        CHECK(feed(reassembler, packets, {0}, 0) == text);
+    }
+
+    void checkInAndOutOfOrder()
+    {
+        LoRaReassembler reassembler;
+        CHECK(reassembler.begin(2));
+        std::string text = message(600, 'a');
+        Packets packets = fragment(1, 7, text);
+        CHECK(packets.size() == 3);
+        CHECK(packets[0].size() == LORA_MAX_PACKET_SIZE);
+        CHECK(packets[2].size() == LORA_FRAGMENT_HEADER_SIZE + 600 - 2 * LORA_FRAGMENT_DATA_SIZE);
+
+        CHECK(feed(reassembler, packets, {0, 1, 2}, 0) == text);
+        CHECK(feed(reassembler, packets, {2, 0, 1}, 10) == text);
+        CHECK(feed(reassembler, packets, {1, 2, 0}, 20) == text);
+        CHECK(reassembler.timedOut() == 0);
+    }
+
+    void checkRepeatedFragments()
+    {
+        LoRaReassembler reassembler;
+        CHECK(reassembler.begin(1));
+        std::string text = message(600, 'b');
+        Packets packets = fragment(1, 8, text);
+
+        // A retransmitted fragment neither completes the message early nor
+        // changes what it reassembles to.
+        CHECK(feed(reassembler, packets, {0, 0, 1, 1, 2}, 0) == text);
+
+        // Once complete, a late copy starts a new message that never finishes.
+        CHECK(feed(reassembler, packets, {1}, 0).empty());
+    }
+
+    void checkCollidingSenders()
+    {
+        LoRaReassembler reassembler;
+        CHECK(reassembler.begin(2));
+        std::string first = message(600, 'c');
+        std::string second = message(600, 'C');
+        Packets a = fragment(loraSourceId("node-a"), 42, first);
+        Packets b = fragment(loraSourceId("node-b"), 42, second);
+        CHECK(loraSourceId("node-a") != loraSourceId("node-b"));
+
+        const char *data;
+        size_t length;
+        CHECK(!reassembler.accept(a[0].data(), a[0].size(), 0, data, length));
+        CHECK(!reassembler.accept(b[0].data(), b[0].size(), 0, data, length));
+        CHECK(!reassembler.accept(a[1].data(), a[1].size(), 0, data, length));
+        CHECK(!reassembler.accept(b[1].data(), b[1].size(), 0, data, length));
+        CHECK(reassembler.accept(b[2].data(), b[2].size(), 0, data, length));
+        CHECK(std::string(data, length) == second);
+        CHECK(reassembler.accept(a[2].data(), a[2].size(), 0, data, length));
+        CHECK(std::string(data, length) == first);
+    }
+
+    void checkExpiry()
+    {
+        LoRaReassembler reassembler;
+        CHECK(reassembler.begin(1));
+        std::string text = message(600, 'd');
+        Packets packets = fragment(1, 9, text);
+
+        CHECK(feed(reassembler, packets, {0, 1}, 0).empty());
+        // The rest arrives too late: the old fragments are gone, so this only
+        // starts the message again.
+        CHECK(feed(reassembler, packets, {2}, LORA_REASSEMBLY_TIMEOUT_MS + 1).empty());
+        CHECK(reassembler.timedOut() == 1);
+        CHECK(feed(reassembler, packets, {0, 1}, LORA_REASSEMBLY_TIMEOUT_MS + 2) == text);
+    }
+
+    void checkEviction()
+    {
+        LoRaReassembler reassembler;
+        CHECK(reassembler.begin(1));
+        std::string older = message(600, 'e');
+        std::string newer = message(300, 'f');
+        Packets a = fragment(1, 10, older);
+        Packets b = fragment(1, 11, newer);
+
+        // With one slot, a new message takes it from the incomplete one.
+        CHECK(feed(reassembler, a, {0, 1}, 0).empty());
+        CHECK(feed(reassembler, b, {0, 1}, 1) == newer);
+        CHECK(reassembler.timedOut() == 1);
+        CHECK(feed(reassembler, a, {2}, 2).empty());
+    }
+
+    void checkMalformedFragments()
+    {
+        LoRaReassembler reassembler;
+        CHECK(reassembler.begin(1));
+        std::string text = message(600, 'g');
+        Packets packets = fragment(1, 12, text);
+        const char *data;
+        size_t length;
+
+        std::string badIndex = packets[0];
+        badIndex[5] = 3;
+        CHECK(!reassembler.accept(badIndex.data(), badIndex.size(), 0, data, length));
+
+        std::string oneOfOne = packets[0];
+        oneOfOne[6] = 1;
+        CHECK(!reassembler.accept(oneOfOne.data(), oneOfOne.size(), 0, data, length));
+
+        std::string shortMiddle = packets[1].substr(0, 100);
+        CHECK(!reassembler.accept(shortMiddle.data(), shortMiddle.size(), 0, data, length));
+
+        std::string headerOnly = packets[0].substr(0, LORA_FRAGMENT_HEADER_SIZE);
+        CHECK(!reassembler.accept(headerOnly.data(), headerOnly.size(), 0, data, length));
+
+        // None of them took the slot from a real message.
+        CHECK(feed(reassembler, packets, {0, 1, 2}, 0) == text);
+    }
+
+    void checkOversizedMessageIsRefused()
+    {
+        transmitted.clear();
+        std::string text = message(LORA_MAX_MESSAGE_SIZE + 1, 'h');
+        LoRaFragmentWriter writer(1, 13, text.size());
+        writer.write(reinterpret_cast<const uint8_t *>(text.data()), text.size());
+        CHECK(!writer.end());
+        CHECK(transmitted.empty());
+    }
+}
+
+int main()
+{
+    host::onLoRaTransmit([](const uint8_t *data, size_t len)
+                         { transmitted.emplace_back(reinterpret_cast<const char *>(data), len); });
+
+    checkSinglePacketPassesThrough();
+    checkInAndOutOfOrder();
+    checkRepeatedFragments();
+    checkCollidingSenders();
+    checkExpiry();
+    checkEviction();
+    checkMalformedFragments();
+    checkOversizedMessageIsRefused();
+    return host::checkResult("lora_fragment_checks");
+}
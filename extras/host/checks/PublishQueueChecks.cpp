@@ -0,0 +1,277 @@
+// Behaviour checks for PublishQueue against the in-memory broker: class
+// priority, the in-flight window, per-class shares and retain flags, and
+// pumping from several tasks at once.
+
+#include "PublishQueue.h"
+#include "Check.h"
+#include "HostHal.h"
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    AsyncMqttClient client;
+    std::mutex publishedMutex;
+    std::vector<host::MqttMessage> published;
+    std::vector<uint32_t> sentTags;
+
+    void onSent(uint32_t tag, uint16_t packetId)
+    {
+        std::lock_guard<std::mutex> lock(publishedMutex);
+        sentTags.push_back(tag);
+    }
+
+    std::vector<host::MqttMessage> takePublished()
+    {
+        std::lock_guard<std::mutex> lock(publishedMutex);
+        std::vector<host::MqttMessage> messages;
+        messages.swap(published);
+        sentTags.clear();
+        return messages;
+    }
+
+    bool connect()
+    {
+        WiFi.begin("checks", "checks");
+        for (int i = 0; i < 500 && WiFi.status() != WL_CONNECTED; i++)
+        {
+            delay(2);
+        }
+        client.setClientId("publish-queue-checks");
+        client.connect();
+        host::drainAsyncTcp();
+        return client.connected();
+    }
+
+    bool enqueue(PublishQueue &queue, PublishClass cls, const char *topic, const std::string &payload = "x", bool retain = false, uint32_t tag = 0)
+    {
+        return queue.enqueue(cls, topic, payload.data(), payload.size(), retain, tag);
+    }
+
+    void checkPriority()
+    {
+        PublishQueue queue;
+        CHECK(queue.begin(&client, onSent));
+        takePublished();
+
+        // Queued lowest class first, published highest class first.
+        CHECK(enqueue(queue, PUBLISH_LOG, "t/log"));
+        CHECK(enqueue(queue, PUBLISH_METRICS, "t/metrics"));
+        CHECK(enqueue(queue, PUBLISH_REGISTRY, "t/registry"));
+        CHECK(enqueue(queue, PUBLISH_ACK, "t/ack"));
+        CHECK(enqueue(queue, PUBLISH_ACK, "t/ack2"));
+        queue.pump();
+
+        std::vector<host::MqttMessage> messages = takePublished();
+        CHECK(messages.size() == 5);
+        if (messages.size() == 5)
+        {
+            CHECK(messages[0].topic == "t/ack");
+            CHECK(messages[1].topic == "t/ack2");
+            CHECK(messages[2].topic == "t/registry");
+            CHECK(messages[3].topic == "t/metrics");
+            CHECK(messages[4].topic == "t/log");
+            CHECK(messages[0].qos == PUBLISH_ACK_QOS);
+            CHECK(messages[4].qos == PUBLISH_LOG_QOS);
+        }
+        CHECK(queue.queued() == 0);
+    }
+
+    void checkInFlightWindow()
+    {
+        PublishQueue queue;
+        CHECK(queue.begin(&client, onSent));
+        takePublished();
+
+        // QoS 0 logs may not overtake acks waiting for the window.
+        CHECK(enqueue(queue, PUBLISH_LOG, "t/log"));
+        for (uint32_t i = 1; i <= PUBLISH_MAX_IN_FLIGHT + 2; i++)
+        {
+            CHECK(enqueue(queue, PUBLISH_ACK, "t/ack", "x", false, i));
+        }
+        queue.pump();
+        CHECK(takePublished().size() == PUBLISH_MAX_IN_FLIGHT);
+        CHECK(queue.queued() == 3);
+
+        // Nothing moves until the broker acknowledges, then one slot frees.
+        queue.pump();
+        CHECK(takePublished().empty());
+
+        // The host client numbers packets from 1, so the window holds the
+        // last PUBLISH_MAX_IN_FLIGHT ids it handed out.
+        uint16_t next = client.publish("t/probe", 1, false, "x", 1);
+        takePublished();
+        queue.acknowledged(next - PUBLISH_MAX_IN_FLIGHT);
+        queue.pump();
+        std::vector<host::MqttMessage> messages = takePublished();
+        CHECK(messages.size() == 1);
+        CHECK(queue.queued() == 2);
+
+        // After a disconnect the window is empty again.
+        queue.disconnected();
+        queue.pump();
+        messages = takePublished();
+        CHECK(messages.size() == 2);
+        if (messages.size() == 2)
+        {
+            CHECK(messages[1].topic == "t/log");
+        }
+        CHECK(queue.queued() == 0);
+    }
+
+    void checkClassShares()
+    {
+        PublishQueue queue;
+        CHECK(queue.begin(&client, onSent));
+
+        // Not pumped, so everything stays queued. Logs get a quarter of the
+        // slots, metrics half, the registry three quarters, acks all.
+        size_t logSlots = PUBLISH_QUEUE_SLOTS / 4;
+        for (size_t i = 0; i < logSlots; i++)
+        {
+            CHECK(enqueue(queue, PUBLISH_LOG, "t/log"));
+        }
+        CHECK(!enqueue(queue, PUBLISH_LOG, "t/log"));
+        CHECK(queue.rejectedCount() == 1);
+        CHECK(!queue.hasRoom(PUBLISH_LOG, 1));
+        CHECK(queue.hasRoom(PUBLISH_METRICS, 1));
+        for (size_t i = logSlots; i < PUBLISH_QUEUE_SLOTS / 2; i++)
+        {
+            CHECK(enqueue(queue, PUBLISH_METRICS, "t/metrics"));
+        }
+        CHECK(!enqueue(queue, PUBLISH_METRICS, "t/metrics"));
+        for (size_t i = PUBLISH_QUEUE_SLOTS / 2; i < PUBLISH_QUEUE_SLOTS; i++)
+        {
+            CHECK(enqueue(queue, PUBLISH_ACK, "t/ack"));
+        }
+        CHECK(!enqueue(queue, PUBLISH_ACK, "t/ack"));
+        CHECK(queue.queued() == PUBLISH_QUEUE_SLOTS);
+
+        // The byte budget is shared out the same way.
+        PublishQueue bytes;
+        CHECK(bytes.begin(&client, onSent));
+        CHECK(!bytes.hasRoom(PUBLISH_LOG, PUBLISH_QUEUE_BYTES / 4 + 1));
+        CHECK(bytes.hasRoom(PUBLISH_LOG, PUBLISH_QUEUE_BYTES / 4));
+        CHECK(bytes.hasRoom(PUBLISH_ACK, PUBLISH_QUEUE_BYTES));
+        char *payload = static_cast<char *>(malloc(PUBLISH_QUEUE_BYTES / 4 + 2));
+        CHECK(!bytes.adopt(PUBLISH_LOG, "t/log", payload, PUBLISH_QUEUE_BYTES / 4 + 1, false));
+        CHECK(bytes.rejectedCount() == 1);
+    }
+
+    void checkRetainAndAdopt()
+    {
+        PublishQueue queue;
+        CHECK(queue.begin(&client, onSent));
+        takePublished();
+
+        // Metrics never retain unless configured to; acks may.
+        std::string text = "{\"status\":\"online\"}";
+        char *owned = static_cast<char *>(malloc(text.size() + 1));
+        memcpy(owned, text.c_str(), text.size() + 1);
+        CHECK(queue.adopt(PUBLISH_ACK, "t/status", owned, text.size(), true, 7));
+        CHECK(enqueue(queue, PUBLISH_METRICS, "t/metrics", "m", true));
+        queue.configure(PUBLISH_LOG, 0, true);
+        CHECK(enqueue(queue, PUBLISH_LOG, "t/log", "l", true));
+        queue.pump();
+
+        std::vector<uint32_t> tags;
+        {
+            std::lock_guard<std::mutex> lock(publishedMutex);
+            tags = sentTags;
+        }
+        std::vector<host::MqttMessage> messages = takePublished();
+        CHECK(messages.size() == 3);
+        if (messages.size() == 3)
+        {
+            CHECK(messages[0].payload == text);
+            CHECK(messages[0].retain);
+            CHECK(!messages[1].retain);
+            CHECK(messages[2].retain);
+        }
+        CHECK(tags.size() == 1 && tags[0] == 7);
+        queue.disconnected();
+    }
+
+    // Producers enqueue and pump while the broker's acknowledgements pump
+    // from the async_tcp thread, as they do on the device. Every message
+    // must go out, each producer's in order, without a final pump. Metrics
+    // are QoS 0, so nothing but the producers' own pumps sends them.
+    PublishQueue *concurrentQueue = nullptr;
+
+    void checkConcurrentPumps()
+    {
+        PublishQueue queue;
+        CHECK(queue.begin(&client, onSent));
+        concurrentQueue = &queue;
+        client.onPublish([](uint16_t packetId)
+                         {
+                             concurrentQueue->acknowledged(packetId);
+                             concurrentQueue->pump(); });
+        takePublished();
+
+        const int producers = 3;
+        const int perProducer = 500;
+        static const char *topics[producers] = {"t/p0", "t/p1", "t/p2"};
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; p++)
+        {
+            threads.emplace_back([&queue, p, perProducer]
+                                 {
+                                     for (int i = 0; i < perProducer; i++)
+                                     {
+                                         std::string payload = std::to_string(i);
+                                         PublishClass cls = p == 0 ? PUBLISH_ACK : PUBLISH_METRICS;
+                                         while (!enqueue(queue, cls, topics[p], payload))
+                                         {
+                                             std::this_thread::yield();
+                                         }
+                                         queue.pump();
+                                     } });
+        }
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+        host::drainAsyncTcp();
+        CHECK(queue.queued() == 0);
+
+        std::vector<host::MqttMessage> messages = takePublished();
+        CHECK(messages.size() == (size_t)(producers * perProducer));
+        int next[producers] = {0, 0, 0};
+        bool ordered = true;
+        for (const host::MqttMessage &message : messages)
+        {
+            int p = message.topic[3] - '0';
+            ordered = ordered && message.payload == std::to_string(next[p]++);
+        }
+        CHECK(ordered);
+
+        client.onPublish(nullptr);
+        concurrentQueue = nullptr;
+    }
+}
+
+int main()
+{
+    host::MqttBroker::instance().onPublish([](const host::MqttMessage &message)
+                                           {
+                                               std::lock_guard<std::mutex> lock(publishedMutex);
+                                               if (message.topic.compare(0, 2, "t/") == 0)
+                                               {
+                                                   published.push_back(message);
+                                               } });
+    if (!connect())
+    {
+        printf("publish_queue_checks: client did not connect\n");
+        return 1;
+    }
+
+    checkPriority();
+    checkInFlightWindow();
+    checkClassShares();
+    checkRetainAndAdopt();
+    checkConcurrentPumps();
+    return host::checkResult("publish_queue_checks");
+}
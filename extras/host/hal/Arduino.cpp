@@ -0,0 +1,191 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include <logger.h>
+#include "HostHal.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+
+HardwareSerial Serial;
+SPIClass SPI;
+
+static const std::chrono::steady_clock::time_point bootTime = std::chrono::steady_clock::now();
+static std::atomic<bool> logEcho(false);
+
+uint64_t host::nowNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - bootTime).count();
+}
+
+unsigned long millis()
+{
+    return (unsigned long)(host::nowNanos() / 1000000ULL);
+}
+
+unsigned long micros()
+{
+    return (unsigned long)(host::nowNanos() / 1000ULL);
+}
+
+void delay(unsigned long ms)
+{
+    vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+uint32_t esp_random()
+{
+    static std::mutex mutex;
+    static std::random_device device;
+    std::lock_guard<std::mutex> guard(mutex);
+    return device();
+}
+
+String::String(long value, unsigned char base)
+{
+    if (base == 10)
+    {
+        buffer = std::to_string(value);
+        return;
+    }
+    bool negative = value < 0;
+    unsigned long magnitude = negative ? 0UL - (unsigned long)value : (unsigned long)value;
+    *this = String(magnitude, base);
+    if (negative)
+    {
+        buffer.insert(buffer.begin(), '-');
+    }
+}
+
+String::String(unsigned long value, unsigned char base)
+{
+    if (base < 2 || base > 36)
+    {
+        base = 10;
+    }
+    do
+    {
+        unsigned digit = value % base;
+        buffer.insert(buffer.begin(), (char)(digit < 10 ? '0' + digit : 'A' + digit - 10));
+        value /= base;
+    } while (value);
+}
+
+String::String(double value, unsigned int decimalPlaces)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", (int)decimalPlaces, value);
+    buffer = buf;
+}
+
+void String::getBytes(unsigned char *buf, unsigned int bufsize, unsigned int index) const
+{
+    if (!bufsize || !buf)
+    {
+        return;
+    }
+    if (index >= buffer.size())
+    {
+        buf[0] = 0;
+        return;
+    }
+    unsigned int n = std::min<unsigned int>(bufsize - 1, buffer.size() - index);
+    memcpy(buf, buffer.data() + index, n);
+    buf[n] = 0;
+}
+
+String String::substring(unsigned int beginIndex, unsigned int endIndex) const
+{
+    if (beginIndex > endIndex)
+    {
+        std::swap(beginIndex, endIndex);
+    }
+    if (beginIndex >= buffer.size())
+    {
+        return String();
+    }
+    endIndex = std::min<unsigned int>(endIndex, buffer.size());
+    return String(buffer.data() + beginIndex, endIndex - beginIndex);
+}
+
+void String::replace(const String &find, const String &replace)
+{
+    if (find.buffer.empty())
+    {
+        return;
+    }
+    size_t pos = 0;
+    while ((pos = buffer.find(find.buffer, pos)) != std::string::npos)
+    {
+        buffer.replace(pos, find.buffer.size(), replace.buffer);
+        pos += replace.buffer.size();
+    }
+}
+
+void String::toLowerCase()
+{
+    for (char &c : buffer)
+    {
+        c = (char)tolower((unsigned char)c);
+    }
+}
+
+void String::toUpperCase()
+{
+    for (char &c : buffer)
+    {
+        c = (char)toupper((unsigned char)c);
+    }
+}
+
+void String::trim()
+{
+    size_t first = buffer.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos)
+    {
+        buffer.clear();
+        return;
+    }
+    size_t last = buffer.find_last_not_of(" \t\r\n");
+    buffer = buffer.substr(first, last - first + 1);
+}
+
+size_t Print::printf(const char *format, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len < 0)
+    {
+        return 0;
+    }
+    return write(buf, std::min<size_t>((size_t)len, sizeof(buf) - 1));
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    return fwrite(buffer, 1, size, stdout);
+}
+
+void host::setLogEcho(bool echo)
+{
+    logEcho = echo;
+}
+
+void logging::Logger::log(LoggerLevel level, const char *module, const char *message)
+{
+    if (logEcho)
+    {
+        fprintf(stderr, "[%s] %s\n", module, message);
+    }
+}
@@ -0,0 +1,243 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Host stand-in for the subset of the ESP32 Arduino core used by the library.
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdarg>
+#include <cmath>
+#include <string>
+#include <functional>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+typedef uint8_t byte;
+
+#define IRAM_ATTR
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+uint32_t esp_random();
+
+class String
+{
+public:
+    String() {}
+    String(const char *cstr) : buffer(cstr ? cstr : "") {}
+    String(const char *cstr, unsigned int length) : buffer(cstr ? std::string(cstr, length) : std::string()) {}
+    String(const String &str) = default;
+    String(String &&str) = default;
+    explicit String(char c) : buffer(1, c) {}
+    explicit String(unsigned char value, unsigned char base = 10) : String((unsigned long)value, base) {}
+    explicit String(int value, unsigned char base = 10) : String((long)value, base) {}
+    explicit String(unsigned int value, unsigned char base = 10) : String((unsigned long)value, base) {}
+    explicit String(long value, unsigned char base = 10);
+    explicit String(unsigned long value, unsigned char base = 10);
+    explicit String(long long value, unsigned char base = 10) : String((long)value, base) {}
+    explicit String(unsigned long long value, unsigned char base = 10) : String((unsigned long)value, base) {}
+    explicit String(float value, unsigned int decimalPlaces = 2) : String((double)value, decimalPlaces) {}
+    explicit String(double value, unsigned int decimalPlaces = 2);
+
+    String &operator=(const String &rhs) = default;
+    String &operator=(String &&rhs) = default;
+    String &operator=(const char *cstr)
+    {
+        buffer = cstr ? cstr : "";
+        return *this;
+    }
+
+    bool reserve(unsigned int size)
+    {
+        buffer.reserve(size);
+        return true;
+    }
+    unsigned int length() const { return buffer.size(); }
+    bool isEmpty() const { return buffer.empty(); }
+    const char *c_str() const { return buffer.c_str(); }
+    char *begin() { return &buffer[0]; }
+    char *end() { return &buffer[0] + buffer.size(); }
+
+    bool concat(const String &str)
+    {
+        buffer += str.buffer;
+        return true;
+    }
+    bool concat(const char *cstr)
+    {
+        if (!cstr)
+            return false;
+        buffer += cstr;
+        return true;
+    }
+    bool concat(const char *cstr, unsigned int length)
+    {
+        if (!cstr)
+            return false;
+        buffer.append(cstr, length);
+        return true;
+    }
+    bool concat(char c)
+    {
+        buffer += c;
+        return true;
+    }
+    bool concat(unsigned char num) { return concat(String(num)); }
+    bool concat(int num) { return concat(String(num)); }
+    bool concat(unsigned int num) { return concat(String(num)); }
+    bool concat(long num) { return concat(String(num)); }
+    bool concat(unsigned long num) { return concat(String(num)); }
+    bool concat(float num) { return concat(String(num)); }
+    bool concat(double num) { return concat(String(num)); }
+
+    template <typename T>
+    String &operator+=(const T &rhs)
+    {
+        concat(rhs);
+        return *this;
+    }
+
+    int compareTo(const String &s) const { return buffer.compare(s.buffer); }
+    bool equals(const String &s) const { return buffer == s.buffer; }
+    bool equals(const char *cstr) const { return buffer == (cstr ? cstr : ""); }
+    bool operator==(const String &rhs) const { return equals(rhs); }
+    bool operator==(const char *cstr) const { return equals(cstr); }
+    bool operator!=(const String &rhs) const { return !equals(rhs); }
+    bool operator!=(const char *cstr) const { return !equals(cstr); }
+    bool operator<(const String &rhs) const { return compareTo(rhs) < 0; }
+    bool startsWith(const String &prefix) const { return buffer.compare(0, prefix.buffer.size(), prefix.buffer) == 0; }
+    bool endsWith(const String &suffix) const
+    {
+        return buffer.size() >= suffix.buffer.size() && buffer.compare(buffer.size() - suffix.buffer.size(), suffix.buffer.size(), suffix.buffer) == 0;
+    }
+
+    char charAt(unsigned int index) const { return index < buffer.size() ? buffer[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    char &operator[](unsigned int index) { return buffer[index]; }
+    void getBytes(unsigned char *buf, unsigned int bufsize, unsigned int index = 0) const;
+    void toCharArray(char *buf, unsigned int bufsize, unsigned int index = 0) const { getBytes((unsigned char *)buf, bufsize, index); }
+
+    int indexOf(char ch, unsigned int fromIndex = 0) const { return find(buffer.find(ch, fromIndex)); }
+    int indexOf(const String &str, unsigned int fromIndex = 0) const { return find(buffer.find(str.buffer, fromIndex)); }
+    int lastIndexOf(char ch) const { return find(buffer.rfind(ch)); }
+    String substring(unsigned int beginIndex) const { return beginIndex < buffer.size() ? String(buffer.substr(beginIndex).c_str()) : String(); }
+    String substring(unsigned int beginIndex, unsigned int endIndex) const;
+
+    void replace(const String &find, const String &replace);
+    void remove(unsigned int index) { buffer.erase(index < buffer.size() ? index : buffer.size()); }
+    void remove(unsigned int index, unsigned int count) { buffer.erase(index < buffer.size() ? index : buffer.size(), count); }
+    void toLowerCase();
+    void toUpperCase();
+    void trim();
+
+    long toInt() const { return strtol(buffer.c_str(), nullptr, 10); }
+    float toFloat() const { return strtof(buffer.c_str(), nullptr); }
+    double toDouble() const { return strtod(buffer.c_str(), nullptr); }
+
+private:
+    static int find(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+
+    std::string buffer;
+};
+
+class StringSumHelper : public String
+{
+public:
+    StringSumHelper(const String &s) : String(s) {}
+    StringSumHelper(const char *p) : String(p) {}
+};
+
+inline StringSumHelper operator+(const String &lhs, const String &rhs)
+{
+    StringSumHelper sum(lhs);
+    sum.concat(rhs);
+    return sum;
+}
+inline StringSumHelper operator+(const String &lhs, const char *rhs)
+{
+    StringSumHelper sum(lhs);
+    sum.concat(rhs);
+    return sum;
+}
+inline StringSumHelper operator+(const char *lhs, const String &rhs)
+{
+    StringSumHelper sum(lhs);
+    sum.concat(rhs);
+    return sum;
+}
+inline StringSumHelper operator+(const String &lhs, char rhs)
+{
+    StringSumHelper sum(lhs);
+    sum.concat(rhs);
+    return sum;
+}
+inline bool operator==(const char *lhs, const String &rhs) { return rhs.equals(lhs); }
+inline bool operator!=(const char *lhs, const String &rhs) { return !rhs.equals(lhs); }
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+        size_t n = 0;
+        while (size--)
+        {
+            n += write(*buffer++);
+        }
+        return n;
+    }
+    size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+
+    size_t print(const char *str) { return write(str); }
+    size_t print(const String &str) { return write(str.c_str(), str.length()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int value) { return print(String(value)); }
+    size_t print(unsigned int value) { return print(String(value)); }
+    size_t print(long value) { return print(String(value)); }
+    size_t print(unsigned long value) { return print(String(value)); }
+    size_t print(double value, int digits = 2) { return print(String(value, digits)); }
+    size_t printf(const char *format, ...);
+
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(const T &value)
+    {
+        size_t n = print(value);
+        return n + println();
+    }
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+};
+
+class HardwareSerial : public Stream
+{
+public:
+    void begin(unsigned long baud) {}
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,509 @@
+#include <AsyncMqttClient.h>
+#include "HostHal.h"
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+struct AsyncTcpDispatcher
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::function<void()>> jobs;
+    bool busy = false;
+    bool started = false;
+};
+
+static AsyncTcpDispatcher *dispatcher = new AsyncTcpDispatcher();
+
+void host::runOnAsyncTcp(std::function<void()> work)
+{
+    std::lock_guard<std::mutex> lock(dispatcher->mutex);
+    dispatcher->jobs.push_back(std::move(work));
+    if (!dispatcher->started)
+    {
+        dispatcher->started = true;
+        std::thread([]
+                    {
+                        for (;;)
+                        {
+                            std::function<void()> job;
+                            {
+                                std::unique_lock<std::mutex> lock(dispatcher->mutex);
+                                dispatcher->busy = false;
+                                dispatcher->changed.notify_all();
+                                dispatcher->changed.wait(lock, []
+                                                         { return !dispatcher->jobs.empty(); });
+                                job = std::move(dispatcher->jobs.front());
+                                dispatcher->jobs.pop_front();
+                                dispatcher->busy = true;
+                            }
+                            job();
+                        } })
+            .detach();
+    }
+    dispatcher->changed.notify_all();
+}
+
+void host::drainAsyncTcp()
+{
+    std::unique_lock<std::mutex> lock(dispatcher->mutex);
+    dispatcher->changed.wait(lock, []
+                             { return dispatcher->jobs.empty() && !dispatcher->busy; });
+}
+
+host::MqttBroker &host::MqttBroker::instance()
+{
+    static MqttBroker *broker = new MqttBroker();
+    return *broker;
+}
+
+bool host::MqttBroker::topicMatches(const std::string &filter, const std::string &topic)
+{
+    size_t f = 0;
+    size_t t = 0;
+    while (f < filter.size())
+    {
+        size_t fEnd = filter.find('/', f);
+        std::string level = filter.substr(f, fEnd == std::string::npos ? std::string::npos : fEnd - f);
+        if (level == "#")
+        {
+            return true;
+        }
+        if (t > topic.size())
+        {
+            return false;
+        }
+        size_t tEnd = topic.find('/', t);
+        std::string topicLevel = topic.substr(t, tEnd == std::string::npos ? std::string::npos : tEnd - t);
+        if (level != "+" && level != topicLevel)
+        {
+            return false;
+        }
+        f = fEnd == std::string::npos ? filter.size() + 1 : fEnd + 1;
+        t = tEnd == std::string::npos ? topic.size() + 1 : tEnd + 1;
+    }
+    return t > topic.size();
+}
+
+void host::MqttBroker::attach(AsyncMqttClient *client)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    clients.insert(client);
+}
+
+void host::MqttBroker::detach(AsyncMqttClient *client)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    clients.erase(client);
+    online.erase(client);
+    subscriptions.erase(client);
+}
+
+bool host::MqttBroker::connected(const AsyncMqttClient *client)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return online.count(client) == 1;
+}
+
+void host::MqttBroker::connect(AsyncMqttClient *client)
+{
+    runOnAsyncTcp([this, client]
+                  {
+                      if (WiFi.status() != WL_CONNECTED)
+                      {
+                          if (client->disconnectCallback)
+                          {
+                              client->disconnectCallback(AsyncMqttClientDisconnectReason::TCP_DISCONNECTED);
+                          }
+                          return;
+                      }
+                      {
+                          std::lock_guard<std::recursive_mutex> lock(mutex);
+                          if (!clients.count(client) || !online.insert(client).second)
+                          {
+                              return;
+                          }
+                          subscriptions[client].clear();
+                      }
+                      if (client->connectCallback)
+                      {
+                          client->connectCallback(false);
+                      } });
+}
+
+void host::MqttBroker::disconnect(AsyncMqttClient *client, bool graceful)
+{
+    MqttMessage will;
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        if (!online.erase(client))
+        {
+            return;
+        }
+        subscriptions.erase(client);
+        will = MqttMessage{client->clientId, client->willTopic, client->willPayload, client->willQos, client->willRetain};
+    }
+    if (!will.topic.empty() && !graceful)
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        if (will.retain)
+        {
+            retainedMessages[will.topic] = will.payload;
+        }
+        deliver(will, 0, true);
+    }
+    runOnAsyncTcp([client]
+                  {
+                      if (client->disconnectCallback)
+                      {
+                          client->disconnectCallback(AsyncMqttClientDisconnectReason::TCP_DISCONNECTED);
+                      } });
+}
+
+void host::MqttBroker::dropConnections()
+{
+    std::vector<AsyncMqttClient *> dropped;
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        for (const AsyncMqttClient *client : online)
+        {
+            dropped.push_back(const_cast<AsyncMqttClient *>(client));
+        }
+    }
+    for (AsyncMqttClient *client : dropped)
+    {
+        disconnect(client, false);
+    }
+}
+
+void host::MqttBroker::subscribe(AsyncMqttClient *client, const char *topic, uint8_t qos, uint16_t packetId)
+{
+    std::string filter(topic);
+    std::vector<MqttMessage> replay;
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        counters.subscribes++;
+        subscriptions[client].insert(filter);
+        for (const auto &retained : retainedMessages)
+        {
+            if (topicMatches(filter, retained.first))
+            {
+                replay.push_back(MqttMessage{"", retained.first, retained.second, qos, true});
+            }
+        }
+    }
+    runOnAsyncTcp([client, qos, packetId, replay]
+                  {
+                      if (client->subscribeCallback)
+                      {
+                          client->subscribeCallback(packetId, qos);
+                      }
+                      for (const MqttMessage &message : replay)
+                      {
+                          if (client->messageCallback)
+                          {
+                              std::string topic = message.topic;
+                              std::string payload = message.payload;
+                              client->messageCallback(&topic[0], &payload[0], AsyncMqttClientMessageProperties{message.qos, false, true}, payload.size(), 0, payload.size());
+                          }
+                      } });
+}
+
+void host::MqttBroker::unsubscribe(AsyncMqttClient *client, const char *topic, uint16_t packetId)
+{
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        subscriptions[client].erase(topic);
+    }
+    runOnAsyncTcp([client, packetId]
+                  {
+                      if (client->unsubscribeCallback)
+                      {
+                          client->unsubscribeCallback(packetId);
+                      } });
+}
+
+bool host::MqttBroker::publish(AsyncMqttClient *client, const char *topic, uint8_t qos, bool retain, const char *payload, size_t length, uint16_t packetId)
+{
+    uint64_t start = nowNanos();
+    MqttMessage message{client->clientId, topic ? topic : "", std::string(payload ? payload : "", length), qos, retain};
+    std::vector<std::function<void(const MqttMessage &)>> observersSnapshot;
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        if (!online.count(client) || message.topic.empty())
+        {
+            return false;
+        }
+        if (retain)
+        {
+            if (message.payload.empty())
+            {
+                retainedMessages.erase(message.topic);
+            }
+            else
+            {
+                retainedMessages[message.topic] = message.payload;
+            }
+        }
+        observersSnapshot = observers;
+        deliver(message, 0, true);
+    }
+    for (const auto &observer : observersSnapshot)
+    {
+        observer(message);
+    }
+    if (qos > 0)
+    {
+        runOnAsyncTcp([client, packetId]
+                      {
+                          if (client->publishCallback)
+                          {
+                              client->publishCallback(packetId);
+                          } });
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    counters.publishes++;
+    counters.publishBytes += length;
+    counters.publishNanos += nowNanos() - start;
+    return true;
+}
+
+void host::MqttBroker::deliver(const MqttMessage &message, size_t chunkSize, bool async)
+{
+    std::vector<AsyncMqttClient *> targets;
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        for (const auto &entry : subscriptions)
+        {
+            if (!online.count(entry.first))
+            {
+                continue;
+            }
+            for (const std::string &filter : entry.second)
+            {
+                if (topicMatches(filter, message.topic))
+                {
+                    targets.push_back(const_cast<AsyncMqttClient *>(entry.first));
+                    break;
+                }
+            }
+        }
+        counters.deliveries += targets.size();
+    }
+
+    for (AsyncMqttClient *client : targets)
+    {
+        auto run = [client, message, chunkSize]
+        {
+            if (!client->messageCallback)
+            {
+                return;
+            }
+            std::string topic = message.topic;
+            std::string payload = message.payload;
+            size_t total = payload.size();
+            size_t step = chunkSize ? chunkSize : (total ? total : 1);
+            size_t index = 0;
+            do
+            {
+                size_t len = total - index < step ? total - index : step;
+                client->messageCallback(&topic[0], &payload[0] + index, AsyncMqttClientMessageProperties{message.qos, false, message.retain}, len, index, total);
+                index += len;
+            } while (index < total);
+        };
+        if (async)
+        {
+            runOnAsyncTcp(run);
+        }
+        else
+        {
+            run();
+        }
+    }
+}
+
+void host::MqttBroker::inject(const char *topic, const char *payload, size_t len, size_t chunkSize, uint8_t qos, bool retain)
+{
+    deliver(MqttMessage{"", topic, std::string(payload, len), qos, retain}, chunkSize, false);
+}
+
+void host::MqttBroker::onPublish(std::function<void(const MqttMessage &)> observer)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    observers.push_back(observer);
+}
+
+bool host::MqttBroker::retained(const char *topic, std::string &payload)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    auto it = retainedMessages.find(topic);
+    if (it == retainedMessages.end())
+    {
+        return false;
+    }
+    payload = it->second;
+    return true;
+}
+
+host::MqttStats host::MqttBroker::stats()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return counters;
+}
+
+AsyncMqttClient::AsyncMqttClient()
+{
+    host::MqttBroker::instance().attach(this);
+}
+
+AsyncMqttClient::~AsyncMqttClient()
+{
+    tcpDetach();
+    host::MqttBroker::instance().detach(this);
+}
+
+AsyncMqttClient &AsyncMqttClient::setClientId(const char *clientId)
+{
+    this->clientId = clientId ? clientId : "";
+    return *this;
+}
+
+AsyncMqttClient &AsyncMqttClient::setServer(const char *host, uint16_t port)
+{
+    serverHost = host ? host : "";
+    serverPort = port;
+    return *this;
+}
+
+AsyncMqttClient &AsyncMqttClient::setCredentials(const char *username, const char *password)
+{
+    this->username = username ? username : "";
+    this->password = password ? password : "";
+    return *this;
+}
+
+AsyncMqttClient &AsyncMqttClient::setWill(const char *topic, uint8_t qos, bool retain, const char *payload, size_t length)
+{
+    willTopic = topic ? topic : "";
+    willPayload = payload ? std::string(payload, length ? length : strlen(payload)) : std::string();
+    willQos = qos;
+    willRetain = retain;
+    return *this;
+}
+
+AsyncMqttClient &AsyncMqttClient::onConnect(AsyncMqttClientInternals::OnConnectUserCallback callback)
+{
+    connectCallback = callback;
+    return *this;
+}
+
+AsyncMqttClient &AsyncMqttClient::onDisconnect(AsyncMqttClientInternals::OnDisconnectUserCallback callback)
+{
+    disconnectCallback = callback;
+    return *this;
+}
+
+AsyncMqttClient &AsyncMqttClient::onSubscribe(AsyncMqttClientInternals::OnSubscribeUserCallback callback)
+{
+    subscribeCallback = callback;
+    return *this;
+}
+
+AsyncMqttClient &AsyncMqttClient::onUnsubscribe(AsyncMqttClientInternals::OnUnsubscribeUserCallback callback)
+{
+    unsubscribeCallback = callback;
+    return *this;
+}
+
+AsyncMqttClient &AsyncMqttClient::onMessage(AsyncMqttClientInternals::OnMessageUserCallback callback)
+{
+    messageCallback = callback;
+    return *this;
+}
+
+AsyncMqttClient &AsyncMqttClient::onPublish(AsyncMqttClientInternals::OnPublishUserCallback callback)
+{
+    publishCallback = callback;
+    return *this;
+}
+
+bool AsyncMqttClient::connected() const
+{
+    if (host::mqttTransport() == host::MQTT_TRANSPORT_TCP)
+    {
+        return tcpConnected();
+    }
+    return host::MqttBroker::instance().connected(this);
+}
+
+void AsyncMqttClient::connect()
+{
+    if (host::mqttTransport() == host::MQTT_TRANSPORT_TCP)
+    {
+        tcpConnect();
+        return;
+    }
+    host::MqttBroker::instance().connect(this);
+}
+
+void AsyncMqttClient::disconnect(bool force)
+{
+    if (host::mqttTransport() == host::MQTT_TRANSPORT_TCP)
+    {
+        tcpDisconnect(force);
+        return;
+    }
+    host::MqttBroker::instance().disconnect(this, !force);
+}
+
+uint16_t AsyncMqttClient::takePacketId()
+{
+    uint16_t packetId = nextPacketId++;
+    if (nextPacketId == 0)
+    {
+        nextPacketId = 1;
+    }
+    return packetId;
+}
+
+uint16_t AsyncMqttClient::subscribe(const char *topic, uint8_t qos)
+{
+    if (host::mqttTransport() == host::MQTT_TRANSPORT_TCP)
+    {
+        return tcpSubscribe(topic, qos);
+    }
+    if (!connected())
+    {
+        return 0;
+    }
+    uint16_t packetId = takePacketId();
+    host::MqttBroker::instance().subscribe(this, topic, qos, packetId);
+    return packetId;
+}
+
+uint16_t AsyncMqttClient::unsubscribe(const char *topic)
+{
+    if (host::mqttTransport() == host::MQTT_TRANSPORT_TCP)
+    {
+        return tcpUnsubscribe(topic);
+    }
+    if (!connected())
+    {
+        return 0;
+    }
+    uint16_t packetId = takePacketId();
+    host::MqttBroker::instance().unsubscribe(this, topic, packetId);
+    return packetId;
+}
+
+uint16_t AsyncMqttClient::publish(const char *topic, uint8_t qos, bool retain, const char *payload, size_t length, bool dup, uint16_t message_id)
+{
+    size_t len = length ? length : (payload ? strlen(payload) : 0);
+    uint16_t packetId = qos > 0 ? (message_id ? message_id : takePacketId()) : 1;
+    if (host::mqttTransport() == host::MQTT_TRANSPORT_TCP)
+    {
+        return tcpPublish(topic, qos, retain, payload, len, packetId);
+    }
+    return host::MqttBroker::instance().publish(this, topic, qos, retain, payload, len, packetId) ? packetId : 0;
+}
@@ -0,0 +1,121 @@
+#ifndef HOST_ASYNC_MQTT_CLIENT_H
+#define HOST_ASYNC_MQTT_CLIENT_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <functional>
+#include <memory>
+#include <string>
+
+enum class AsyncMqttClientDisconnectReason : int8_t
+{
+    TCP_DISCONNECTED = 0,
+    MQTT_UNACCEPTABLE_PROTOCOL_VERSION = 1,
+    MQTT_IDENTIFIER_REJECTED = 2,
+    MQTT_SERVER_UNAVAILABLE = 3,
+    MQTT_MALFORMED_CREDENTIALS = 4,
+    MQTT_NOT_AUTHORIZED = 5,
+    ESP8266_NOT_ENOUGH_SPACE = 6,
+    TLS_BAD_FINGERPRINT = 7
+};
+
+struct AsyncMqttClientMessageProperties
+{
+    uint8_t qos;
+    bool dup;
+    bool retain;
+};
+
+namespace AsyncMqttClientInternals
+{
+    typedef std::function<void(bool sessionPresent)> OnConnectUserCallback;
+    typedef std::function<void(AsyncMqttClientDisconnectReason reason)> OnDisconnectUserCallback;
+    typedef std::function<void(uint16_t packetId, uint8_t qos)> OnSubscribeUserCallback;
+    typedef std::function<void(uint16_t packetId)> OnUnsubscribeUserCallback;
+    typedef std::function<void(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)> OnMessageUserCallback;
+    typedef std::function<void(uint16_t packetId)> OnPublishUserCallback;
+}
+
+namespace host
+{
+    class MqttBroker;
+    class MqttTcpSession;
+}
+
+// Host stand-in for marvinroger/AsyncMqttClient. Clients talk to the
+// in-process broker in HostHal.h, or to a real one over TCP after
+// host::setMqttTransport(); callbacks fire on a single "async_tcp"
+// dispatcher thread, as they do on the ESP32.
+class AsyncMqttClient
+{
+public:
+    AsyncMqttClient();
+    ~AsyncMqttClient();
+
+    AsyncMqttClient &setKeepAlive(uint16_t keepAlive)
+    {
+        this->keepAlive = keepAlive;
+        return *this;
+    }
+    AsyncMqttClient &setClientId(const char *clientId);
+    AsyncMqttClient &setCleanSession(bool cleanSession) { return *this; }
+    AsyncMqttClient &setMaxTopicLength(uint16_t maxTopicLength) { return *this; }
+    AsyncMqttClient &setCredentials(const char *username, const char *password = nullptr);
+    AsyncMqttClient &setWill(const char *topic, uint8_t qos, bool retain, const char *payload = nullptr, size_t length = 0);
+    AsyncMqttClient &setServer(IPAddress ip, uint16_t port) { return setServer(ip.toString().c_str(), port); }
+    AsyncMqttClient &setServer(const char *host, uint16_t port);
+    AsyncMqttClient &setSecure(bool secure) { return *this; }
+
+    AsyncMqttClient &onConnect(AsyncMqttClientInternals::OnConnectUserCallback callback);
+    AsyncMqttClient &onDisconnect(AsyncMqttClientInternals::OnDisconnectUserCallback callback);
+    AsyncMqttClient &onSubscribe(AsyncMqttClientInternals::OnSubscribeUserCallback callback);
+    AsyncMqttClient &onUnsubscribe(AsyncMqttClientInternals::OnUnsubscribeUserCallback callback);
+    AsyncMqttClient &onMessage(AsyncMqttClientInternals::OnMessageUserCallback callback);
+    AsyncMqttClient &onPublish(AsyncMqttClientInternals::OnPublishUserCallback callback);
+
+    bool connected() const;
+    void connect();
+    void disconnect(bool force = false);
+    uint16_t subscribe(const char *topic, uint8_t qos);
+    uint16_t unsubscribe(const char *topic);
+    uint16_t publish(const char *topic, uint8_t qos, bool retain, const char *payload = nullptr, size_t length = 0, bool dup = false, uint16_t message_id = 0);
+
+    const char *getClientId() const { return clientId.c_str(); }
+
+private:
+    friend class host::MqttBroker;
+    friend class host::MqttTcpSession;
+
+    // MQTT_TRANSPORT_TCP, in MqttTcp.cpp.
+    void tcpConnect();
+    void tcpDisconnect(bool force);
+    void tcpDetach();
+    bool tcpConnected() const;
+    uint16_t tcpSubscribe(const char *topic, uint8_t qos);
+    uint16_t tcpUnsubscribe(const char *topic);
+    uint16_t tcpPublish(const char *topic, uint8_t qos, bool retain, const char *payload, size_t length, uint16_t packetId);
+    uint16_t takePacketId();
+
+    std::string serverHost;
+    uint16_t serverPort = 1883;
+    std::string username;
+    std::string password;
+    uint16_t keepAlive = 15;
+    std::shared_ptr<host::MqttTcpSession> session;
+
+    std::string clientId;
+    std::string willTopic;
+    std::string willPayload;
+    uint8_t willQos = 0;
+    bool willRetain = false;
+    uint16_t nextPacketId = 1;
+
+    AsyncMqttClientInternals::OnConnectUserCallback connectCallback;
+    AsyncMqttClientInternals::OnDisconnectUserCallback disconnectCallback;
+    AsyncMqttClientInternals::OnSubscribeUserCallback subscribeCallback;
+    AsyncMqttClientInternals::OnUnsubscribeUserCallback unsubscribeCallback;
+    AsyncMqttClientInternals::OnMessageUserCallback messageCallback;
+    AsyncMqttClientInternals::OnPublishUserCallback publishCallback;
+};
+
+#endif
@@ -0,0 +1,296 @@
+#include <Arduino.h>
+#include "HostHal.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct HostTask
+{
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool suspended = false;
+    bool deleted = false;
+    std::string name;
+    uint32_t stackDepth = 0;
+};
+
+struct HostQueue
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<uint8_t>> items;
+    UBaseType_t length = 0;
+    UBaseType_t itemSize = 0;
+};
+
+struct HostSemaphore
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool available = false;
+};
+
+// Task control blocks are never freed: detached threads may still be parked
+// on them while the process exits.
+static thread_local HostTask *currentTask = nullptr;
+
+// Parks the calling task while it is suspended. Returns true if it was.
+static bool parkIfSuspended(HostTask *task, std::unique_lock<std::mutex> &lock)
+{
+    if (!task->suspended)
+    {
+        return false;
+    }
+    task->wake.wait(lock, [task]
+                    { return !task->suspended; });
+    return true;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth, void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask, BaseType_t xCoreID)
+{
+    HostTask *task = new HostTask();
+    task->name = pcName ? pcName : "";
+    task->stackDepth = usStackDepth;
+    if (pxCreatedTask)
+    {
+        *pxCreatedTask = task;
+    }
+
+    std::thread([task, pvTaskCode, pvParameters]
+                {
+                    currentTask = task;
+                    {
+                        std::unique_lock<std::mutex> lock(task->mutex);
+                        parkIfSuspended(task, lock);
+                    }
+                    pvTaskCode(pvParameters);
+                    // Returning from a FreeRTOS task is an error; park forever instead.
+                    std::unique_lock<std::mutex> lock(task->mutex);
+                    task->wake.wait(lock, []
+                                    { return false; }); })
+        .detach();
+    std::this_thread::yield();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth, void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask)
+{
+    return xTaskCreatePinnedToCore(pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t xTask)
+{
+    HostTask *task = xTask ? xTask : currentTask;
+    if (!task)
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(task->mutex);
+    task->deleted = true;
+    task->suspended = true;
+    if (task == currentTask)
+    {
+        task->wake.wait(lock, []
+                        { return false; });
+    }
+}
+
+void vTaskSuspend(TaskHandle_t xTaskToSuspend)
+{
+    HostTask *task = xTaskToSuspend ? xTaskToSuspend : currentTask;
+    if (!task)
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(task->mutex);
+    task->suspended = true;
+    task->wake.notify_all();
+    if (task == currentTask)
+    {
+        parkIfSuspended(task, lock);
+    }
+}
+
+void vTaskResume(TaskHandle_t xTaskToResume)
+{
+    if (!xTaskToResume)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(xTaskToResume->mutex);
+    if (!xTaskToResume->deleted)
+    {
+        xTaskToResume->suspended = false;
+        xTaskToResume->wake.notify_all();
+    }
+}
+
+void vTaskDelay(TickType_t xTicksToDelay)
+{
+    HostTask *task = currentTask;
+    if (!task)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(xTicksToDelay));
+        return;
+    }
+
+    // As in FreeRTOS, suspending a delayed task cancels the delay: once it is
+    // resumed it runs again straight away.
+    std::unique_lock<std::mutex> lock(task->mutex);
+    if (task->wake.wait_for(lock, std::chrono::milliseconds(xTicksToDelay), [task]
+                            { return task->suspended; }))
+    {
+        parkIfSuspended(task, lock);
+    }
+}
+
+TickType_t xTaskGetTickCount()
+{
+    return (TickType_t)millis();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return currentTask;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask)
+{
+    HostTask *task = xTask ? xTask : currentTask;
+    return task ? task->stackDepth : 0;
+}
+
+size_t xPortGetFreeHeapSize()
+{
+    return 320 * 1024;
+}
+
+size_t xPortGetMinimumEverFreeHeapSize()
+{
+    return 320 * 1024;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize)
+{
+    HostQueue *queue = new HostQueue();
+    queue->length = uxQueueLength;
+    queue->itemSize = uxItemSize;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t xQueue)
+{
+    delete xQueue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+    std::unique_lock<std::mutex> lock(xQueue->mutex);
+    auto hasRoom = [xQueue]
+    { return xQueue->items.size() < xQueue->length; };
+    if (xTicksToWait == portMAX_DELAY)
+    {
+        xQueue->changed.wait(lock, hasRoom);
+    }
+    else if (!xQueue->changed.wait_for(lock, std::chrono::milliseconds(xTicksToWait), hasRoom))
+    {
+        return errQUEUE_FULL;
+    }
+    const uint8_t *item = static_cast<const uint8_t *>(pvItemToQueue);
+    xQueue->items.emplace_back(item, item + xQueue->itemSize);
+    xQueue->changed.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t xQueue, const void *pvItemToQueue, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    if (pxHigherPriorityTaskWoken)
+    {
+        *pxHigherPriorityTaskWoken = pdFALSE;
+    }
+    return xQueueSend(xQueue, pvItemToQueue, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+    std::unique_lock<std::mutex> lock(xQueue->mutex);
+    auto hasItem = [xQueue]
+    { return !xQueue->items.empty(); };
+    if (xTicksToWait == portMAX_DELAY)
+    {
+        xQueue->changed.wait(lock, hasItem);
+    }
+    else if (!xQueue->changed.wait_for(lock, std::chrono::milliseconds(xTicksToWait), hasItem))
+    {
+        return pdFALSE;
+    }
+    memcpy(pvBuffer, xQueue->items.front().data(), xQueue->itemSize);
+    xQueue->items.pop_front();
+    xQueue->changed.notify_all();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue)
+{
+    std::lock_guard<std::mutex> lock(xQueue->mutex);
+    return xQueue->items.size();
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    HostSemaphore *semaphore = new HostSemaphore();
+    semaphore->available = true;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+    return new HostSemaphore();
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t xSemaphore)
+{
+    delete xSemaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xTicksToWait)
+{
+    std::unique_lock<std::mutex> lock(xSemaphore->mutex);
+    auto available = [xSemaphore]
+    { return xSemaphore->available; };
+    if (xTicksToWait == portMAX_DELAY)
+    {
+        xSemaphore->changed.wait(lock, available);
+    }
+    else if (!xSemaphore->changed.wait_for(lock, std::chrono::milliseconds(xTicksToWait), available))
+    {
+        return pdFALSE;
+    }
+    xSemaphore->available = false;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore)
+{
+    std::lock_guard<std::mutex> lock(xSemaphore->mutex);
+    if (xSemaphore->available)
+    {
+        return pdFALSE;
+    }
+    xSemaphore->available = true;
+    xSemaphore->changed.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t xSemaphore, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    if (pxHigherPriorityTaskWoken)
+    {
+        *pxHigherPriorityTaskWoken = pdFALSE;
+    }
+    return xSemaphoreGive(xSemaphore);
+}
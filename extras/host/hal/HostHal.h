@@ -0,0 +1,116 @@
+#ifndef HOST_HAL_H
+#define HOST_HAL_H
+
+// Host-only controls and counters for the mock HAL. Firmware code never
+// includes this; drivers under extras/host use it to inject traffic and to
+// attribute time to each stage of the update path.
+
+#include <Arduino.h>
+#include <AsyncMqttClient.h>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace host
+{
+    uint64_t nowNanos();
+
+    // Runs work on the shared "async_tcp" dispatcher thread.
+    void runOnAsyncTcp(std::function<void()> work);
+    // Blocks until every queued dispatcher job has run.
+    void drainAsyncTcp();
+
+    struct NvsStats
+    {
+        uint64_t writes;
+        uint64_t bytesWritten;
+        uint64_t writeNanos;
+        uint64_t reads;
+    };
+
+    NvsStats nvsStats();
+    void setNvsWriteLatency(uint32_t micros);
+    void eraseNvs();
+
+    void setWiFiConnectDelay(uint32_t ms);
+    void dropWiFi();
+
+    void loraInject(const uint8_t *data, size_t len, int rssi = -60, float snr = 9.5f);
+    void onLoRaTransmit(std::function<void(const uint8_t *data, size_t len)> observer);
+
+    void setLogEcho(bool echo);
+
+    enum MqttTransport
+    {
+        MQTT_TRANSPORT_MEMORY, // the in-process MqttBroker below
+        MQTT_TRANSPORT_TCP     // a real broker, at the address given to setServer()
+    };
+
+    // Call before any client connects. Over TCP clients speak MQTT 3.1.1
+    // without TLS, so setSecure() is ignored, and MqttBroker sees nothing.
+    void setMqttTransport(MqttTransport transport);
+    MqttTransport mqttTransport();
+
+    struct MqttMessage
+    {
+        std::string clientId;
+        std::string topic;
+        std::string payload;
+        uint8_t qos;
+        bool retain;
+    };
+
+    struct MqttStats
+    {
+        uint64_t publishes;
+        uint64_t publishBytes;
+        uint64_t publishNanos;
+        uint64_t deliveries;
+        uint64_t subscribes;
+    };
+
+    // In-process broker shared by every AsyncMqttClient in the process.
+    class MqttBroker
+    {
+    public:
+        static MqttBroker &instance();
+
+        // Delivers a message to matching subscribers on the calling thread,
+        // split into chunkSize fragments the way AsyncMqttClient hands large
+        // payloads to onMessage. chunkSize == 0 delivers in one piece.
+        void inject(const char *topic, const char *payload, size_t len, size_t chunkSize = 0, uint8_t qos = 0, bool retain = false);
+        // Drops every connection as if the broker went away; wills are published.
+        void dropConnections();
+        void onPublish(std::function<void(const MqttMessage &)> observer);
+        bool retained(const char *topic, std::string &payload);
+        MqttStats stats();
+
+        static bool topicMatches(const std::string &filter, const std::string &topic);
+
+    private:
+        friend class ::AsyncMqttClient;
+
+        void attach(AsyncMqttClient *client);
+        void detach(AsyncMqttClient *client);
+        void connect(AsyncMqttClient *client);
+        void disconnect(AsyncMqttClient *client, bool graceful);
+        bool connected(const AsyncMqttClient *client);
+        void subscribe(AsyncMqttClient *client, const char *topic, uint8_t qos, uint16_t packetId);
+        void unsubscribe(AsyncMqttClient *client, const char *topic, uint16_t packetId);
+        bool publish(AsyncMqttClient *client, const char *topic, uint8_t qos, bool retain, const char *payload, size_t length, uint16_t packetId);
+        void deliver(const MqttMessage &message, size_t chunkSize, bool async);
+
+        std::recursive_mutex mutex;
+        std::set<AsyncMqttClient *> clients;
+        std::set<const AsyncMqttClient *> online;
+        std::map<const AsyncMqttClient *, std::set<std::string>> subscriptions;
+        std::map<std::string, std::string> retainedMessages;
+        std::vector<std::function<void(const MqttMessage &)>> observers;
+        MqttStats counters = {};
+    };
+}
+
+#endif
@@ -0,0 +1,158 @@
+#include <LoRa.h>
+#include "HostHal.h"
+#include <mutex>
+#include <vector>
+
+// SX127x FIFO limit.
+#define LORA_MAX_PKT_LENGTH 255
+
+LoRaClass LoRa;
+
+static std::mutex radioMutex;
+static std::vector<uint8_t> txPacket;
+static bool transmitting = false;
+static std::vector<uint8_t> rxPacket;
+static size_t rxIndex = 0;
+static int rxRssi = 0;
+static float rxSnr = 0;
+static void (*receiveCallback)(int) = nullptr;
+static void (*txDoneCallback)() = nullptr;
+static std::function<void(const uint8_t *, size_t)> *transmitObserver = new std::function<void(const uint8_t *, size_t)>();
+
+void host::loraInject(const uint8_t *data, size_t len, int rssi, float snr)
+{
+    void (*callback)(int);
+    {
+        std::lock_guard<std::mutex> lock(radioMutex);
+        rxPacket.assign(data, data + (len > LORA_MAX_PKT_LENGTH ? LORA_MAX_PKT_LENGTH : len));
+        rxIndex = 0;
+        rxRssi = rssi;
+        rxSnr = snr;
+        callback = receiveCallback;
+    }
+    if (callback)
+    {
+        callback((int)rxPacket.size());
+    }
+}
+
+void host::onLoRaTransmit(std::function<void(const uint8_t *data, size_t len)> observer)
+{
+    std::lock_guard<std::mutex> lock(radioMutex);
+    *transmitObserver = observer;
+}
+
+int LoRaClass::begin(long frequency)
+{
+    return 1;
+}
+
+int LoRaClass::beginPacket(int implicitHeader)
+{
+    std::lock_guard<std::mutex> lock(radioMutex);
+    if (transmitting)
+    {
+        return 0;
+    }
+    transmitting = true;
+    txPacket.clear();
+    return 1;
+}
+
+int LoRaClass::endPacket(bool async)
+{
+    std::vector<uint8_t> packet;
+    std::function<void(const uint8_t *, size_t)> observer;
+    void (*callback)();
+    {
+        std::lock_guard<std::mutex> lock(radioMutex);
+        if (!transmitting)
+        {
+            return 0;
+        }
+        transmitting = false;
+        packet.swap(txPacket);
+        observer = *transmitObserver;
+        callback = txDoneCallback;
+    }
+    if (observer)
+    {
+        observer(packet.data(), packet.size());
+    }
+    if (async && callback)
+    {
+        callback();
+    }
+    return 1;
+}
+
+int LoRaClass::parsePacket(int size)
+{
+    std::lock_guard<std::mutex> lock(radioMutex);
+    return (int)(rxPacket.size() - rxIndex);
+}
+
+int LoRaClass::packetRssi()
+{
+    return rxRssi;
+}
+
+float LoRaClass::packetSnr()
+{
+    return rxSnr;
+}
+
+size_t LoRaClass::write(uint8_t byte)
+{
+    return write(&byte, 1);
+}
+
+size_t LoRaClass::write(const uint8_t *buffer, size_t size)
+{
+    std::lock_guard<std::mutex> lock(radioMutex);
+    if (!transmitting)
+    {
+        return 0;
+    }
+    size_t room = LORA_MAX_PKT_LENGTH - txPacket.size();
+    if (size > room)
+    {
+        size = room;
+    }
+    txPacket.insert(txPacket.end(), buffer, buffer + size);
+    return size;
+}
+
+int LoRaClass::available()
+{
+    std::lock_guard<std::mutex> lock(radioMutex);
+    return (int)(rxPacket.size() - rxIndex);
+}
+
+int LoRaClass::read()
+{
+    std::lock_guard<std::mutex> lock(radioMutex);
+    return rxIndex < rxPacket.size() ? rxPacket[rxIndex++] : -1;
+}
+
+int LoRaClass::peek()
+{
+    std::lock_guard<std::mutex> lock(radioMutex);
+    return rxIndex < rxPacket.size() ? rxPacket[rxIndex] : -1;
+}
+
+void LoRaClass::onReceive(void (*callback)(int))
+{
+    std::lock_guard<std::mutex> lock(radioMutex);
+    receiveCallback = callback;
+}
+
+void LoRaClass::onTxDone(void (*callback)())
+{
+    std::lock_guard<std::mutex> lock(radioMutex);
+    txDoneCallback = callback;
+}
+
+void LoRaClass::receive(int size)
+{
+}
@@ -0,0 +1,52 @@
+#ifndef HOST_LORA_H
+#define HOST_LORA_H
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#define LORA_DEFAULT_SS_PIN 10
+#define LORA_DEFAULT_RESET_PIN 9
+#define LORA_DEFAULT_DIO0_PIN 2
+
+class LoRaClass : public Stream
+{
+public:
+    int begin(long frequency);
+    void end() {}
+
+    int beginPacket(int implicitHeader = false);
+    int endPacket(bool async = false);
+
+    int parsePacket(int size = 0);
+    int packetRssi();
+    float packetSnr();
+
+    size_t write(uint8_t byte) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    void flush() override {}
+
+    void onReceive(void (*callback)(int));
+    void onTxDone(void (*callback)());
+    void receive(int size = 0);
+    void idle() {}
+    void sleep() {}
+
+    void setPins(int ss = LORA_DEFAULT_SS_PIN, int reset = LORA_DEFAULT_RESET_PIN, int dio0 = LORA_DEFAULT_DIO0_PIN) {}
+    void setTxPower(int level, int outputPin = 1) {}
+    void setFrequency(long frequency) {}
+    void setSpreadingFactor(int sf) {}
+    void setSignalBandwidth(long sbw) {}
+    void setCodingRate4(int denominator) {}
+    void setSyncWord(int sw) {}
+    void enableCrc() {}
+    void disableCrc() {}
+};
+
+extern LoRaClass LoRa;
+
+#endif
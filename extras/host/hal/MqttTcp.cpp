@@ -0,0 +1,505 @@
+#include <AsyncMqttClient.h>
+#include "HostHal.h"
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+// A minimal MQTT 3.1.1 client for MQTT_TRANSPORT_TCP: enough of the protocol
+// for the library's traffic (QoS 0-2 both ways, retained messages, the Last
+// Will and keepalive), so the host build can be pointed at a real broker.
+
+static std::atomic<host::MqttTransport> transport(host::MQTT_TRANSPORT_MEMORY);
+
+void host::setMqttTransport(MqttTransport value)
+{
+    transport = value;
+}
+
+host::MqttTransport host::mqttTransport()
+{
+    return transport;
+}
+
+namespace
+{
+    enum PacketType : uint8_t
+    {
+        CONNECT = 1,
+        CONNACK = 2,
+        PUBLISH = 3,
+        PUBACK = 4,
+        PUBREC = 5,
+        PUBREL = 6,
+        PUBCOMP = 7,
+        SUBSCRIBE = 8,
+        SUBACK = 9,
+        UNSUBSCRIBE = 10,
+        UNSUBACK = 11,
+        PINGREQ = 12,
+        PINGRESP = 13,
+        DISCONNECT = 14
+    };
+
+    void putUint16(std::string &out, uint16_t value)
+    {
+        out.push_back((char)(value >> 8));
+        out.push_back((char)(value & 0xFF));
+    }
+
+    void putString(std::string &out, const std::string &value)
+    {
+        putUint16(out, (uint16_t)value.size());
+        out += value;
+    }
+
+    std::string packet(uint8_t header, const std::string &body)
+    {
+        std::string out(1, (char)header);
+        size_t length = body.size();
+        do
+        {
+            uint8_t digit = length % 128;
+            length /= 128;
+            out.push_back((char)(length > 0 ? digit | 0x80 : digit));
+        } while (length > 0);
+        return out + body;
+    }
+
+    uint16_t getUint16(const std::string &in, size_t at)
+    {
+        return at + 1 < in.size() ? (uint16_t)(((uint8_t)in[at] << 8) | (uint8_t)in[at + 1]) : 0;
+    }
+
+    int openSocket(const std::string &hostName, uint16_t port)
+    {
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *addresses = nullptr;
+        if (getaddrinfo(hostName.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+        {
+            return -1;
+        }
+        int fd = -1;
+        for (addrinfo *address = addresses; address != nullptr && fd < 0; address = address->ai_next)
+        {
+            fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (fd >= 0 && ::connect(fd, address->ai_addr, address->ai_addrlen) != 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+        return fd;
+    }
+}
+
+// One TCP connection. The reader thread owns the socket and keeps the session
+// alive; the client drops its reference when it disconnects or goes away.
+class host::MqttTcpSession : public std::enable_shared_from_this<host::MqttTcpSession>
+{
+public:
+    explicit MqttTcpSession(AsyncMqttClient *client) : client(client) {}
+
+    void start()
+    {
+        std::shared_ptr<MqttTcpSession> self = shared_from_this();
+        std::thread([self]
+                    { self->run(); })
+            .detach();
+    }
+
+    bool connected() const { return accepted && !closing; }
+    // The reader has stopped and reported the disconnect.
+    bool finished() const { return done; }
+
+    bool send(const std::string &data)
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        size_t sent = 0;
+        while (fd >= 0 && sent < data.size())
+        {
+            ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+            {
+                return false;
+            }
+            sent += n;
+        }
+        lastSentAt = nowNanos();
+        return fd >= 0;
+    }
+
+    // A graceful close sends DISCONNECT, so the broker drops the Last Will.
+    void close(bool graceful)
+    {
+        if (closing.exchange(true))
+        {
+            return;
+        }
+        if (graceful && accepted)
+        {
+            send(packet(DISCONNECT << 4, ""));
+        }
+        std::lock_guard<std::mutex> lock(writeMutex);
+        if (fd >= 0)
+        {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+
+    // The client is going away: nothing may call back into it any more.
+    void detach()
+    {
+        client = nullptr;
+        close(false);
+    }
+
+private:
+    void notify(std::function<void(AsyncMqttClient *client)> callback)
+    {
+        std::shared_ptr<MqttTcpSession> self = shared_from_this();
+        runOnAsyncTcp([self, callback]
+                      {
+                          AsyncMqttClient *target = self->client;
+                          if (target != nullptr)
+                          {
+                              callback(target);
+                          } });
+    }
+
+    void run()
+    {
+        AsyncMqttClientDisconnectReason reason = AsyncMqttClientDisconnectReason::TCP_DISCONNECTED;
+        AsyncMqttClient *owner = client;
+        int socket = WiFi.status() == WL_CONNECTED && owner != nullptr ? openSocket(owner->serverHost, owner->serverPort) : -1;
+        {
+            std::lock_guard<std::mutex> lock(writeMutex);
+            fd = socket;
+        }
+        if (socket >= 0 && !closing && sendConnect())
+        {
+            reason = receive();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(writeMutex);
+            fd = -1;
+        }
+        if (socket >= 0)
+        {
+            ::close(socket);
+        }
+        accepted = false;
+        closing = true;
+        done = true;
+        notify([reason](AsyncMqttClient *client)
+               {
+                   if (client->disconnectCallback)
+                   {
+                       client->disconnectCallback(reason);
+                   } });
+    }
+
+    bool sendConnect()
+    {
+        AsyncMqttClient *owner = client;
+        if (owner == nullptr)
+        {
+            return false;
+        }
+        keepAliveSeconds = owner->keepAlive;
+
+        uint8_t flags = 0x02; // clean session
+        std::string payload;
+        putString(payload, owner->clientId);
+        if (!owner->willTopic.empty())
+        {
+            flags |= 0x04 | (owner->willQos << 3) | (owner->willRetain ? 0x20 : 0);
+            putString(payload, owner->willTopic);
+            putString(payload, owner->willPayload);
+        }
+        if (!owner->username.empty())
+        {
+            flags |= 0x80;
+            putString(payload, owner->username);
+            if (!owner->password.empty())
+            {
+                flags |= 0x40;
+                putString(payload, owner->password);
+            }
+        }
+
+        std::string body;
+        putString(body, "MQTT");
+        body.push_back(4);
+        body.push_back((char)flags);
+        putUint16(body, keepAliveSeconds);
+        return send(packet(CONNECT << 4, body + payload));
+    }
+
+    // Reads packets until the connection ends and says why it did.
+    AsyncMqttClientDisconnectReason receive()
+    {
+        std::string buffer;
+        uint64_t pingEveryNanos = keepAliveSeconds * 500000000ULL;
+        for (;;)
+        {
+            pollfd input = {fd, POLLIN, 0};
+            if (poll(&input, 1, pingEveryNanos ? (int)std::min<uint64_t>(pingEveryNanos / 1000000, 1000) : 1000) < 0)
+            {
+                return AsyncMqttClientDisconnectReason::TCP_DISCONNECTED;
+            }
+            if (input.revents != 0)
+            {
+                char chunk[4096];
+                ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+                if (n <= 0)
+                {
+                    return AsyncMqttClientDisconnectReason::TCP_DISCONNECTED;
+                }
+                buffer.append(chunk, n);
+            }
+            if (closing)
+            {
+                return AsyncMqttClientDisconnectReason::TCP_DISCONNECTED;
+            }
+            if (accepted && pingEveryNanos != 0 && nowNanos() - lastSentAt >= pingEveryNanos)
+            {
+                send(packet(PINGREQ << 4, ""));
+            }
+
+            // Splits off every complete packet.
+            for (;;)
+            {
+                size_t length = 0;
+                size_t at = 1;
+                uint32_t scale = 1;
+                while (at < buffer.size() && at < 5)
+                {
+                    uint8_t digit = buffer[at++];
+                    length += (digit & 0x7F) * scale;
+                    scale *= 128;
+                    if ((digit & 0x80) == 0)
+                    {
+                        scale = 0;
+                        break;
+                    }
+                }
+                if (scale != 0 || buffer.size() < at + length)
+                {
+                    break;
+                }
+                uint8_t header = buffer[0];
+                std::string body = buffer.substr(at, length);
+                buffer.erase(0, at + length);
+                int8_t refused = handle(header, body);
+                if (refused != 0)
+                {
+                    return (AsyncMqttClientDisconnectReason)refused;
+                }
+            }
+        }
+    }
+
+    // Non-zero is a CONNACK return code, which maps onto the disconnect reasons.
+    int8_t handle(uint8_t header, const std::string &body)
+    {
+        uint16_t packetId = getUint16(body, 0);
+        switch (header >> 4)
+        {
+        case CONNACK:
+        {
+            int8_t code = body.size() > 1 ? body[1] : 3;
+            if (code != 0)
+            {
+                return code;
+            }
+            accepted = true;
+            bool sessionPresent = body[0] & 0x01;
+            notify([sessionPresent](AsyncMqttClient *client)
+                   {
+                       if (client->connectCallback)
+                       {
+                           client->connectCallback(sessionPresent);
+                       } });
+            break;
+        }
+        case PUBLISH:
+        {
+            AsyncMqttClientMessageProperties properties{(uint8_t)((header >> 1) & 0x03), (header & 0x08) != 0, (header & 0x01) != 0};
+            size_t topicLength = getUint16(body, 0);
+            size_t at = 2 + topicLength;
+            std::string topic = body.substr(2, topicLength);
+            uint16_t messageId = properties.qos > 0 ? getUint16(body, at) : 0;
+            std::string payload = body.substr(std::min(body.size(), at + (properties.qos > 0 ? 2 : 0)));
+            if (properties.qos == 1)
+            {
+                std::string ack;
+                putUint16(ack, messageId);
+                send(packet(PUBACK << 4, ack));
+            }
+            else if (properties.qos == 2)
+            {
+                std::string ack;
+                putUint16(ack, messageId);
+                send(packet(PUBREC << 4, ack));
+            }
+            notify([topic, payload, properties](AsyncMqttClient *client)
+                   {
+                       if (client->messageCallback)
+                       {
+                           std::string topicCopy = topic;
+                           std::string payloadCopy = payload;
+                           payloadCopy.push_back('\0');
+                           client->messageCallback(&topicCopy[0], &payloadCopy[0], properties, payload.size(), 0, payload.size());
+                       } });
+            break;
+        }
+        case PUBREC:
+        {
+            std::string release;
+            putUint16(release, packetId);
+            send(packet((PUBREL << 4) | 0x02, release));
+            break;
+        }
+        case PUBREL:
+        {
+            std::string complete;
+            putUint16(complete, packetId);
+            send(packet(PUBCOMP << 4, complete));
+            break;
+        }
+        case PUBACK:
+        case PUBCOMP:
+            notify([packetId](AsyncMqttClient *client)
+                   {
+                       if (client->publishCallback)
+                       {
+                           client->publishCallback(packetId);
+                       } });
+            break;
+        case SUBACK:
+        {
+            uint8_t qos = body.size() > 2 ? body[2] : 0x80;
+            notify([packetId, qos](AsyncMqttClient *client)
+                   {
+                       if (client->subscribeCallback)
+                       {
+                           client->subscribeCallback(packetId, qos);
+                       } });
+            break;
+        }
+        case UNSUBACK:
+            notify([packetId](AsyncMqttClient *client)
+                   {
+                       if (client->unsubscribeCallback)
+                       {
+                           client->unsubscribeCallback(packetId);
+                       } });
+            break;
+        default:
+            break;
+        }
+        return 0;
+    }
+
+    std::atomic<AsyncMqttClient *> client;
+    std::mutex writeMutex;
+    int fd = -1;
+    uint16_t keepAliveSeconds = 0;
+    std::atomic<bool> accepted{false};
+    std::atomic<bool> closing{false};
+    std::atomic<bool> done{false};
+    std::atomic<uint64_t> lastSentAt{0};
+};
+
+bool AsyncMqttClient::tcpConnected() const
+{
+    std::shared_ptr<host::MqttTcpSession> current = std::atomic_load(&session);
+    return current && current->connected();
+}
+
+// Like the ESP32 client, connect() returns at once and the outcome arrives
+// through onConnect or onDisconnect. A call while connecting does nothing.
+void AsyncMqttClient::tcpConnect()
+{
+    std::shared_ptr<host::MqttTcpSession> current = std::atomic_load(&session);
+    if (current && !current->finished())
+    {
+        return;
+    }
+    current = std::make_shared<host::MqttTcpSession>(this);
+    std::atomic_store(&session, current);
+    current->start();
+}
+
+void AsyncMqttClient::tcpDisconnect(bool force)
+{
+    std::shared_ptr<host::MqttTcpSession> current = std::atomic_load(&session);
+    if (current)
+    {
+        current->close(!force);
+    }
+}
+
+void AsyncMqttClient::tcpDetach()
+{
+    std::shared_ptr<host::MqttTcpSession> current = std::atomic_load(&session);
+    if (current)
+    {
+        current->detach();
+    }
+}
+
+uint16_t AsyncMqttClient::tcpSubscribe(const char *topic, uint8_t qos)
+{
+    std::shared_ptr<host::MqttTcpSession> current = std::atomic_load(&session);
+    if (!current || !current->connected())
+    {
+        return 0;
+    }
+    uint16_t packetId = takePacketId();
+    std::string body;
+    putUint16(body, packetId);
+    putString(body, topic);
+    body.push_back((char)qos);
+    return current->send(packet((SUBSCRIBE << 4) | 0x02, body)) ? packetId : 0;
+}
+
+uint16_t AsyncMqttClient::tcpUnsubscribe(const char *topic)
+{
+    std::shared_ptr<host::MqttTcpSession> current = std::atomic_load(&session);
+    if (!current || !current->connected())
+    {
+        return 0;
+    }
+    uint16_t packetId = takePacketId();
+    std::string body;
+    putUint16(body, packetId);
+    putString(body, topic);
+    return current->send(packet((UNSUBSCRIBE << 4) | 0x02, body)) ? packetId : 0;
+}
+
+uint16_t AsyncMqttClient::tcpPublish(const char *topic, uint8_t qos, bool retain, const char *payload, size_t length, uint16_t packetId)
+{
+    std::shared_ptr<host::MqttTcpSession> current = std::atomic_load(&session);
+    if (!current || !current->connected())
+    {
+        return 0;
+    }
+    std::string body;
+    putString(body, topic);
+    if (qos > 0)
+    {
+        putUint16(body, packetId);
+    }
+    body.append(payload ? payload : "", length);
+    return current->send(packet((PUBLISH << 4) | (qos << 1) | (retain ? 1 : 0), body)) ? packetId : 0;
+}
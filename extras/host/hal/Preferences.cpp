@@ -0,0 +1,242 @@
+#include <Preferences.h>
+#include "HostHal.h"
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// NVS limits keys to 15 characters and a namespace to a fixed number of entries.
+static const size_t NVS_KEY_NAME_MAX_SIZE = 15;
+static const size_t NVS_HOST_MAX_ENTRIES = 504;
+
+struct HostNvsNamespace
+{
+    struct Entry
+    {
+        PreferenceType type;
+        std::vector<uint8_t> bytes;
+    };
+
+    std::map<std::string, Entry> entries;
+};
+
+static std::mutex nvsMutex;
+static std::map<std::string, HostNvsNamespace *> *namespaces = new std::map<std::string, HostNvsNamespace *>();
+static std::atomic<uint32_t> writeLatencyMicros(0);
+static std::atomic<uint64_t> writes(0);
+static std::atomic<uint64_t> bytesWritten(0);
+static std::atomic<uint64_t> writeNanos(0);
+static std::atomic<uint64_t> reads(0);
+
+host::NvsStats host::nvsStats()
+{
+    return NvsStats{writes, bytesWritten, writeNanos, reads};
+}
+
+void host::setNvsWriteLatency(uint32_t micros)
+{
+    writeLatencyMicros = micros;
+}
+
+void host::eraseNvs()
+{
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    for (auto &ns : *namespaces)
+    {
+        ns.second->entries.clear();
+    }
+}
+
+static bool validKey(const char *key)
+{
+    return key && *key && strlen(key) <= NVS_KEY_NAME_MAX_SIZE;
+}
+
+bool Preferences::begin(const char *name, bool readOnly, const char *partition_label)
+{
+    if (ns || !validKey(name))
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    HostNvsNamespace *&slot = (*namespaces)[name];
+    if (!slot)
+    {
+        slot = new HostNvsNamespace();
+    }
+    ns = slot;
+    this->readOnly = readOnly;
+    return true;
+}
+
+void Preferences::end()
+{
+    ns = nullptr;
+}
+
+bool Preferences::clear()
+{
+    if (!ns || readOnly)
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    ns->entries.clear();
+    return true;
+}
+
+bool Preferences::remove(const char *key)
+{
+    if (!ns || readOnly || !validKey(key))
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    return ns->entries.erase(key) == 1;
+}
+
+size_t Preferences::putBytesOf(const char *key, PreferenceType type, const void *value, size_t len)
+{
+    if (!ns || readOnly || !validKey(key) || (!value && len))
+    {
+        return 0;
+    }
+
+    uint64_t start = host::nowNanos();
+    {
+        std::lock_guard<std::mutex> lock(nvsMutex);
+        if (ns->entries.size() >= NVS_HOST_MAX_ENTRIES && !ns->entries.count(key))
+        {
+            return 0;
+        }
+        HostNvsNamespace::Entry &entry = ns->entries[key];
+        entry.type = type;
+        entry.bytes.assign(static_cast<const uint8_t *>(value), static_cast<const uint8_t *>(value) + len);
+    }
+    if (writeLatencyMicros)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(writeLatencyMicros));
+    }
+    writes++;
+    bytesWritten += len;
+    writeNanos += host::nowNanos() - start;
+    return len;
+}
+
+size_t Preferences::putString(const char *key, const char *value)
+{
+    if (!value)
+    {
+        return 0;
+    }
+    // The real putString stores the terminator but reports strlen(value).
+    size_t len = strlen(value);
+    return putBytesOf(key, PT_STR, value, len + 1) ? len : 0;
+}
+
+bool Preferences::isKey(const char *key)
+{
+    return getType(key) != PT_INVALID;
+}
+
+PreferenceType Preferences::getType(const char *key)
+{
+    if (!ns || !validKey(key))
+    {
+        return PT_INVALID;
+    }
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    auto it = ns->entries.find(key);
+    return it == ns->entries.end() ? PT_INVALID : it->second.type;
+}
+
+bool Preferences::getBytesOf(const char *key, PreferenceType type, void *buf, size_t len)
+{
+    if (!ns || !validKey(key))
+    {
+        return false;
+    }
+    reads++;
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    auto it = ns->entries.find(key);
+    if (it == ns->entries.end() || it->second.type != type || it->second.bytes.size() != len)
+    {
+        return false;
+    }
+    memcpy(buf, it->second.bytes.data(), len);
+    return true;
+}
+
+size_t Preferences::getString(const char *key, char *value, size_t maxLen)
+{
+    if (!ns || !validKey(key) || !value)
+    {
+        return 0;
+    }
+    reads++;
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    auto it = ns->entries.find(key);
+    if (it == ns->entries.end() || it->second.type != PT_STR || it->second.bytes.size() > maxLen)
+    {
+        return 0;
+    }
+    memcpy(value, it->second.bytes.data(), it->second.bytes.size());
+    return it->second.bytes.size();
+}
+
+String Preferences::getString(const char *key, String defaultValue)
+{
+    if (!ns || !validKey(key))
+    {
+        return defaultValue;
+    }
+    reads++;
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    auto it = ns->entries.find(key);
+    if (it == ns->entries.end() || it->second.type != PT_STR || it->second.bytes.empty())
+    {
+        return defaultValue;
+    }
+    return String(reinterpret_cast<const char *>(it->second.bytes.data()));
+}
+
+size_t Preferences::getBytesLength(const char *key)
+{
+    if (!ns || !validKey(key))
+    {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    auto it = ns->entries.find(key);
+    return it == ns->entries.end() || it->second.type != PT_BLOB ? 0 : it->second.bytes.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen)
+{
+    if (!ns || !validKey(key) || !buf)
+    {
+        return 0;
+    }
+    reads++;
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    auto it = ns->entries.find(key);
+    if (it == ns->entries.end() || it->second.type != PT_BLOB || it->second.bytes.size() > maxLen)
+    {
+        return 0;
+    }
+    memcpy(buf, it->second.bytes.data(), it->second.bytes.size());
+    return it->second.bytes.size();
+}
+
+size_t Preferences::freeEntries()
+{
+    if (!ns)
+    {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    return NVS_HOST_MAX_ENTRIES - ns->entries.size();
+}
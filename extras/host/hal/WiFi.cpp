@@ -0,0 +1,105 @@
+#include <WiFi.h>
+#include "HostHal.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+WiFiClass WiFi;
+
+struct WiFiListener
+{
+    WiFiEventCb callback;
+    WiFiEvent_t event;
+};
+
+static std::mutex listenersMutex;
+static std::mutex eventLoopMutex;
+static std::vector<WiFiListener> *listeners = new std::vector<WiFiListener>();
+static std::atomic<wl_status_t> wifiStatus(WL_DISCONNECTED);
+static std::atomic<bool> connecting(false);
+static std::atomic<uint32_t> connectDelayMs(10);
+
+// Events are raised on their own thread, like the ESP32 system event task, so
+// handlers may suspend the task that triggered them.
+static void raiseEvent(WiFiEvent_t event)
+{
+    std::thread([event]
+                {
+                    std::lock_guard<std::mutex> loop(eventLoopMutex);
+                    std::vector<WiFiListener> snapshot;
+                    {
+                        std::lock_guard<std::mutex> lock(listenersMutex);
+                        snapshot = *listeners;
+                    }
+                    for (const WiFiListener &listener : snapshot)
+                    {
+                        if (listener.event == SYSTEM_EVENT_MAX || listener.event == event)
+                        {
+                            listener.callback(event);
+                        }
+                    } })
+        .detach();
+}
+
+void host::setWiFiConnectDelay(uint32_t ms)
+{
+    connectDelayMs = ms;
+}
+
+void host::dropWiFi()
+{
+    if (wifiStatus.exchange(WL_CONNECTION_LOST) == WL_CONNECTED)
+    {
+        MqttBroker::instance().dropConnections();
+        raiseEvent(SYSTEM_EVENT_STA_DISCONNECTED);
+    }
+}
+
+String IPAddress::toString() const
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+    return String(buf);
+}
+
+int WiFiClass::onEvent(WiFiEventCb cbEvent, WiFiEvent_t event)
+{
+    std::lock_guard<std::mutex> lock(listenersMutex);
+    listeners->push_back({cbEvent, event});
+    return (int)listeners->size();
+}
+
+wl_status_t WiFiClass::begin(const char *ssid, const char *passphrase)
+{
+    if (wifiStatus == WL_CONNECTED || connecting.exchange(true))
+    {
+        return wifiStatus;
+    }
+    std::thread([]
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(connectDelayMs));
+                    wifiStatus = WL_CONNECTED;
+                    connecting = false;
+                    raiseEvent(SYSTEM_EVENT_STA_GOT_IP); })
+        .detach();
+    return wifiStatus;
+}
+
+bool WiFiClass::disconnect(bool wifiOff)
+{
+    host::dropWiFi();
+    wifiStatus = WL_DISCONNECTED;
+    return true;
+}
+
+wl_status_t WiFiClass::status()
+{
+    return wifiStatus;
+}
+
+IPAddress WiFiClass::localIP()
+{
+    return wifiStatus == WL_CONNECTED ? IPAddress(127, 0, 0, 1) : IPAddress();
+}
@@ -0,0 +1,29 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+// Host stand-in for the FreeRTOS kernel types used by the library. Tasks map
+// onto std::thread; suspension is honoured at vTaskDelay/vTaskSuspend points.
+
+#include <cstddef>
+#include <cstdint>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdPASS (pdTRUE)
+#define pdFAIL (pdFALSE)
+#define errQUEUE_FULL ((BaseType_t)0)
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS ((TickType_t)1)
+#define pdMS_TO_TICKS(xTimeInMs) ((TickType_t)(xTimeInMs))
+#define tskNO_AFFINITY ((BaseType_t)0x7FFFFFFF)
+#define portYIELD_FROM_ISR(...) ((void)0)
+
+// The host heap is not bounded; these report a fixed ESP32-sized heap.
+size_t xPortGetFreeHeapSize();
+size_t xPortGetMinimumEverFreeHeapSize();
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef HOST_LOGGER_H
+#define HOST_LOGGER_H
+
+#include <Arduino.h>
+
+namespace logging
+{
+    enum class LoggerLevel
+    {
+        LOGGER_LEVEL_DEBUG,
+        LOGGER_LEVEL_INFO,
+        LOGGER_LEVEL_WARN,
+        LOGGER_LEVEL_ERROR
+    };
+
+    class Logger
+    {
+    public:
+        void log(LoggerLevel level, const char *module, const char *message);
+    };
+}
+
+#endif
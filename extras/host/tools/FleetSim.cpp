@@ -0,0 +1,657 @@
+// Runs a fleet of simulated devices against a real MQTT broker and reports
+// what the broker and the devices see under load. Every device is the
+// library itself, built against the host HAL with its MQTT client switched
+// to TCP, in a process of its own:
+//
+//   mosquitto -p 1883 &
+//   fleet_sim --devices 50 --params 32 --update-rate 100 --duration 60
+//
+//   fleet_sim [--devices N] [--params N] [--keys N] [--update-rate N]
+//             [--duration SECONDS] [--drain SECONDS] [--heartbeat-ms MS]
+//             [--metrics-ms MS] [--group-pct PCT] [--invalid-pct PCT]
+//             [--duplicate-pct PCT] [--host HOST] [--port PORT]
+//             [--user USER] [--password PASSWORD]
+//
+// The controller sends --update-rate updates a second across the fleet, each
+// changing --keys parameters of a random device. The mix percentages turn
+// some of them into updates to the "sim" group every device joins, updates
+// naming a parameter that does not exist, or redeliveries of an earlier
+// update. It reports broker message rates from mosquitto's $SYS counters
+// (published every sys_interval, 10 s by default), round-trip times from
+// update to confirmation, and the memory of each device process. The exit
+// status is 0 only if every update was answered as expected.
+
+#include "AsyncParamUpdate.h"
+#include "HostHal.h"
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define SIM_DEVICE_PREFIX "sim-"
+#define SIM_GROUP "sim"
+
+namespace
+{
+    enum UpdateKind
+    {
+        UPDATE_DIRECT,
+        UPDATE_GROUP,
+        UPDATE_INVALID,
+        UPDATE_DUPLICATE,
+        UPDATE_KINDS
+    };
+
+    const char *const kindNames[UPDATE_KINDS] = {"direct", "group", "invalid", "duplicate"};
+
+    struct Options
+    {
+        size_t devices = 10;
+        size_t params = 16;
+        size_t keys = 1;
+        double updateRate = 20;
+        double durationSeconds = 30;
+        double drainSeconds = 5;
+        uint32_t heartbeatMillis = 5000;
+        uint32_t metricsMillis = 0;
+        uint32_t groupPercent = 5;
+        uint32_t invalidPercent = 5;
+        uint32_t duplicatePercent = 5;
+        std::string host = "localhost";
+        uint16_t port = 1883;
+        std::string user;
+        std::string password;
+    };
+
+    class Series
+    {
+    public:
+        void add(uint64_t nanos) { samples.push_back(nanos / 1e6); }
+
+        void report(const char *label)
+        {
+            if (samples.empty())
+            {
+                return;
+            }
+            std::sort(samples.begin(), samples.end());
+            double total = 0;
+            for (double sample : samples)
+            {
+                total += sample;
+            }
+            printf("    %-20s %8zu %10.2f %10.2f %10.2f %10.2f %10.2f\n", label, samples.size(), total / samples.size(),
+                   percentile(0.50), percentile(0.90), percentile(0.99), samples.back());
+        }
+
+    private:
+        double percentile(double p) const
+        {
+            return samples[std::min(samples.size() - 1, (size_t)(samples.size() * p))];
+        }
+
+        std::vector<double> samples;
+    };
+
+    bool parseOptions(int argc, char **argv, Options &options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--devices" && hasValue)
+            {
+                options.devices = strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--params" && hasValue)
+            {
+                options.params = strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--keys" && hasValue)
+            {
+                options.keys = strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--update-rate" && hasValue)
+            {
+                options.updateRate = strtod(argv[++i], nullptr);
+            }
+            else if (arg == "--duration" && hasValue)
+            {
+                options.durationSeconds = strtod(argv[++i], nullptr);
+            }
+            else if (arg == "--drain" && hasValue)
+            {
+                options.drainSeconds = strtod(argv[++i], nullptr);
+            }
+            else if (arg == "--heartbeat-ms" && hasValue)
+            {
+                options.heartbeatMillis = strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--metrics-ms" && hasValue)
+            {
+                options.metricsMillis = strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--group-pct" && hasValue)
+            {
+                options.groupPercent = strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--invalid-pct" && hasValue)
+            {
+                options.invalidPercent = strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--duplicate-pct" && hasValue)
+            {
+                options.duplicatePercent = strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--host" && hasValue)
+            {
+                options.host = argv[++i];
+            }
+            else if (arg == "--port" && hasValue)
+            {
+                options.port = strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--user" && hasValue)
+            {
+                options.user = argv[++i];
+            }
+            else if (arg == "--password" && hasValue)
+            {
+                options.password = argv[++i];
+            }
+            else
+            {
+                options.devices = 0;
+                break;
+            }
+        }
+        if (options.devices == 0 || options.params == 0 || options.keys == 0 || options.keys > options.params ||
+            options.groupPercent + options.invalidPercent + options.duplicatePercent > 100)
+        {
+            fprintf(stderr, "usage: %s [--devices N] [--params N] [--keys N] [--update-rate N] [--duration SECONDS] [--drain SECONDS] "
+                            "[--heartbeat-ms MS] [--metrics-ms MS] [--group-pct PCT] [--invalid-pct PCT] [--duplicate-pct PCT] "
+                            "[--host HOST] [--port PORT] [--user USER] [--password PASSWORD]\n",
+                    argv[0]);
+            return false;
+        }
+        return true;
+    }
+
+    std::string deviceName(size_t index)
+    {
+        return SIM_DEVICE_PREFIX + std::to_string(index);
+    }
+
+    // The library keeps a single instance per process, so each device runs
+    // in a child forked before the controller starts any thread. It waits
+    // for the controller to close the start pipe and runs until SIGTERM.
+    [[noreturn]] void runDevice(const Options &options, size_t index, int startPipe)
+    {
+        sigset_t stop;
+        sigemptyset(&stop);
+        sigaddset(&stop, SIGTERM);
+        sigprocmask(SIG_BLOCK, &stop, nullptr);
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+        char byte;
+        while (read(startPipe, &byte, 1) > 0)
+        {
+        }
+        close(startPipe);
+
+        host::setMqttTransport(host::MQTT_TRANSPORT_TCP);
+        static std::string name = deviceName(index);
+        static AsyncParamUpdate device("sim-ssid", "sim-password", options.host.c_str(), options.port, options.user.c_str(), options.password.c_str(), name.c_str(), false);
+        device.setHeartbeatInterval(options.heartbeatMillis);
+        device.setMetricsInterval(options.metricsMillis);
+        device.joinGroup(SIM_GROUP);
+        device.begin();
+
+        static std::vector<int> values(options.params);
+        device.beginRegistration();
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            device.addParameter("p" + std::to_string(i), values[i]);
+        }
+        device.commitRegistration();
+
+        int signal;
+        sigwait(&stop, &signal);
+        _exit(0);
+    }
+
+    struct Memory
+    {
+        size_t rssKb = 0;
+        size_t peakKb = 0;
+        size_t pssKb = 0;
+    };
+
+    size_t procField(const std::string &path, const char *field)
+    {
+        std::ifstream in(path);
+        std::string line;
+        size_t length = strlen(field);
+        while (std::getline(in, line))
+        {
+            if (line.compare(0, length, field) == 0)
+            {
+                return strtoul(line.c_str() + length, nullptr, 10);
+            }
+        }
+        return 0;
+    }
+
+    // Pss splits the pages the forked devices still share between them.
+    Memory processMemory(pid_t pid)
+    {
+        std::string proc = "/proc/" + std::to_string(pid);
+        Memory memory;
+        memory.rssKb = procField(proc + "/status", "VmRSS:");
+        memory.peakKb = procField(proc + "/status", "VmHWM:");
+        memory.pssKb = procField(proc + "/smaps_rollup", "Pss:");
+        return memory;
+    }
+
+    // What the controller knows about one update id. A redelivery reuses the
+    // id, so it adds a send and expects one more answer.
+    struct Update
+    {
+        std::vector<std::pair<uint64_t, UpdateKind>> sends;
+        std::string topic;
+        std::string payload;
+        size_t expected = 0;
+        size_t answered = 0;
+        bool shouldApply = true;
+    };
+
+    class Controller
+    {
+    public:
+        explicit Controller(const Options &options) : options(options) {}
+
+        void onMessage(const std::string &topic, const std::string &payload, bool retained)
+        {
+            uint64_t now = host::nowNanos();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (topic.compare(0, strlen("$SYS/"), "$SYS/") == 0)
+            {
+                brokerCounter(topic, strtoull(payload.c_str(), nullptr, 10), now);
+                return;
+            }
+            if (!measuring || retained)
+            {
+                if (topic.size() > strlen(STATUS_SUFFIX) && topic.compare(topic.size() - strlen(STATUS_SUFFIX), std::string::npos, STATUS_SUFFIX) == 0 &&
+                    payload.find("\"online\"") != std::string::npos && !retained)
+                {
+                    online.insert(topic);
+                }
+                return;
+            }
+            fleetMessages++;
+            fleetBytes += payload.size();
+
+            bool confirmation = topic == GROUPS_PREFIX SIM_GROUP GROUP_ACK_SUFFIX ||
+                                (topic.size() > strlen(CONFIRMATION_SUFFIX) && topic.compare(topic.size() - strlen(CONFIRMATION_SUFFIX), std::string::npos, CONFIRMATION_SUFFIX) == 0);
+            if (!confirmation)
+            {
+                return;
+            }
+            JsonDocument doc;
+            if (deserializeJson(doc, payload))
+            {
+                return;
+            }
+            auto update = updates.find(doc["id"] | "");
+            if (update == updates.end() || update->second.answered >= update->second.expected)
+            {
+                unexpectedAnswers++;
+                return;
+            }
+            Update &sent = update->second;
+            bool group = sent.sends.front().second == UPDATE_GROUP;
+            const auto &send = sent.sends[group ? 0 : std::min(sent.answered, sent.sends.size() - 1)];
+            rtt[send.second].add(now - send.first);
+            sent.answered++;
+            if ((strcmp(doc["status"] | "", "updated") == 0) != sent.shouldApply)
+            {
+                wrongAnswers++;
+            }
+        }
+
+        // Waits for each device to announce itself after connecting.
+        void waitOnline(double seconds)
+        {
+            uint64_t startedAt = host::nowNanos();
+            std::unique_lock<std::mutex> lock(mutex);
+            while (online.size() < options.devices && host::nowNanos() - startedAt < seconds * 1e9)
+            {
+                lock.unlock();
+                delay(10);
+                lock.lock();
+            }
+            onlineNanos = host::nowNanos() - startedAt;
+        }
+
+        void run(AsyncMqttClient &client)
+        {
+            std::mt19937 random(getpid());
+            std::string run = std::to_string(getpid());
+            uint64_t startedAt = host::nowNanos();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                measuring = true;
+            }
+
+            std::vector<std::string> directIds;
+            size_t total = (size_t)(options.updateRate * options.durationSeconds);
+            for (size_t n = 0; n < total; n++)
+            {
+                uint64_t due = startedAt + (uint64_t)(n * 1e9 / options.updateRate);
+                uint64_t now = host::nowNanos();
+                if (now < due)
+                {
+                    std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+                }
+
+                UpdateKind kind = pickKind(random() % 100);
+                if (kind == UPDATE_DUPLICATE && directIds.empty())
+                {
+                    kind = UPDATE_DIRECT;
+                }
+                std::string id;
+                Update update;
+                if (kind == UPDATE_DUPLICATE)
+                {
+                    id = directIds[random() % directIds.size()];
+                }
+                else
+                {
+                    id = run + "-" + std::to_string(n);
+                    update = makeUpdate(kind, id, random);
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                Update &entry = kind == UPDATE_DUPLICATE ? updates[id] : (updates[id] = update);
+                entry.sends.push_back({host::nowNanos(), kind});
+                entry.expected += kind == UPDATE_GROUP ? options.devices : 1;
+                if (kind == UPDATE_DIRECT)
+                {
+                    directIds.push_back(id);
+                }
+                sent[kind]++;
+                if (client.publish(entry.topic.c_str(), 1, false, entry.payload.c_str(), entry.payload.size()) == 0)
+                {
+                    entry.expected -= kind == UPDATE_GROUP ? options.devices : 1;
+                    entry.sends.pop_back();
+                    publishFailures++;
+                }
+            }
+
+            uint64_t drainUntil = host::nowNanos() + (uint64_t)(options.drainSeconds * 1e9);
+            while (host::nowNanos() < drainUntil && outstanding() > 0)
+            {
+                delay(10);
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            measuring = false;
+            measuredNanos = host::nowNanos() - startedAt;
+        }
+
+        // Prints the summary; true if every update was answered as expected.
+        bool report(const std::vector<Memory> &memory)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            double seconds = measuredNanos / 1e9;
+            size_t expected = 0;
+            size_t answered = 0;
+            for (const auto &update : updates)
+            {
+                expected += update.second.expected;
+                answered += update.second.answered;
+            }
+
+            printf("fleet: %zu devices x %zu params, %.0f updates/s of %zu keys for %.0f s, heartbeat %u ms, metrics %u ms\n",
+                   options.devices, options.params, options.updateRate, options.keys, options.durationSeconds, options.heartbeatMillis, options.metricsMillis);
+            printf("  devices online         %10zu/%zu in %.2f s\n", online.size(), options.devices, onlineNanos / 1e9);
+            printf("  updates sent           %10zu direct %6zu group %6zu invalid %6zu duplicate %6zu refused by client\n",
+                   sent[UPDATE_DIRECT], sent[UPDATE_GROUP], sent[UPDATE_INVALID], sent[UPDATE_DUPLICATE], publishFailures);
+            printf("  answers                %10zu/%zu received %6zu wrong status %6zu unexpected\n", answered, expected, wrongAnswers, unexpectedAnswers);
+            printf("  round trip (ms)        %8s %10s %10s %10s %10s %10s\n", "count", "mean", "p50", "p90", "p99", "max");
+            for (int kind = 0; kind < UPDATE_KINDS; kind++)
+            {
+                rtt[kind].report(kindNames[kind]);
+            }
+
+            printf("  fleet traffic          %10.0f msg/s %10.0f bytes/s on boards/#\n", fleetMessages / seconds, fleetBytes / seconds);
+            for (const auto &counter : brokerCounters)
+            {
+                const BrokerCounter &samples = counter.second;
+                if (samples.lastAt > samples.firstAt)
+                {
+                    printf("  broker %-15s %10.0f msg/s\n", counter.first.c_str(), (samples.last - samples.first) / ((samples.lastAt - samples.firstAt) / 1e9));
+                }
+            }
+            if (brokerCounters.empty() || brokerCounters.begin()->second.lastAt == brokerCounters.begin()->second.firstAt)
+            {
+                printf("  broker                 no $SYS/broker/messages counters seen twice; run longer than sys_interval\n");
+            }
+
+            Memory total;
+            Memory largest;
+            for (const Memory &device : memory)
+            {
+                total.rssKb += device.rssKb;
+                total.peakKb += device.peakKb;
+                total.pssKb += device.pssKb;
+                largest.rssKb = std::max(largest.rssKb, device.rssKb);
+                largest.peakKb = std::max(largest.peakKb, device.peakKb);
+                largest.pssKb = std::max(largest.pssKb, device.pssKb);
+            }
+            if (!memory.empty())
+            {
+                printf("  device memory (kB)     %10s %10s\n", "mean", "max");
+                printf("    %-20s %10zu %10zu\n", "rss", total.rssKb / memory.size(), largest.rssKb);
+                printf("    %-20s %10zu %10zu\n", "rss peak", total.peakKb / memory.size(), largest.peakKb);
+                printf("    %-20s %10zu %10zu\n", "pss", total.pssKb / memory.size(), largest.pssKb);
+            }
+            return answered == expected && wrongAnswers == 0 && publishFailures == 0;
+        }
+
+    private:
+        struct BrokerCounter
+        {
+            uint64_t first = 0;
+            uint64_t firstAt = 0;
+            uint64_t last = 0;
+            uint64_t lastAt = 0;
+        };
+
+        // Only samples taken while updates are sent count towards the rate.
+        void brokerCounter(const std::string &topic, uint64_t value, uint64_t now)
+        {
+            if (!measuring)
+            {
+                return;
+            }
+            BrokerCounter &counter = brokerCounters[topic.substr(topic.rfind('/') + 1)];
+            if (counter.firstAt == 0)
+            {
+                counter.first = value;
+                counter.firstAt = now;
+            }
+            counter.last = value;
+            counter.lastAt = now;
+        }
+
+        UpdateKind pickKind(uint32_t roll) const
+        {
+            if (roll < options.groupPercent)
+            {
+                return UPDATE_GROUP;
+            }
+            roll -= options.groupPercent;
+            if (roll < options.invalidPercent)
+            {
+                return UPDATE_INVALID;
+            }
+            roll -= options.invalidPercent;
+            return roll < options.duplicatePercent ? UPDATE_DUPLICATE : UPDATE_DIRECT;
+        }
+
+        Update makeUpdate(UpdateKind kind, const std::string &id, std::mt19937 &random) const
+        {
+            Update update;
+            update.topic = kind == UPDATE_GROUP ? GROUPS_PREFIX SIM_GROUP : BOARDS_PREFIX + deviceName(random() % options.devices);
+            update.shouldApply = kind != UPDATE_INVALID;
+
+            JsonDocument doc;
+            doc["id"] = id;
+            JsonObject parameters = doc["parameters"].to<JsonObject>();
+            size_t first = random() % options.params;
+            for (size_t i = 0; i < options.keys; i++)
+            {
+                parameters["p" + std::to_string((first + i) % options.params)] = (int)(random() % 100000);
+            }
+            if (kind == UPDATE_INVALID)
+            {
+                parameters["missing"] = 1;
+            }
+            serializeJson(doc, update.payload);
+            return update;
+        }
+
+        size_t outstanding()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t missing = 0;
+            for (const auto &update : updates)
+            {
+                missing += update.second.expected - update.second.answered;
+            }
+            return missing;
+        }
+
+        const Options &options;
+        std::mutex mutex;
+        std::set<std::string> online;
+        std::map<std::string, Update> updates;
+        std::map<std::string, BrokerCounter> brokerCounters;
+        Series rtt[UPDATE_KINDS];
+        size_t sent[UPDATE_KINDS] = {};
+        bool measuring = false;
+        uint64_t onlineNanos = 0;
+        uint64_t measuredNanos = 0;
+        size_t fleetMessages = 0;
+        size_t fleetBytes = 0;
+        size_t wrongAnswers = 0;
+        size_t unexpectedAnswers = 0;
+        size_t publishFailures = 0;
+    };
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        return 2;
+    }
+
+    int startPipe[2];
+    if (pipe(startPipe) != 0)
+    {
+        perror("pipe");
+        return 1;
+    }
+    std::vector<pid_t> devices;
+    for (size_t i = 0; i < options.devices; i++)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            perror("fork");
+            break;
+        }
+        if (pid == 0)
+        {
+            close(startPipe[1]);
+            runDevice(options, i, startPipe[0]);
+        }
+        devices.push_back(pid);
+    }
+    close(startPipe[0]);
+
+    host::setMqttTransport(host::MQTT_TRANSPORT_TCP);
+    Controller controller(options);
+    std::atomic<int> subscriptions(0);
+    static AsyncMqttClient client;
+    std::string clientId = "fleet-sim-" + std::to_string(getpid());
+    client.setServer(options.host.c_str(), options.port);
+    client.setClientId(clientId.c_str());
+    if (!options.user.empty())
+    {
+        client.setCredentials(options.user.c_str(), options.password.c_str());
+    }
+    client.onConnect([&](bool sessionPresent)
+                     {
+                         client.subscribe("$SYS/broker/messages/+", 0);
+                         client.subscribe(BOARDS_PREFIX "#", 0); });
+    client.onSubscribe([&](uint16_t packetId, uint8_t qos)
+                       { subscriptions++; });
+    client.onMessage([&](char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)
+                     { controller.onMessage(topic, std::string(payload, len), properties.retain); });
+
+    WiFi.begin("sim-ssid", "sim-password");
+    for (int i = 0; i < 500 && subscriptions < 2; i++)
+    {
+        if (i % 100 == 0 && WiFi.status() == WL_CONNECTED)
+        {
+            client.connect();
+        }
+        delay(10);
+    }
+
+    bool passed = false;
+    if (subscriptions < 2)
+    {
+        fprintf(stderr, "could not subscribe on %s:%u\n", options.host.c_str(), options.port);
+    }
+    else
+    {
+        close(startPipe[1]);
+        controller.waitOnline(30);
+        controller.run(client);
+
+        std::vector<Memory> memory;
+        for (pid_t pid : devices)
+        {
+            memory.push_back(processMemory(pid));
+        }
+        passed = controller.report(memory);
+    }
+
+    close(startPipe[1]);
+    for (pid_t pid : devices)
+    {
+        kill(pid, SIGTERM);
+    }
+    for (pid_t pid : devices)
+    {
+        waitpid(pid, nullptr, 0);
+    }
+    client.disconnect();
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+// Collects the confirmations of one group update and reports which devices
+// applied it, which failed and which never answered. Confirmations are read
+// from standard input, one per line, as printed by mosquitto_sub with or
+// without -v:
+//
+//   mosquitto_sub -h broker -t 'boards/groups/kitchen/ack' -v |
+//       group_ack_aggregator --id rollout-7 --devices kitchen.txt --timeout 30
+//
+//   group_ack_aggregator --id ID (--devices FILE | --expect N)
+//                        [--timeout SECONDS] [--quiet]
+//
+// --devices lists the group's members, one per line, so stragglers can be
+// named; with --expect only their number is known. The tool exits once every
+// member has answered or the timeout expires, with status 0 only if every
+// member applied the update.
+
+#include <ArduinoJson.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct Options
+    {
+        std::string id;
+        std::string devicesFile;
+        size_t expected = 0;
+        double timeoutSeconds = 60;
+        bool quiet = false;
+    };
+
+    bool parseOptions(int argc, char **argv, Options &options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--id" && hasValue)
+            {
+                options.id = argv[++i];
+            }
+            else if (arg == "--devices" && hasValue)
+            {
+                options.devicesFile = argv[++i];
+            }
+            else if (arg == "--expect" && hasValue)
+            {
+                options.expected = strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--timeout" && hasValue)
+            {
+                options.timeoutSeconds = strtod(argv[++i], nullptr);
+            }
+            else if (arg == "--quiet")
+            {
+                options.quiet = true;
+            }
+            else
+            {
+                options.id.clear();
+                break;
+            }
+        }
+        if (options.id.empty() || (options.devicesFile.empty() && options.expected == 0))
+        {
+            fprintf(stderr, "usage: %s --id ID (--devices FILE | --expect N) [--timeout SECONDS] [--quiet]\n", argv[0]);
+            return false;
+        }
+        return true;
+    }
+
+    std::set<std::string> loadDevices(const std::string &path)
+    {
+        std::set<std::string> devices;
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+            {
+                line.pop_back();
+            }
+            if (!line.empty() && line[0] != '#')
+            {
+                devices.insert(line);
+            }
+        }
+        return devices;
+    }
+
+    class AckTracker
+    {
+    public:
+        AckTracker(const std::string &id, const std::set<std::string> &members, size_t expected)
+            : id(id), members(members), expected(members.empty() ? expected : members.size()) {}
+
+        // Lines that are not a confirmation of this update are ignored.
+        // mosquitto_sub -v puts the topic before the payload.
+        bool add(const std::string &line, double elapsed)
+        {
+            size_t start = line.find('{');
+            if (start == std::string::npos)
+            {
+                return false;
+            }
+            JsonDocument doc;
+            if (deserializeJson(doc, line.c_str() + start) || id != (doc["id"] | ""))
+            {
+                return false;
+            }
+            std::string device = doc["Device"] | "";
+            if (device.empty() || answers.count(device) > 0)
+            {
+                return false;
+            }
+            if (!members.empty() && members.count(device) == 0)
+            {
+                strangers.insert(device);
+                return false;
+            }
+            answers[device] = Answer{strcmp(doc["status"] | "", "updated") == 0, elapsed};
+            return true;
+        }
+
+        bool complete() const { return answers.size() >= expected; }
+
+        // Prints the summary; true if every member applied the update.
+        bool report(double elapsed) const
+        {
+            std::vector<std::string> failed;
+            std::vector<double> times;
+            for (const auto &answer : answers)
+            {
+                if (!answer.second.updated)
+                {
+                    failed.push_back(answer.first);
+                }
+                times.push_back(answer.second.at);
+            }
+            std::sort(times.begin(), times.end());
+
+            size_t missing = expected > answers.size() ? expected - answers.size() : 0;
+            printf("update %s: %zu/%zu answered, %zu updated, %zu failed, %zu missing after %.1f s\n", id.c_str(), answers.size(), expected,
+                   answers.size() - failed.size(), failed.size(), missing, elapsed);
+            if (!times.empty())
+            {
+                printf("  answered within   p50 %.2f s  p90 %.2f s  last %.2f s\n", times[times.size() / 2], times[std::min(times.size() - 1, times.size() * 9 / 10)], times.back());
+            }
+            printList("failed", failed);
+            std::vector<std::string> stragglers;
+            for (const std::string &member : members)
+            {
+                if (answers.count(member) == 0)
+                {
+                    stragglers.push_back(member);
+                }
+            }
+            printList("stragglers", stragglers);
+            printList("not in group", std::vector<std::string>(strangers.begin(), strangers.end()));
+            return failed.empty() && missing == 0;
+        }
+
+    private:
+        struct Answer
+        {
+            bool updated;
+            double at;
+        };
+
+        static void printList(const char *label, const std::vector<std::string> &devices)
+        {
+            if (devices.empty())
+            {
+                return;
+            }
+            printf("  %s:", label);
+            for (const std::string &device : devices)
+            {
+                printf(" %s", device.c_str());
+            }
+            printf("\n");
+        }
+
+        std::string id;
+        std::set<std::string> members;
+        size_t expected;
+        std::map<std::string, Answer> answers;
+        std::set<std::string> strangers;
+    };
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        return 2;
+    }
+
+    std::set<std::string> members;
+    if (!options.devicesFile.empty())
+    {
+        members = loadDevices(options.devicesFile);
+        if (members.empty())
+        {
+            fprintf(stderr, "no devices in %s\n", options.devicesFile.c_str());
+            return 2;
+        }
+    }
+
+    AckTracker tracker(options.id, members, options.expected);
+    auto startedAt = std::chrono::steady_clock::now();
+    auto elapsed = [&]
+    { return std::chrono::duration<double>(std::chrono::steady_clock::now() - startedAt).count(); };
+
+    // Reads with poll() so the timeout holds while the broker is quiet.
+    std::string pending;
+    bool open = true;
+    while (open && !tracker.complete() && elapsed() < options.timeoutSeconds)
+    {
+        pollfd input = {STDIN_FILENO, POLLIN, 0};
+        int waitMs = (int)((options.timeoutSeconds - elapsed()) * 1000) + 1;
+        if (poll(&input, 1, waitMs) <= 0)
+        {
+            continue;
+        }
+
+        char buffer[4096];
+        ssize_t length = read(STDIN_FILENO, buffer, sizeof(buffer));
+        if (length <= 0)
+        {
+            open = false;
+            length = 0;
+        }
+        pending.append(buffer, length);
+
+        size_t end;
+        while ((end = pending.find('\n')) != std::string::npos || (!open && !pending.empty()))
+        {
+            std::string line = pending.substr(0, end);
+            pending.erase(0, end == std::string::npos ? end : end + 1);
+            if (tracker.add(line, elapsed()) && !options.quiet)
+            {
+                fprintf(stderr, "%s\n", line.c_str());
+            }
+        }
+    }
+
+    return tracker.report(elapsed()) ? 0 : 1;
+}
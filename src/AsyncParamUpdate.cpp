@@ -1,4 +1,5 @@
 #include "AsyncParamUpdate.h"
+#include <algorithm>
 
 AsyncParamUpdate *AsyncParamUpdate::instance = nullptr;
 
@@ -10,6 +11,8 @@ AsyncParamUpdate::AsyncParamUpdate(const char *wifiSSID, const char *wifiPasswor
     this->wifiPassword = wifiPassword;
     this->deviceName = deviceName;
     this->logTopic = BOARDS_PREFIX + this->deviceName + LOG_SUFFIX;
+    this->metricsTopic = BOARDS_PREFIX + this->deviceName + METRICS_SUFFIX;
+    this->statusTopic = BOARDS_PREFIX + this->deviceName + STATUS_SUFFIX;
     this->updateTopic = BOARDS_PREFIX + String(this->deviceName);
     this->confirmationTopic = this->updateTopic + CONFIRMATION_SUFFIX;
     this->mqttHost = mqttHost;
@@ -18,6 +21,7 @@ AsyncParamUpdate::AsyncParamUpdate(const char *wifiSSID, const char *wifiPasswor
     this->mqttPassword = mqttPassword;
     this->mqttLog = mqttLog;
     this->useLoRa = false;
+    this->wireFormat = MQTT_WIRE_FORMAT;
 
     InitMqtt();
     WiFi.onEvent(AsyncParamUpdate::WiFiEvent);
@@ -25,7 +29,7 @@ AsyncParamUpdate::AsyncParamUpdate(const char *wifiSSID, const char *wifiPasswor
     xTaskCreate(reconnectWifi, "WiFiReconnect", 4096, NULL, 1, &wifiConnectionTask);
     xTaskCreate(reconnectMqtt, "MqttReconnect", 4096, NULL, 1, &mqttConnectionTask);
     vTaskSuspend(mqttConnectionTask);
-    xTaskCreate(sendActiveMessage, "ActiveMessage", 4096, NULL, 1, NULL);
+    xTaskCreate(housekeeping, "Housekeeping", 4096, NULL, 1, &housekeepingTask);
 }
 
 AsyncParamUpdate::AsyncParamUpdate(const char *deviceName, bool mqttLog)
@@ -35,12 +39,21 @@ AsyncParamUpdate::AsyncParamUpdate(const char *deviceName, bool mqttLog)
     this->deviceName = deviceName;
     this->mqttLog = mqttLog;
     this->useLoRa = true;
+    this->wireFormat = LORA_WIRE_FORMAT;
 
     this->initializeLoRa();
 }
 
 void AsyncParamUpdate::initializeLoRa()
 {
+    // The gateway could neither subscribe for this node nor queue downlinks
+    // to it.
+    if (deviceName.length() > LORA_MAX_DEVICE_NAME)
+    {
+        Serial.println("Device name " + deviceName + " is longer than " + String(LORA_MAX_DEVICE_NAME) + " characters, not starting LoRa");
+        while (1)
+            ;
+    }
 
     SPI.begin(SCK, MISO, MOSI, SS);
     LoRa.setPins(SS, RST, DI0);
@@ -53,6 +66,16 @@ void AsyncParamUpdate::initializeLoRa()
     }
 
     Serial.println("Starting LoRa success!");
+    configureLoRaRadio();
+
+    if (!loraReassembler.begin(1))
+    {
+        Serial.println("Could not allocate the LoRa reassembly buffer");
+    }
+    // Nodes running the same firmware boot in step, so micros() would give
+    // them the same IDs.
+    loraSource = loraSourceId(deviceName.c_str());
+    loraMessageId = esp_random();
 
     LoRa.onReceive(OnLoRaReceived);
     LoRa.receive();
@@ -82,6 +105,7 @@ void AsyncParamUpdate::WiFiEvent(WiFiEvent_t event)
     switch (event)
     {
     case WIFI_EVENT_CONNECTED:
+        instance->wifiConnects++;
         instance->logMessage("WiFi connected");
         instance->logMessage("IP address: ");
         instance->logMessage(WiFi.localIP().toString());
@@ -101,6 +125,10 @@ void AsyncParamUpdate::reconnectMqtt(void *parameters)
     {
         if (!instance->mqttClient.connected())
         {
+            if (instance->willFormat != instance->wireFormat)
+            {
+                instance->updateWill();
+            }
             instance->mqttClient.connect();
         }
 
@@ -108,49 +136,88 @@ void AsyncParamUpdate::reconnectMqtt(void *parameters)
     }
 }
 
-void AsyncParamUpdate::sendActiveMessage(void *parameters)
+// Sends heartbeats and metrics when they are due, sleeping in between.
+// Any publish counts as proof of life, so a device with regular traffic
+// sends no heartbeats at all. While the publish queue holds messages the
+// client pushed back on, it is pumped every PUBLISH_RETRY_MS.
+void AsyncParamUpdate::housekeeping(void *parameters)
 {
-
-    vTaskDelay(pdMS_TO_TICKS(30000));
+    uint32_t metricsPublishedAt = millis();
     for (;;)
     {
-        JsonDocument doc;
-        doc["Device"] = instance->deviceName;
-        doc["status"] = "active";
+        uint32_t now = millis();
+        uint32_t wait = HOUSEKEEPING_MAX_WAIT_MS;
 
-        char jsonBuffer[JSON_BUFFER_SIZE];
-        serializeJson(doc, jsonBuffer);
+        uint32_t heartbeatMs = instance->heartbeatIntervalMs;
+        if (heartbeatMs != 0 && instance->mqttClient.connected())
+        {
+            // Another task may have published since now was read.
+            int32_t sinceLast = (int32_t)(now - instance->lastPublishAt.load());
+            uint32_t idle = sinceLast < 0 ? 0 : sinceLast;
+            if (idle >= heartbeatMs)
+            {
+                instance->publishPayload(PUBLISH_METRICS, instance->statusTopic.c_str(), false, instance->presenceDocument("online"));
+                idle = 0;
+            }
+            wait = std::min(wait, heartbeatMs - idle);
+        }
+
+        uint32_t metricsMs = instance->metricsIntervalMs;
+        if (metricsMs != 0)
+        {
+            uint32_t elapsed = now - metricsPublishedAt;
+            if (elapsed >= metricsMs)
+            {
+                metricsPublishedAt = now;
+                instance->publishMetrics();
+                elapsed = 0;
+            }
+            wait = std::min(wait, metricsMs - elapsed);
+        }
 
-        instance->mqttClient.publish(instance->updateTopic.c_str(), MQTT_QOS_LEVEL, true, jsonBuffer);
+        instance->publishQueue.pump();
+        if (instance->publishQueue.queued() > 0)
+        {
+            wait = std::min<uint32_t>(wait, PUBLISH_RETRY_MS);
+        }
+        else if (instance->registryRetry.exchange(false))
+        {
+            instance->publishRegistry(true, true);
+        }
 
-        vTaskDelay(pdMS_TO_TICKS(30000));
+        vTaskDelay(pdMS_TO_TICKS(wait));
     }
 }
 
+JsonDocument AsyncParamUpdate::presenceDocument(const char *status) const
+{
+    JsonDocument doc;
+    doc["Device"] = deviceName;
+    doc["status"] = status;
+    return doc;
+}
+
 void AsyncParamUpdate::OnMqttConnect(bool sessionPresent)
 {
 
     vTaskSuspend(instance->mqttConnectionTask);
+    instance->mqttConnects++;
     instance->mqttClient.subscribe(instance->updateTopic.c_str(), MQTT_QOS_LEVEL);
-
-    if (instance->mqttLog)
+    for (size_t i = 0; i < instance->groupCount; i++)
     {
-
-        while (!instance->pendingMessages.empty())
-        {
-
-            String pendingMessage = instance->pendingMessages.front();
-            instance->mqttClient.publish(instance->logTopic.c_str(), MQTT_QOS_LEVEL, false, pendingMessage.c_str());
-            instance->pendingMessages.pop();
-        }
+        instance->mqttClient.subscribe(instance->groups[i].updateTopic.c_str(), MQTT_QOS_LEVEL);
     }
+    instance->publishPayload(PUBLISH_ACK, instance->statusTopic.c_str(), true, instance->presenceDocument("online"));
 
     instance->logMessage("Connected to MQTT.");
+    instance->logShipper.wake();
+    instance->publishRegistry(true);
 }
 
 void AsyncParamUpdate::OnMqttDisconnect(AsyncMqttClientDisconnectReason reason)
 {
 
+    instance->publishQueue.disconnected();
     instance->logMessage("Disconnected from MQTT.");
 
     if (WiFi.isConnected())
@@ -180,27 +247,91 @@ void AsyncParamUpdate::OnMqttPublish(uint16_t packetId)
     // logMessage("Publish acknowledged.");
     // Serial.print("  packetId: ");
     // logMessage(packetId);
+
+    instance->paramStore.lock();
+    instance->recentPublishAcks[instance->recentPublishAckIndex++ % PUBLISH_ACK_HISTORY] = packetId;
+    if (packetId != 0 && packetId == instance->registryPacketId)
+    {
+        instance->acknowledgedVersion = std::max(instance->acknowledgedVersion, instance->inFlightVersion);
+    }
+    instance->paramStore.unlock();
+
+    instance->publishQueue.acknowledged(packetId);
+    instance->publishQueue.pump();
 }
 
-String GetPayloadContent(char *data, size_t len)
+// Called by the publish queue when the last page of a registry publish has
+// been handed to the client. packetId is 0 when the registry class is QoS 0:
+// no acknowledgement will come, so the version counts as delivered now.
+void AsyncParamUpdate::OnPublishSent(uint32_t version, uint16_t packetId)
 {
-    String content = "";
-    for (size_t i = 0; i < len; i++)
+    instance->paramStore.lock();
+    if (packetId == 0)
+    {
+        instance->acknowledgedVersion = std::max(instance->acknowledgedVersion, version);
+    }
+    else
     {
-        content.concat(data[i]);
+        // The broker may acknowledge before publish() returns to the queue.
+        instance->registryPacketId = packetId;
+        instance->inFlightVersion = version;
+        for (uint16_t acked : instance->recentPublishAcks)
+        {
+            if (acked == packetId)
+            {
+                instance->acknowledgedVersion = std::max(instance->acknowledgedVersion, version);
+            }
+        }
     }
-    return content;
+    instance->paramStore.unlock();
 }
 
 void AsyncParamUpdate::OnMqttReceived(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)
 {
-    String content = GetPayloadContent(payload, len);
+    if (index == 0)
+    {
+        instance->receiveStartedAt = micros();
+    }
+
+    PayloadAssembler::Status status = instance->payloadAssembler.append(payload, len, index, total);
+    if (status == PayloadAssembler::REJECTED)
+    {
+        instance->messagesDropped++;
+        if (total > instance->payloadAssembler.maxPayloadSize())
+        {
+            instance->logMessage("Message received too large (" + String(total) + " bytes), discarding", logging::LoggerLevel::LOGGER_LEVEL_WARN);
+        }
+        else
+        {
+            instance->logMessage("Message received out of sequence, discarding", logging::LoggerLevel::LOGGER_LEVEL_WARN);
+        }
+        return;
+    }
+    if (status == PayloadAssembler::INCOMPLETE)
+    {
+        return;
+    }
 
     JsonDocument doc;
-    DeserializationError error = deserializeJson(doc, content);
+    DeserializationError error = deserializePayload(doc, instance->payloadAssembler.data(), instance->payloadAssembler.size());
     if (error)
     {
-        instance->logMessage("Message received deserializeJson() failed with code " + String(error.c_str()));
+        instance->messagesDropped++;
+        instance->logMessage("Message received deserializeJson() failed with code " + String(error.c_str()), logging::LoggerLevel::LOGGER_LEVEL_WARN);
+        return;
+    }
+
+    instance->receiveLatency.record(micros() - instance->receiveStartedAt);
+
+    const char *request = doc["request"].as<const char *>();
+    if (request != nullptr && strcmp(request, "registry") == 0)
+    {
+        instance->publishRegistry(true);
+        return;
+    }
+    if (request != nullptr && strcmp(request, "metrics") == 0)
+    {
+        instance->publishMetrics();
         return;
     }
 
@@ -209,172 +340,427 @@ void AsyncParamUpdate::OnMqttReceived(char *topic, char *payload, AsyncMqttClien
         return;
     }
 
-    JsonObject params = doc["parameters"].as<JsonObject>();
-    String messageId = doc["id"].as<String>();
-    bool allParamsUpdated = true;
-    std::map<String, JsonVariant> oldValues;
+    instance->handleUpdate(doc, instance->findGroup(topic));
+}
 
-    for (JsonPair kv : params)
+bool AsyncParamUpdate::joinGroup(const char *group)
+{
+    size_t count = groupCount;
+    if (count == MQTT_MAX_GROUPS)
     {
-        String key = kv.key().c_str();
-        instance->logMessage(key.c_str());
+        return false;
+    }
 
-        auto paramIter = instance->params.find(key.c_str());
-        if (paramIter != instance->params.end())
-        {
-            ParamInfo &paramInfo = paramIter->second;
-            JsonVariant oldValue = *static_cast<JsonVariant *>(paramInfo.param);
-            oldValues[key] = oldValue;
-            bool updateSuccess = instance->updateParameter(paramInfo, kv.value());
+    GroupTopics &topics = groups[count];
+    topics.updateTopic = String(GROUPS_PREFIX) + group;
+    topics.ackTopic = topics.updateTopic + GROUP_ACK_SUFFIX;
+    groupCount = count + 1;
 
-            if (!updateSuccess)
-            {
-                allParamsUpdated = false;
-                *static_cast<JsonVariant *>(paramInfo.param) = oldValue;
-                break;
-            }
+    // Otherwise it is subscribed with the rest on connect.
+    if (!useLoRa && mqttClient.connected())
+    {
+        mqttClient.subscribe(topics.updateTopic.c_str(), MQTT_QOS_LEVEL);
+    }
+    return true;
+}
+
+const AsyncParamUpdate::GroupTopics *AsyncParamUpdate::findGroup(const char *topic) const
+{
+    for (size_t i = 0; i < groupCount; i++)
+    {
+        if (groups[i].updateTopic == topic)
+        {
+            return &groups[i];
         }
     }
+    return nullptr;
+}
+
+// A message whose id was handled recently is a redelivery: it is answered
+// with the recorded result instead of being applied again. The first
+// confirmation is retained on MQTT, so a repeated one is not. Group updates
+// are confirmed on the group's ack topic and never retained, since every
+// member answers there.
+void AsyncParamUpdate::handleUpdate(JsonDocument &doc, const GroupTopics *group)
+{
+    String messageId = doc["id"].as<String>();
+    bool hasId = !doc["id"].isNull();
+    bool allParamsUpdated;
+    updatesReceived++;
+    if (hasId && recentUpdates.find(messageId.c_str(), allParamsUpdated))
+    {
+        duplicateUpdates++;
+        sendConfirmation(messageId, allParamsUpdated, false, group);
+        return;
+    }
+
+    // Parameter IDs differ between devices, so a group update names them.
+    uint32_t startedAt = micros();
+    allParamsUpdated = applyParameters(doc["parameters"].as<JsonObject>(), group == nullptr);
+    applyLatency.record(micros() - startedAt);
+    if (hasId)
+    {
+        recentUpdates.add(messageId.c_str(), allParamsUpdated);
+    }
+
+    startedAt = micros();
+    sendConfirmation(messageId, allParamsUpdated, group == nullptr, group);
+    ackLatency.record(micros() - startedAt);
+    publishRegistry(false);
+
+    if (!allParamsUpdated)
+    {
+        logMessage("Error updating parameters", logging::LoggerLevel::LOGGER_LEVEL_ERROR);
+    }
+}
 
+void AsyncParamUpdate::sendConfirmation(const String &messageId, bool updated, bool retain, const GroupTopics *group)
+{
     JsonDocument ackDoc;
     ackDoc["id"] = messageId;
-    ackDoc["Device"] = instance->deviceName;
-    ackDoc["status"] = allParamsUpdated ? "updated" : "failed";
+    ackDoc["Device"] = deviceName;
+    ackDoc["status"] = updated ? "updated" : "failed";
 
-    char jsonBuffer[JSON_BUFFER_SIZE];
-    serializeJson(ackDoc, jsonBuffer);
-    instance->mqttClient.publish(instance->confirmationTopic.c_str(), MQTT_QOS_LEVEL, true, jsonBuffer);
+    if (useLoRa)
+    {
+        sendLoRaPayload(ackDoc);
+    }
+    else
+    {
+        const char *topic = group != nullptr ? group->ackTopic.c_str() : confirmationTopic.c_str();
+        publishPayload(PUBLISH_ACK, topic, retain, ackDoc);
+    }
+}
 
-    if (!allParamsUpdated)
+static bool paramNameLess(const AsyncParamUpdate::ParamInfo &paramInfo, const std::pair<const char *, size_t> &name)
+{
+    return paramInfo.paramName.compare(0, std::string::npos, name.first, name.second) < 0;
+}
+
+static bool paramNameEqual(const AsyncParamUpdate::ParamInfo &a, const AsyncParamUpdate::ParamInfo &b)
+{
+    return a.paramName == b.paramName;
+}
+
+// Frees the copy bindArray() made of a C array once its entry is gone.
+static void releaseArrayCopy(const AsyncParamUpdate::ParamInfo &paramInfo)
+{
+    if (paramInfo.array != nullptr)
+    {
+        paramInfo.type->destroy(paramInfo.param);
+    }
+}
+
+AsyncParamUpdate::~AsyncParamUpdate()
+{
+    for (const ParamInfo &paramInfo : params)
+    {
+        releaseArrayCopy(paramInfo);
+    }
+}
+
+// Inside beginRegistration()/commitRegistration() entries are appended and
+// sorted once at commit; otherwise each one is inserted in place.
+void AsyncParamUpdate::insertParameter(const ParamInfo &paramInfo)
+{
+    ParamInfo entry = paramInfo;
+    if (entry.persist == nullptr)
     {
-        instance->logMessage("Error updating parameters");
+        entry.persist = paramStore.track(entry.paramName, entry.type, entry.param);
+    }
+
+    paramStore.lock();
+    entry.version = ++registryVersion;
+    entry.unitVersions.assign(entry.type->units, entry.version);
+    registryLayoutChanged = true;
+    if (registering)
+    {
+        params.push_back(entry);
+        paramsSorted = false;
+    }
+    else
+    {
+        std::pair<const char *, size_t> name(entry.paramName.data(), entry.paramName.size());
+        auto it = std::lower_bound(params.begin(), params.end(), name, paramNameLess);
+        if (it != params.end() && it->paramName == entry.paramName)
+        {
+            releaseArrayCopy(*it);
+            *it = entry;
+        }
+        else
+        {
+            params.insert(it, entry);
+        }
     }
+    paramStore.unlock();
 }
 
-bool AsyncParamUpdate::updateParameter(const ParamInfo &paramInfo, JsonVariant value)
+// A record that does not match the current layout is rewritten once it has
+// been offered to migrate, so the mismatch is reported on one boot only.
+void AsyncParamUpdate::loadStruct(const std::string &key, const ParamType *type, void *value, size_t size, uint16_t version, uint32_t layoutHash,
+                                  const std::function<bool(const ParamStructRecord &stored)> &migrate)
 {
-    const std::string &paramName = paramInfo.paramName;
-    bool success = false;
+    const char *nvsKey = key.c_str();
+    if (!preferences.isKey(nvsKey))
+    {
+        type->store(preferences, nvsKey, value);
+        return;
+    }
 
-    try
+    std::vector<uint8_t> record(preferences.getBytesLength(nvsKey));
+    ParamStructHeader header = {0, 0, 0};
+    if (record.size() >= sizeof(header) && preferences.getBytes(nvsKey, record.data(), record.size()) == record.size())
+    {
+        memcpy(&header, record.data(), sizeof(header));
+    }
+    if (header.version == version && header.layoutHash == layoutHash && header.size == size && record.size() == sizeof(header) + size)
     {
+        memcpy(value, record.data() + sizeof(header), size);
+        return;
+    }
 
-        if (strcmp(paramInfo.typeName, typeid(int).name()) == 0)
+    bool hasData = record.size() > sizeof(header);
+    ParamStructRecord stored = {header.version, header.layoutHash, hasData ? record.data() + sizeof(header) : nullptr, hasData ? record.size() - sizeof(header) : 0};
+    if (migrate(stored))
+    {
+        logMessage("Migrated " + String(nvsKey) + " from version " + String(header.version), logging::LoggerLevel::LOGGER_LEVEL_WARN);
+    }
+    else
+    {
+        logMessage("Stored layout of " + String(nvsKey) + " changed, using defaults", logging::LoggerLevel::LOGGER_LEVEL_WARN);
+    }
+    type->store(preferences, nvsKey, value);
+}
+
+void AsyncParamUpdate::beginRegistration()
+{
+    registering = true;
+}
+
+void AsyncParamUpdate::commitRegistration()
+{
+    paramStore.lock();
+    registering = false;
+    if (!paramsSorted)
+    {
+        // Stable, so of several registrations under one name the last is kept.
+        std::stable_sort(params.begin(), params.end(), [](const ParamInfo &a, const ParamInfo &b)
+                         { return a.paramName < b.paramName; });
+        for (size_t i = 0; i + 1 < params.size(); i++)
         {
-            *(static_cast<int *>(paramInfo.param)) = value.as<int>();
-            success = preferences.putInt(paramName.c_str(), value.as<int>());
+            if (paramNameEqual(params[i], params[i + 1]))
+            {
+                releaseArrayCopy(params[i]);
+            }
         }
-        else if (strcmp(paramInfo.typeName, typeid(float).name()) == 0)
+        auto last = std::unique(params.rbegin(), params.rend(), paramNameEqual);
+        params.erase(params.begin(), last.base());
+        paramsSorted = true;
+    }
+    paramStore.unlock();
+
+    publishRegistry(true);
+}
+
+AsyncParamUpdate::ParamInfo *AsyncParamUpdate::findParameter(const char *name, size_t length)
+{
+    if (!paramsSorted)
+    {
+        for (auto it = params.rbegin(); it != params.rend(); ++it)
         {
-            *(static_cast<float *>(paramInfo.param)) = value.as<float>();
-            success = preferences.putFloat(paramName.c_str(), value.as<float>());
+            if (it->paramName.compare(0, std::string::npos, name, length) == 0)
+            {
+                return &*it;
+            }
         }
-        else if (strcmp(paramInfo.typeName, typeid(double).name()) == 0)
+        return nullptr;
+    }
+
+    std::pair<const char *, size_t> key(name, length);
+    auto it = std::lower_bound(params.begin(), params.end(), key, paramNameLess);
+    if (it == params.end() || it->paramName.compare(0, std::string::npos, name, length) != 0)
+    {
+        return nullptr;
+    }
+    return &*it;
+}
+
+// With numericIds an all-digit key is a position in the sorted registry, as
+// listed by the last snapshot.
+AsyncParamUpdate::ParamInfo *AsyncParamUpdate::findParameterKey(const char *key, size_t length)
+{
+    if (numericIds && paramsSorted && length > 0 && length <= 5)
+    {
+        size_t id = 0;
+        size_t i = 0;
+        while (i < length && key[i] >= '0' && key[i] <= '9')
         {
-            *(static_cast<double *>(paramInfo.param)) = value.as<double>();
-            success = preferences.putDouble(paramName.c_str(), value.as<double>());
+            id = id * 10 + (key[i++] - '0');
         }
-        else if (strcmp(paramInfo.typeName, typeid(bool).name()) == 0)
+        if (i == length)
         {
-            *(static_cast<bool *>(paramInfo.param)) = value.as<bool>();
-            success = preferences.putBool(paramName.c_str(), value.as<bool>());
+            return id < params.size() ? &params[id] : nullptr;
         }
-        else if (strcmp(paramInfo.typeName, typeid(String).name()) == 0)
+    }
+    return findParameter(key, length);
+}
+
+// Converts every known key into a staged copy first and only touches the live
+// variables once all of them are valid, so a failed update changes nothing in
+// RAM or NVS. The registry stays locked throughout so a concurrent
+// addParameter cannot move the entries being staged.
+bool AsyncParamUpdate::applyParameters(JsonObject parameters, bool numericKeys)
+{
+    struct StagedValue
+    {
+        ParamInfo *paramInfo;
+        const ParamType *type;
+        ParamStore::Entry *persist;
+        void *value;
+        bool changed;
+    };
+    std::vector<StagedValue> staged;
+    staged.reserve(parameters.size());
+    bool valid = true;
+
+    paramStore.lock();
+    for (JsonPair kv : parameters)
+    {
+        JsonString key = kv.key();
+        logMessage(key.c_str(), logging::LoggerLevel::LOGGER_LEVEL_DEBUG);
+
+        ParamInfo *paramInfo = numericKeys ? findParameterKey(key.c_str(), key.size()) : findParameter(key.c_str(), key.size());
+        if (paramInfo == nullptr)
         {
-            *(static_cast<String *>(paramInfo.param)) = value.as<String>();
-            success = preferences.putString(paramName.c_str(), value.as<String>().c_str());
+            continue;
         }
-        else
+
+        StagedValue stagedValue = {paramInfo, paramInfo->type, paramInfo->persist, paramInfo->type->clone(paramInfo->param), false};
+        staged.push_back(stagedValue);
+        if (!paramInfo->type->fromJson(kv.value(), stagedValue.value))
         {
-            logMessage("Error: Type mismatch or unsupported type.");
+            logMessage("Error: Type mismatch or unsupported type.", logging::LoggerLevel::LOGGER_LEVEL_ERROR);
+            valid = false;
+            break;
         }
     }
-    catch (const std::exception &e)
+
+    if (valid)
     {
-        logMessage("Exception caught: " + String(e.what()));
-        success = false;
+        uint32_t version = registryVersion + 1;
+        std::vector<ParamSnapshotStore::Change> changes;
+        std::vector<ParamChanges::Entry> notifications;
+        for (StagedValue &stagedValue : staged)
+        {
+            ParamInfo *paramInfo = stagedValue.paramInfo;
+            if (!paramInfo->type->equals(paramInfo->param, stagedValue.value))
+            {
+                if (notifier.watching(paramInfo->snapshot))
+                {
+                    notifications.push_back({paramInfo->snapshot, paramInfo->type->clone(paramInfo->param), paramInfo->type->clone(stagedValue.value), true});
+                }
+                for (size_t unit = 0; unit < paramInfo->unitVersions.size(); unit++)
+                {
+                    if (!paramInfo->type->unitEquals(paramInfo->param, stagedValue.value, unit))
+                    {
+                        paramInfo->unitVersions[unit] = version;
+                    }
+                }
+                paramInfo->type->assign(paramInfo->param, stagedValue.value);
+                if (paramInfo->copyToArray != nullptr)
+                {
+                    paramInfo->copyToArray(paramInfo->array, paramInfo->param);
+                }
+                paramInfo->version = version;
+                stagedValue.changed = true;
+                registryVersion = version;
+                changes.emplace_back(paramInfo->snapshot, stagedValue.value);
+            }
+        }
+        // All changed values become visible to snapshots together.
+        snapshots.publish(changes);
+        notifier.record(notifications);
     }
+    paramStore.unlock();
+    // Callbacks run once per update, after the values are all in place.
+    notifier.dispatch();
 
-    return success;
+    for (const StagedValue &stagedValue : staged)
+    {
+        if (stagedValue.changed)
+        {
+            paramStore.markDirty(stagedValue.persist);
+        }
+        stagedValue.type->destroy(stagedValue.value);
+    }
+    return valid;
 }
 
 void AsyncParamUpdate::OnLoRaReceived(int packetSize)
 {
-    String receivedMessage;
-    while (LoRa.available())
+    uint32_t receivedAt = micros(); // of the last fragment, for a fragmented message
+    char packet[LORA_MAX_PACKET_SIZE];
+    size_t length = 0;
+    while (LoRa.available() && length < sizeof(packet))
+    {
+        packet[length++] = (char)LoRa.read();
+    }
+
+    const char *message;
+    size_t messageLength;
+    if (!instance->loraReassembler.accept(packet, length, millis(), message, messageLength))
     {
-        receivedMessage += (char)LoRa.read();
+        return;
     }
 
     // Procesar el mensaje recibido
     JsonDocument doc;
-    DeserializationError error = deserializeJson(doc, receivedMessage);
+    DeserializationError error = deserializePayload(doc, message, messageLength);
     if (error)
     {
-        instance->logMessage("LoRa message deserializeJson() failed with code " + String(error.c_str()));
+        instance->messagesDropped++;
+        instance->logMessage("LoRa message deserializeJson() failed with code " + String(error.c_str()), logging::LoggerLevel::LOGGER_LEVEL_WARN);
         return;
     }
+    instance->receiveLatency.record(micros() - receivedAt);
 
     String deviceName = doc["Device"].as<String>();
     if (deviceName != instance->deviceName)
     {
-        instance->logMessage("Received message is not for this device, discarding.");
+        instance->logMessage("Received message is not for this device, discarding.", logging::LoggerLevel::LOGGER_LEVEL_DEBUG);
         return;
     }
 
     if (!doc.containsKey("parameters"))
     {
+        // Answered with the message id and a status, which the gateway
+        // takes as the acknowledgement of its downlink.
+        const char *request = doc["request"].as<const char *>();
+        if (request != nullptr && strcmp(request, "metrics") == 0)
+        {
+            JsonDocument metrics;
+            instance->writeMetrics(metrics);
+            metrics["id"] = doc["id"];
+            metrics["status"] = "metrics";
+            instance->sendLoRaPayload(metrics);
+        }
         return;
     }
 
-    JsonObject params = doc["parameters"].as<JsonObject>();
-    String messageId = doc["id"].as<String>();
-    bool allParamsUpdated = true;
-    std::map<String, JsonVariant> oldValues;
+    instance->handleUpdate(doc);
+}
 
-    for (JsonPair kv : params)
+void AsyncParamUpdate::InitMqtt()
+{
+    if (!payloadAssembler.begin(MQTT_MAX_PAYLOAD_SIZE))
     {
-        String key = kv.key().c_str();
-        instance->logMessage(key.c_str());
-
-        auto paramIter = instance->params.find(key.c_str());
-        if (paramIter != instance->params.end())
-        {
-            ParamInfo &paramInfo = paramIter->second;
-            JsonVariant oldValue = *static_cast<JsonVariant *>(paramInfo.param);
-            oldValues[key] = oldValue;
-            bool updateSuccess = instance->updateParameter(paramInfo, kv.value());
-
-            if (!updateSuccess)
-            {
-                allParamsUpdated = false;
-                *static_cast<JsonVariant *>(paramInfo.param) = oldValue;
-                break;
-            }
-        }
+        logMessage("Could not allocate the MQTT payload buffer", logging::LoggerLevel::LOGGER_LEVEL_ERROR);
     }
-
-    JsonDocument ackDoc;
-    ackDoc["id"] = messageId;
-    ackDoc["Device"] = instance->deviceName;
-    ackDoc["status"] = allParamsUpdated ? "updated" : "failed";
-
-    char jsonBuffer[JSON_BUFFER_SIZE];
-    serializeJson(ackDoc, jsonBuffer);
-
-    // Envía una respuesta a través de LoRa
-    LoRa.beginPacket();
-    LoRa.print(jsonBuffer);
-    LoRa.endPacket();
-
-    if (!allParamsUpdated)
+    if (!publishQueue.begin(&mqttClient, OnPublishSent))
     {
-        instance->logMessage("Error updating parameters");
+        logMessage("Could not create the publish queue locks", logging::LoggerLevel::LOGGER_LEVEL_ERROR);
     }
-}
 
-void AsyncParamUpdate::InitMqtt()
-{
     mqttClient.onConnect(AsyncParamUpdate::OnMqttConnect);
     mqttClient.onDisconnect(AsyncParamUpdate::OnMqttDisconnect);
     mqttClient.onPublish(AsyncParamUpdate::OnMqttPublish);
@@ -384,124 +770,307 @@ void AsyncParamUpdate::InitMqtt()
     mqttClient.setCredentials(mqttUser, mqttPassword);
     mqttClient.setClientId(deviceName.c_str());
     mqttClient.setSecure(MQTT_SECURE);
+
+    updateWill();
 }
 
-void AsyncParamUpdate::publishParametersList(std::string paramName)
+// The broker publishes the will, so it is encoded ahead of time and again
+// before reconnecting if setWireFormat() has changed the encoding since.
+// AsyncMqttClient keeps the pointers, so both strings live in members.
+void AsyncParamUpdate::updateWill()
 {
+    willFormat = wireFormat;
+    willPayload = "";
+    serializePayload(presenceDocument("offline"), willFormat, willPayload);
+    mqttClient.setWill(statusTopic.c_str(), STATUS_QOS_LEVEL, true, willPayload.c_str(), willPayload.length());
+}
 
-    if (!useLoRa)
+// A full snapshot is retained on REGISTRY_TOPIC. Otherwise only parameters
+// changed since the last acknowledged publish are sent, not retained, with
+// "base" naming the version they apply on top of. Either is split into pages
+// of about REGISTRY_PAGE_SIZE bytes, numbered with "page" and "pages" when
+// there is more than one. Each retained page would replace the one before on
+// the broker, so a paged snapshot is not retained at all rather than leaving
+// a late subscriber only its last page. Pages that find the publish queue
+// full are retried from housekeeping, which can wait for the queue to drain;
+// MQTT callbacks cannot, since acknowledgements arrive on their task.
+void AsyncParamUpdate::publishRegistry(bool full, bool waitForQueue)
+{
+    // Whatever is not published now goes out with the snapshot on connect.
+    if (!useLoRa && !mqttClient.connected())
     {
-        while (!mqttClient.connected())
-        {
-        }
+        return;
     }
 
+    String ip = WiFi.localIP().toString();
     JsonDocument doc;
-    doc["Device"] = deviceName;
-    doc["Ip"] = WiFi.localIP().toString();
-    JsonArray paramsArray = doc["parameters"].to<JsonArray>();
-
-    for (const auto &p : params)
+    JsonDocument entry;
+    std::vector<size_t> pageStarts;
+
+    // First pass: measure every selected entry and decide where pages start.
+    // IDs are positions in the snapshot, so a new parameter needs a new one.
+    paramStore.lock();
+    full = full || registryLayoutChanged;
+    uint32_t base = full ? 0 : acknowledgedVersion;
+    uint32_t version = registryVersion;
+    beginRegistryPage(doc, ip, version, full, base);
+    size_t headerSize = measurePayload(doc, wireFormat) + sizeof(",\"page\":65535,\"pages\":65535") - 1;
+    size_t pageSize = 0;
+    for (size_t i = 0; i < params.size(); i++)
     {
-        JsonObject paramObj = paramsArray.add<JsonObject>();
-
-        std::string paramValue;
-
-        if (p.second.typeName == typeid(int).name())
+        const ParamInfo &p = params[i];
+        if (!full && p.version <= base)
+        {
+            continue;
+        }
+        entry.clear();
+        registryValue(entry[registryKey(i, full)].to<JsonVariant>(), p, full, base);
+        size_t entrySize = measurePayload(entry, wireFormat) + 1;
+        if (pageStarts.empty() || pageSize + entrySize > REGISTRY_PAGE_SIZE)
         {
-            paramValue = std::to_string(*static_cast<int *>(p.second.param));
+            pageStarts.push_back(i);
+            pageSize = headerSize;
         }
-        else if (p.second.typeName == typeid(float).name())
+        pageSize += entrySize;
+    }
+    size_t registrySize = params.size();
+    paramStore.unlock();
+
+    if (pageStarts.empty())
+    {
+        if (!full)
         {
-            paramValue = std::to_string(*static_cast<float *>(p.second.param));
+            return;
         }
-        else if (p.second.typeName == typeid(double).name())
+        pageStarts.push_back(registrySize);
+    }
+
+    bool queued = true;
+    bool retain = full && pageStarts.size() == 1;
+    if (full)
+    {
+        paramStore.lock();
+        registryLayoutChanged = false;
+        paramStore.unlock();
+    }
+    for (size_t page = 0; page < pageStarts.size() && queued; page++)
+    {
+        size_t end = page + 1 < pageStarts.size() ? pageStarts[page + 1] : SIZE_MAX;
+
+        JsonArray paramsArray = beginRegistryPage(doc, ip, version, full, base);
+        if (pageStarts.size() > 1)
         {
-            paramValue = std::to_string(*static_cast<double *>(p.second.param));
+            doc["page"] = page;
+            doc["pages"] = pageStarts.size();
         }
-        else if (p.second.typeName == typeid(bool).name())
+
+        paramStore.lock();
+        for (size_t i = pageStarts[page]; i < end && i < params.size(); i++)
         {
-            paramValue = *static_cast<bool *>(p.second.param) ? "true" : "false";
+            const ParamInfo &p = params[i];
+            if (full || p.version > base)
+            {
+                JsonObject paramObj = paramsArray.add<JsonObject>();
+                registryValue(paramObj[registryKey(i, full)].to<JsonVariant>(), p, full, base);
+            }
         }
-        else if (p.second.typeName == typeid(std::string).name())
+        paramStore.unlock();
+
+        if (useLoRa)
         {
-            paramValue = *static_cast<std::string *>(p.second.param);
+            // Send via LoRa
+            sendLoRaPayload(doc);
         }
         else
         {
-            continue;
+            // Send via MQTT. The last page is acknowledged last, so it
+            // stands for the whole publish; OnPublishSent tracks it.
+            bool last = page + 1 == pageStarts.size();
+            while (waitForQueue && publishQueue.queued() > 0 && mqttClient.connected() &&
+                   !publishQueue.hasRoom(PUBLISH_REGISTRY, measurePayload(doc, wireFormat)))
+            {
+                vTaskDelay(pdMS_TO_TICKS(PUBLISH_RETRY_MS));
+            }
+            queued = publishPayload(PUBLISH_REGISTRY, REGISTRY_TOPIC, retain, doc, last ? version : 0);
         }
-
-        paramObj[p.first.c_str()] = paramValue;
     }
 
-    char jsonBuffer[JSON_BUFFER_SIZE];
-    serializeJson(doc, jsonBuffer);
-
     if (useLoRa)
     {
-        // Send via LoRa
-        LoRa.beginPacket();
-        LoRa.print(jsonBuffer);
-        LoRa.endPacket();
+        paramStore.lock();
+        acknowledgedVersion = std::max(acknowledgedVersion, version);
+        paramStore.unlock();
     }
-    else
+    else if (!queued && waitForQueue)
     {
-        // Send via MQTT
-        mqttClient.publish(REGISTRY_TOPIC, MQTT_QOS_LEVEL, true, jsonBuffer);
+        logMessage("Registry page does not fit in the publish queue", logging::LoggerLevel::LOGGER_LEVEL_ERROR);
+    }
+    else if (!queued)
+    {
+        // Some pages may be out already; a fresh snapshot supersedes them.
+        logMessage("Publish queue full, registry deferred", logging::LoggerLevel::LOGGER_LEVEL_WARN);
+        registryRetry = true;
     }
 }
 
-void AsyncParamUpdate::onTxDone()
+JsonArray AsyncParamUpdate::beginRegistryPage(JsonDocument &doc, const String &ip, uint32_t version, bool full, uint32_t base)
 {
-
-    instance->logMessage("Datos enviados");
+    doc.clear();
+    doc["Device"] = deviceName;
+    doc["Ip"] = ip;
+    doc["version"] = version;
+    if (!full)
+    {
+        doc["base"] = base;
+    }
+    doc["encoding"] = wireFormatName(wireFormat);
+    if (numericIds)
+    {
+        doc["keys"] = "id";
+    }
+    return doc["parameters"].to<JsonArray>();
 }
 
-void AsyncParamUpdate::saveParameter(const std::string &key, int value)
+String AsyncParamUpdate::registryKey(size_t index, bool full) const
 {
-    preferences.putInt(key.c_str(), value);
+    return numericIds && !full ? String((unsigned long)index) : String(params[index].paramName.c_str());
 }
 
-void AsyncParamUpdate::saveParameter(const std::string &key, float value)
+// A delta sends an array or blob as a patch of the parts changed since base,
+// in the form an update would use, unless most of it changed.
+void AsyncParamUpdate::registryValue(JsonVariant dst, const ParamInfo &p, bool full, uint32_t base) const
 {
-    preferences.putFloat(key.c_str(), value);
-}
+    size_t units = p.unitVersions.size();
+    size_t changed = 0;
+    for (size_t unit = 0; unit < units && !full; unit++)
+    {
+        changed += p.unitVersions[unit] > base ? 1 : 0;
+    }
+    if (full || changed == 0 || changed * 2 > units)
+    {
+        p.type->toJson(dst, p.param);
+        return;
+    }
 
-void AsyncParamUpdate::saveParameter(const std::string &key, bool value)
-{
-    preferences.putBool(key.c_str(), value);
+    JsonObject patch = dst.to<JsonObject>();
+    size_t begin = 0;
+    while (begin < units)
+    {
+        if (p.unitVersions[begin] <= base)
+        {
+            begin++;
+            continue;
+        }
+        size_t end = begin + 1;
+        while (end < units && p.unitVersions[end] > base)
+        {
+            end++;
+        }
+        p.type->unitsToJson(patch, p.param, begin, end);
+        begin = end;
+    }
 }
 
-void AsyncParamUpdate::saveParameter(const std::string &key, const char *value)
+// Serializes once, into a buffer sized by measurePayload that the queue then
+// owns, so a message costs one allocation and no copy. It is sent as soon as
+// its class's turn comes, usually before this returns.
+bool AsyncParamUpdate::publishPayload(PublishClass cls, const char *topic, bool retain, const JsonDocument &doc, uint32_t tag)
 {
-    preferences.putString(key.c_str(), value);
+    size_t length = measurePayload(doc, wireFormat);
+    char *buffer = static_cast<char *>(malloc(length + 1));
+    if (buffer == nullptr)
+    {
+        logMessage("Could not allocate " + String(length) + " bytes to publish on " + String(topic), logging::LoggerLevel::LOGGER_LEVEL_ERROR);
+        return false;
+    }
+
+    serializePayload(doc, wireFormat, buffer, length + 1);
+    buffer[length] = '\0';
+    bool queued = publishQueue.adopt(cls, topic, buffer, length, retain, tag);
+    if (queued)
+    {
+        lastPublishAt = millis();
+        publishQueue.pump();
+    }
+    return queued;
 }
 
-void AsyncParamUpdate::saveParameter(const std::string &key, const String &value)
+void AsyncParamUpdate::sendLoRaPayload(const JsonDocument &doc)
 {
-    preferences.putString(key.c_str(), value.c_str());
+    LoRaFragmentWriter writer(loraSource, loraMessageId++, measurePayload(doc, wireFormat));
+    serializePayload(doc, wireFormat, writer);
+    if (!writer.end())
+    {
+        logMessage("Could not send LoRa message", logging::LoggerLevel::LOGGER_LEVEL_ERROR);
+    }
+    LoRa.receive();
 }
 
-void AsyncParamUpdate::saveParameter(const std::string &key, double value)
+void AsyncParamUpdate::onTxDone()
 {
-    preferences.putFloat(key.c_str(), static_cast<float>(value));
+
+    instance->logMessage("Datos enviados");
 }
-void AsyncParamUpdate::logMessage(const String &message)
+
+// With mqttLog, records are batched onto the log topic by logShipper rather
+// than published one by one.
+void AsyncParamUpdate::logMessage(const String &message, logging::LoggerLevel level)
 {
-    if (this->mqttLog)
+    if (level < this->logLevel)
     {
-        if (this->mqttClient.connected())
-        {
-            this->mqttClient.publish(this->logTopic.c_str(), MQTT_QOS_LEVEL, false, message.c_str());
-        }
-        else
-        {
-            pendingMessages.push(message);
-        }
+        return;
+    }
+
+    if (this->mqttLog && !this->useLoRa)
+    {
+        logShipper.add(level, message.c_str());
     }
     else
     {
-        this->logger.log(logging::LoggerLevel::LOGGER_LEVEL_INFO, "MAIN", message.c_str());
+        this->logger.log(level, "MAIN", message.c_str());
     }
 }
+
+void AsyncParamUpdate::writeMetrics(JsonDocument &doc)
+{
+    doc["Device"] = deviceName;
+    doc["uptimeMs"] = millis();
+    doc["freeHeap"] = xPortGetFreeHeapSize();
+    doc["minFreeHeap"] = xPortGetMinimumEverFreeHeapSize();
+
+    JsonObject counters = doc["counters"].to<JsonObject>();
+    counters["updates"] = updatesReceived.load();
+    counters["duplicates"] = duplicateUpdates.load();
+    counters["dropped"] = messagesDropped.load();
+    counters["wifiConnects"] = wifiConnects.load();
+    counters["mqttConnects"] = mqttConnects.load();
+    counters["logQueued"] = logShipper.queued();
+    counters["logDropped"] = logShipper.droppedCount();
+    counters["publishQueued"] = publishQueue.queued();
+    counters["publishRejected"] = publishQueue.rejectedCount();
+
+    JsonObject stackFree = doc["stackFree"].to<JsonObject>();
+    addStackHighWaterMark(stackFree, "WiFiReconnect", wifiConnectionTask);
+    addStackHighWaterMark(stackFree, "MqttReconnect", mqttConnectionTask);
+    addStackHighWaterMark(stackFree, "Housekeeping", housekeepingTask);
+    addStackHighWaterMark(stackFree, "ParamNotify", notifier.taskHandle());
+
+    LatencyHistogram::boundsToJson(doc["bucketsUs"].to<JsonArray>());
+    JsonObject latency = doc["latencyUs"].to<JsonObject>();
+    receiveLatency.toJson(latency["receiveParse"].to<JsonObject>());
+    applyLatency.toJson(latency["parseApply"].to<JsonObject>());
+    paramStore.writeLatency().toJson(latency["nvsWrite"].to<JsonObject>());
+    ackLatency.toJson(latency["ackPublish"].to<JsonObject>());
+}
+
+void AsyncParamUpdate::publishMetrics()
+{
+    if (useLoRa || !mqttClient.connected())
+    {
+        return;
+    }
+
+    JsonDocument doc;
+    writeMetrics(doc);
+    publishPayload(PUBLISH_METRICS, metricsTopic.c_str(), false, doc);
+}
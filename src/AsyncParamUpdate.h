@@ -8,13 +8,23 @@
 #include <WiFi.h>
 #include <set>
 #include <string>
-#include <typeinfo>
-#include <unordered_map>
+#include <vector>
 #include <map>
-#include <queue>
 #include <Preferences.h>
 #include <LoRa.h>
+#include "LoRaFragments.h"
 #include "LoRaToMqttGateway.h"
+#include "LogShipper.h"
+#include "MessageIdCache.h"
+#include "Metrics.h"
+#include "ParamNotifier.h"
+#include "ParamSnapshot.h"
+#include "ParamStore.h"
+#include "ParamStruct.h"
+#include "ParamTraits.h"
+#include "PayloadAssembler.h"
+#include "PublishQueue.h"
+#include "WireFormat.h"
 
 #define SCK 5   // GPIO5  -- SX1276's SCK
 #define MISO 19 // GPIO19 -- SX1276's MISO
@@ -26,10 +36,29 @@
 #define DELAY_MS 5000
 #define BOARDS_PREFIX "boards/"
 #define REGISTRY_TOPIC "boards/registry"
-#define JSON_BUFFER_SIZE 1024
+#ifndef REGISTRY_PAGE_SIZE
+#define REGISTRY_PAGE_SIZE 1024
+#endif
+#ifndef MQTT_MAX_PAYLOAD_SIZE
+#define MQTT_MAX_PAYLOAD_SIZE 4096
+#endif
 #define MQTT_QOS_LEVEL 2
+#define PUBLISH_ACK_HISTORY 8
 #define LOG_SUFFIX "/log"
 #define CONFIRMATION_SUFFIX "/confirmation"
+#define GROUPS_PREFIX "boards/groups/"
+#define GROUP_ACK_SUFFIX "/ack"
+#ifndef MQTT_MAX_GROUPS
+#define MQTT_MAX_GROUPS 4
+#endif
+#define STATUS_SUFFIX "/status"
+#define STATUS_QOS_LEVEL 1
+// A heartbeat is only sent after this long without any other publish; 0
+// disables heartbeats and leaves presence to the Last Will.
+#ifndef HEARTBEAT_INTERVAL_MS
+#define HEARTBEAT_INTERVAL_MS 300000
+#endif
+#define HOUSEKEEPING_MAX_WAIT_MS 60000
 #define WIFI_EVENT_CONNECTED SYSTEM_EVENT_STA_GOT_IP
 #define WIFI_EVENT_DISCONNECTED SYSTEM_EVENT_STA_DISCONNECTED
 #define MQTT_SECURE true
@@ -40,11 +69,23 @@ public:
     struct ParamInfo
     {
         void *param;
-        const char *typeName;
+        const ParamType *type;
         std::string paramName;
+        ParamStore::Entry *persist;
+        ParamSnapshotStore::Slot *snapshot;
+        uint32_t version; // registryVersion when the value last changed
+        // Per patch unit of an array or blob, so a delta carries only the
+        // parts that changed.
+        std::vector<uint32_t> unitVersions;
+        // A C array registered as a parameter: param is a copy the instance
+        // owns and frees, written to the caller's array element by element
+        // on change.
+        void *array;
+        void (*copyToArray)(void *array, const void *param);
 
-        ParamInfo() : param(nullptr), typeName(nullptr) {}
-        ParamInfo(void *param, const char *typeName, const std::string &paramName) : param(param), typeName(typeName), paramName(paramName) {}
+        ParamInfo() : param(nullptr), type(nullptr), persist(nullptr), snapshot(nullptr), version(0), array(nullptr), copyToArray(nullptr) {}
+        ParamInfo(void *param, const ParamType *type, const std::string &paramName)
+            : param(param), type(type), paramName(paramName), persist(nullptr), snapshot(nullptr), version(0), array(nullptr), copyToArray(nullptr) {}
     };
 
     AsyncParamUpdate(const char *wifiSSID, const char *wifiPassword, const char *mqttHost, uint16_t mqttPort, const char *mqttUser, const char *mqttPassword, const char *deviceName, bool mqttLog);
@@ -52,51 +93,202 @@ public:
     AsyncParamUpdate(const char *deviceName, bool mqttLog = false);
 
     AsyncParamUpdate() {}
+    ~AsyncParamUpdate();
 
     static void setGateway(const char *wifiID, const char *wifiPass, const char *mqttHost, uint16_t mqttPort, const char *mqttUser, const char *mqttPassword)
     {
         LoRaMqttGateway::setGateway(wifiID, wifiPass, mqttHost, mqttPort, mqttUser, mqttPassword);
     }
 
+    // Updates are written into param from the network task. Read it in the
+    // application through the returned handle, or a snapshot(), rather than
+    // directly: neither can observe a half-written value.
     template <typename T>
-    void addParameter(const std::string &paramName, T &param)
+    ParamHandle<T> addParameter(const std::string &paramName, T &param)
     {
-        if (preferences.isKey(paramName.c_str()))
-        {
-            getParameter(paramName, param);
-        }
-        else
+        return bindParameter(paramName, param, nullptr, nullptr);
+    }
+
+    // A C array is handled as a std::array; either is persisted as one NVS
+    // blob and can be patched element by element.
+    template <typename T, size_t N>
+    ParamHandle<std::array<T, N>> addParameter(const std::string &paramName, T (&param)[N])
+    {
+        return bindArray<std::array<T, N>>(paramName, param);
+    }
+
+    // Registers data as opaque bytes, sent as a hex string, rather than as an
+    // array of numbers.
+    template <size_t N>
+    ParamHandle<ParamBlob<N>> addBlob(const std::string &paramName, uint8_t (&data)[N])
+    {
+        return bindArray<ParamBlob<N>>(paramName, data);
+    }
+
+    // Registers each field PARAM_STRUCT names as "<name>.<field>" and stores
+    // value as one NVS record under name. A record written under another
+    // schema version or layout goes to migrate, if given, and value keeps
+    // its compiled-in defaults otherwise; either way the record is then
+    // rewritten in the current layout.
+    template <typename S>
+    ParamStructHandle<S> addParameterStruct(const std::string &name, S &value, typename ParamStructHandle<S>::Migration migrate = nullptr)
+    {
+        loadStruct(name, &ParamStructType<S>::type, &value, sizeof(S), ParamStructTraits<S>::version(), ParamStructTraits<S>::layoutHash(),
+                   [&value, &migrate](const ParamStructRecord &stored)
+                   { return migrate && migrate(stored, value); });
+
+        ParamStructHandle<S> handle;
+        handle.store = &snapshots;
+        StructFieldRegistrar<S> registrar = {this, &name, &value, paramStore.track(name, &ParamStructType<S>::type, &value), &handle};
+        ParamStructTraits<S>::visit(registrar);
+        if (!registering)
         {
-            saveParameter(paramName, param);
+            publishRegistry(false);
         }
+        return handle;
+    }
+
+    // Calls callback with the old and new value whenever an update changes
+    // param. Callbacks run on the notification task, once per update.
+    template <typename T>
+    void onChange(const ParamHandle<T> &param, typename ParamHandle<T>::Callback callback)
+    {
+        notifier.listen({param}, [param, callback](const ParamChanges &changes)
+                        { callback(changes.before(param), changes.after(param)); });
+    }
 
-        params[paramName] = ParamInfo(&param, typeid(T).name(), paramName);
-        publishParametersList(paramName);
+    // Calls callback once for every update that changes any of params, so
+    // settings applied together are reconfigured together:
+    // onChange({kp, ki, kd}, [](const ParamChanges &c) { pid.setTunings(c.after(kp), ...); });
+    void onChange(std::initializer_list<ParamHandleBase> params, ParamNotifier::Callback callback)
+    {
+        notifier.listen(params, callback);
     }
 
-    void getParameter(const std::string &paramName, int &outValue)
+    // Call before begin(). Change callbacks run on a task of the given
+    // priority, pinned to core, with stackSize bytes of stack.
+    void setNotifyTask(UBaseType_t priority, BaseType_t core = NOTIFY_TASK_CORE, uint32_t stackSize = NOTIFY_TASK_STACK)
     {
-        outValue = preferences.getInt(paramName.c_str(), 0);
+        notifyPriority = priority;
+        notifyCore = core;
+        notifyStackSize = stackSize;
     }
 
-    void getParameter(const std::string &paramName, float &outValue)
+    // Every handle read through the returned snapshot sees the same update.
+    // Updates wait while a snapshot is held, so drop it soon and do not call
+    // into the library while holding it.
+    ParamSnapshot snapshot() const
     {
-        outValue = preferences.getFloat(paramName.c_str(), 0.0f);
+        return ParamSnapshot(snapshots);
     }
 
-    void getParameter(const std::string &paramName, bool &outValue)
+    // Brackets a run of addParameter calls: nothing is published until
+    // commitRegistration(), which sends one registry snapshot. Registration
+    // never waits for the network; a device that is offline publishes its
+    // registry when MQTT connects.
+    void beginRegistration();
+    void commitRegistration();
+
+    template <typename T>
+    void getParameter(const std::string &paramName, T &outValue)
     {
-        outValue = preferences.getBool(paramName.c_str(), false);
+        ParamTraits<T>::load(preferences, paramName.c_str(), outValue);
     }
 
-    void getParameter(const std::string &paramName, String &outValue)
+    // Encoding used for everything this device sends except log batches,
+    // which stay JSON; MQTT_WIRE_FORMAT or LORA_WIRE_FORMAT by default. With numericIds the registry snapshot lists
+    // parameters in ID order and deltas and updates key them by ID ("0", "1", ...).
+    void setWireFormat(WireFormat format, bool numericIds = false)
     {
-        outValue = preferences.getString(paramName.c_str(), "");
+        wireFormat = format;
+        this->numericIds = numericIds;
+        registryLayoutChanged = true;
+    }
+
+    // Call before begin(). Updates are written to NVS once a parameter has been
+    // dirty for coalesceMs, by a task of the given priority pinned to core.
+    void setPersistence(uint32_t coalesceMs, UBaseType_t priority = PERSIST_TASK_PRIORITY, BaseType_t core = PERSIST_TASK_CORE)
+    {
+        persistCoalesceMs = coalesceMs;
+        persistPriority = priority;
+        persistCore = core;
+    }
+
+    // Call before begin(). With mqttLog, buffered log records are published
+    // as one message every intervalMs, or as soon as batchSize bytes of them
+    // are waiting.
+    void setLogShipping(uint32_t intervalMs, size_t batchSize = LOG_BATCH_SIZE)
+    {
+        logIntervalMs = intervalMs;
+        logBatchSize = batchSize;
+    }
+
+    // Messages below level are discarded before they are buffered.
+    void setLogLevel(logging::LoggerLevel level)
+    {
+        logLevel = level;
+    }
+
+    uint32_t logRecordsDropped() const
+    {
+        return logShipper.droppedCount();
+    }
+
+    // Metrics are published on boards/<device>/metrics every intervalMs (0
+    // disables it) and on {"request":"metrics"}.
+    void setMetricsInterval(uint32_t intervalMs)
+    {
+        metricsIntervalMs = intervalMs;
+    }
+
+    void writeMetrics(JsonDocument &doc);
+
+    // Every MQTT publish goes through a queue that sends acknowledgements
+    // first, then registry, metrics and logs, each class with its own QoS.
+    // retain only allows the class's retained messages (acks, presence and
+    // registry snapshots) to be retained; it never retains the others.
+    void setPublishClass(PublishClass cls, uint8_t qos, bool retain)
+    {
+        publishQueue.configure(cls, qos, retain);
+    }
+
+    // Also takes updates published to boards/groups/<group>, so one publish
+    // reaches every device in the group. They are applied like updates to
+    // the device's own topic, except that parameters must be named, not
+    // numbered, and the confirmation goes to boards/groups/<group>/ack
+    // without being retained. False once MQTT_MAX_GROUPS groups are joined.
+    bool joinGroup(const char *group);
+
+    // Presence is "online"/"offline", retained on boards/<device>/status; the
+    // broker publishes "offline" as the Last Will. A heartbeat is sent there
+    // after intervalMs without any other publish (0 disables it).
+    void setHeartbeatInterval(uint32_t intervalMs)
+    {
+        heartbeatIntervalMs = intervalMs;
     }
 
     void begin()
     {
         preferences.begin("app", false);
+        if (!paramStore.begin(&preferences, persistCoalesceMs, persistPriority, persistCore))
+        {
+            logMessage("Could not start the persistence task, writing updates through", logging::LoggerLevel::LOGGER_LEVEL_WARN);
+        }
+        if (!notifier.begin(notifyPriority, notifyCore, notifyStackSize))
+        {
+            logMessage("Could not start the notification task, running change callbacks inline", logging::LoggerLevel::LOGGER_LEVEL_WARN);
+        }
+        if (mqttLog && !useLoRa && !logShipper.begin(&publishQueue, logTopic.c_str(), deviceName.c_str(), logIntervalMs, logBatchSize))
+        {
+            mqttLog = false;
+            logMessage("Could not start the log shipping task, logging locally", logging::LoggerLevel::LOGGER_LEVEL_WARN);
+        }
+    }
+
+    // Writes every pending update to NVS before returning.
+    void flush()
+    {
+        paramStore.flush();
     }
 
 private:
@@ -108,6 +300,20 @@ private:
     String updateTopic;
     String confirmationTopic;
     String logTopic;
+    String metricsTopic;
+    String statusTopic;
+    String willPayload;
+    WireFormat willFormat = WIRE_FORMAT_JSON;
+
+    struct GroupTopics
+    {
+        String updateTopic;
+        String ackTopic;
+    };
+    // Appended to by joinGroup() and only then counted, so the MQTT task
+    // can read the first groupCount entries at any time.
+    GroupTopics groups[MQTT_MAX_GROUPS];
+    std::atomic<size_t> groupCount{0};
     const char *mqttHost;
     uint16_t mqttPort;
     const char *mqttUser;
@@ -117,18 +323,67 @@ private:
     logging::Logger logger;
 
     AsyncMqttClient mqttClient;
+    PayloadAssembler payloadAssembler;
+    LoRaReassembler loraReassembler;
+    uint16_t loraSource = 0;
+    uint16_t loraMessageId = 0;
     Preferences preferences;
+    ParamStore paramStore;
+    ParamSnapshotStore snapshots;
+    ParamNotifier notifier;
+    UBaseType_t notifyPriority = NOTIFY_TASK_PRIORITY;
+    BaseType_t notifyCore = NOTIFY_TASK_CORE;
+    uint32_t notifyStackSize = NOTIFY_TASK_STACK;
+    uint32_t persistCoalesceMs = PERSIST_COALESCE_MS;
+    UBaseType_t persistPriority = PERSIST_TASK_PRIORITY;
+    BaseType_t persistCore = PERSIST_TASK_CORE;
+    PublishQueue publishQueue;
+    LogShipper logShipper;
+    logging::LoggerLevel logLevel = logging::LoggerLevel::LOGGER_LEVEL_INFO;
+    uint32_t logIntervalMs = LOG_BATCH_INTERVAL_MS;
+    size_t logBatchSize = LOG_BATCH_SIZE;
+    uint32_t metricsIntervalMs = METRICS_INTERVAL_MS;
+    uint32_t heartbeatIntervalMs = HEARTBEAT_INTERVAL_MS;
+    std::atomic<uint32_t> lastPublishAt{0};
 
-    std::unordered_map<std::string, ParamInfo> params;
-    std::queue<String> pendingMessages;
+    // Runtime metrics; updated lock-free from whichever task sees the event.
+    LatencyHistogram receiveLatency; // first fragment received -> parsed
+    LatencyHistogram applyLatency;
+    LatencyHistogram ackLatency;
+    MetricCounter updatesReceived{0};
+    MetricCounter duplicateUpdates{0};
+    MetricCounter messagesDropped{0};
+    MetricCounter wifiConnects{0};
+    MetricCounter mqttConnects{0};
+    uint32_t receiveStartedAt = 0;
 
-    TaskHandle_t wifiConnectionTask;
-    TaskHandle_t mqttConnectionTask;
+    // Sorted by paramName so incoming keys can be looked up in place; only
+    // appended to, and searched linearly, while a registration batch is open.
+    std::vector<ParamInfo> params;
+    bool paramsSorted = true;
+    bool registering = false;
+    bool registryLayoutChanged = true;
+    WireFormat wireFormat = WIRE_FORMAT_JSON;
+    bool numericIds = false;
+    uint32_t registryVersion = 0;
+    uint32_t acknowledgedVersion = 0;
+    uint32_t inFlightVersion = 0;
+    uint16_t registryPacketId = 0;
+    uint16_t recentPublishAcks[PUBLISH_ACK_HISTORY] = {};
+    uint8_t recentPublishAckIndex = 0;
+    // Set when a registry page found the publish queue full; housekeeping
+    // publishes a full snapshot once the queue has drained.
+    std::atomic<bool> registryRetry{false};
+    MessageIdCache recentUpdates;
+
+    TaskHandle_t wifiConnectionTask = NULL;
+    TaskHandle_t mqttConnectionTask = NULL;
+    TaskHandle_t housekeepingTask = NULL;
 
     static void OnLoRaReceived(int packetSize);
     static void reconnectWifi(void *parameters);
     static void reconnectMqtt(void *parameters);
-    static void sendActiveMessage(void *parameters);
+    static void housekeeping(void *parameters);
     static void WiFiEvent(WiFiEvent_t event);
     static void OnMqttConnect(bool sessionPresent);
     static void OnMqttDisconnect(AsyncMqttClientDisconnectReason reason);
@@ -136,18 +391,105 @@ private:
     static void OnMqttUnsubscribe(uint16_t packetId);
     static void OnMqttPublish(uint16_t packetId);
     static void OnMqttReceived(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total);
+    static void OnPublishSent(uint32_t version, uint16_t packetId);
     static void onTxDone();
     void InitMqtt();
-    void publishParametersList(std::string paramName);
-    bool updateParameter(const ParamInfo &paramInfo, JsonVariant value);
-    void saveParameter(const std::string &key, int value);
-    void saveParameter(const std::string &key, float value);
-    void saveParameter(const std::string &key, bool value);
-    void saveParameter(const std::string &key, const char *value);
-    void saveParameter(const std::string &key, const String &value);
-    void saveParameter(const std::string &key, double value);
+    void publishRegistry(bool full, bool waitForQueue = false);
+    JsonArray beginRegistryPage(JsonDocument &doc, const String &ip, uint32_t version, bool full, uint32_t base);
+    String registryKey(size_t index, bool full) const;
+    void registryValue(JsonVariant dst, const ParamInfo &p, bool full, uint32_t base) const;
+    bool publishPayload(PublishClass cls, const char *topic, bool retain, const JsonDocument &doc, uint32_t tag = 0);
+    void sendLoRaPayload(const JsonDocument &doc);
+    void insertParameter(const ParamInfo &paramInfo);
+    ParamInfo *findParameter(const char *name, size_t length);
+    ParamInfo *findParameterKey(const char *key, size_t length);
+    bool applyParameters(JsonObject parameters, bool numericKeys = true);
+    void handleUpdate(JsonDocument &doc, const GroupTopics *group = nullptr);
+    void sendConfirmation(const String &messageId, bool updated, bool retain, const GroupTopics *group = nullptr);
+    const GroupTopics *findGroup(const char *topic) const;
+    void publishMetrics();
+    JsonDocument presenceDocument(const char *status) const;
+    void updateWill();
+
+    // Loads or stores param's NVS value and adds it to the registry.
+    template <typename T>
+    ParamHandle<T> bindParameter(const std::string &paramName, T &param, void *array, void (*copyToArray)(void *array, const void *param))
+    {
+        if (preferences.isKey(paramName.c_str()))
+        {
+            getParameter(paramName, param);
+        }
+        else
+        {
+            saveParameter(paramName, param);
+        }
+
+        ParamInfo paramInfo(&param, &ParamTypeOf<T>::type, paramName);
+        paramInfo.array = array;
+        paramInfo.copyToArray = copyToArray;
+        if (copyToArray != nullptr)
+        {
+            copyToArray(array, &param);
+        }
+        paramInfo.snapshot = snapshots.add(paramInfo.type, &param);
+        insertParameter(paramInfo);
+        if (!registering)
+        {
+            publishRegistry(false);
+        }
+        return ParamHandle<T>(&snapshots, paramInfo.snapshot);
+    }
+
+    // The caller's array is never accessed as the V it is not: the parameter
+    // is a V the library owns, seeded from the array and copied back to it.
+    template <typename V, typename T, size_t N>
+    ParamHandle<V> bindArray(const std::string &paramName, T (&array)[N])
+    {
+        V *value = new V();
+        std::copy(array, array + N, value->begin());
+        return bindParameter(paramName, *value, array, &copyElements<V, T>);
+    }
+
+    template <typename V, typename T>
+    static void copyElements(void *array, const void *param)
+    {
+        const V &value = *static_cast<const V *>(param);
+        std::copy(value.begin(), value.end(), static_cast<T *>(array));
+    }
+
+    // Fields share the struct's NVS entry, so any of them changing rewrites
+    // the one record.
+    template <typename S>
+    struct StructFieldRegistrar
+    {
+        AsyncParamUpdate *owner;
+        const std::string *name;
+        S *value;
+        ParamStore::Entry *persist;
+        ParamStructHandle<S> *handle;
+
+        template <typename T>
+        void operator()(const char *field, T S::*member)
+        {
+            ParamInfo paramInfo(&(value->*member), &ParamTypeOf<T>::type, *name + "." + field);
+            paramInfo.persist = persist;
+            paramInfo.snapshot = owner->snapshots.add(paramInfo.type, paramInfo.param);
+            owner->insertParameter(paramInfo);
+            handle->slots.push_back(paramInfo.snapshot);
+        }
+    };
+
+    void loadStruct(const std::string &key, const ParamType *type, void *value, size_t size, uint16_t version, uint32_t layoutHash,
+                    const std::function<bool(const ParamStructRecord &stored)> &migrate);
+
+    template <typename T>
+    void saveParameter(const std::string &key, const T &value)
+    {
+        ParamTraits<T>::store(preferences, key.c_str(), value);
+    }
+
     void initializeLoRa();
-    void logMessage(const String &message);
+    void logMessage(const String &message, logging::LoggerLevel level = logging::LoggerLevel::LOGGER_LEVEL_INFO);
 };
 
 #endif
@@ -0,0 +1,57 @@
+#include "DeviceTable.h"
+
+GatewayDevice *DeviceTable::find(const char *name)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (strcmp(devices[i].name, name) == 0)
+        {
+            return &devices[i];
+        }
+    }
+    return nullptr;
+}
+
+GatewayDevice *DeviceTable::add(const char *name, uint32_t now, GatewayDevice &evicted, bool &didEvict)
+{
+    GatewayDevice *device;
+    didEvict = count == GATEWAY_MAX_DEVICES;
+    if (didEvict)
+    {
+        device = &devices[0];
+        for (size_t i = 1; i < count; i++)
+        {
+            if (now - devices[i].lastSeen > now - device->lastSeen)
+            {
+                device = &devices[i];
+            }
+        }
+        evicted = *device;
+    }
+    else
+    {
+        device = &devices[count++];
+    }
+
+    strncpy(device->name, name, sizeof(device->name) - 1);
+    device->name[sizeof(device->name) - 1] = '\0';
+    device->lastSeen = now;
+    device->rssi = 0;
+    device->snr = 0;
+    device->subscribed = false;
+    return device;
+}
+
+bool DeviceTable::expire(uint32_t now, uint32_t maxAge, GatewayDevice &expired)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (now - devices[i].lastSeen > maxAge)
+        {
+            expired = devices[i];
+            devices[i] = devices[--count];
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,45 @@
+#ifndef DeviceTable_h
+#define DeviceTable_h
+
+#include <Arduino.h>
+#include "LoRaFragments.h"
+
+#ifndef GATEWAY_MAX_DEVICES
+#define GATEWAY_MAX_DEVICES 32
+#endif
+#define GATEWAY_DEVICE_NAME_SIZE (LORA_MAX_DEVICE_NAME + 1)
+
+struct GatewayDevice
+{
+    char name[GATEWAY_DEVICE_NAME_SIZE];
+    uint32_t lastSeen;
+    int16_t rssi;
+    float snr;
+    bool subscribed;
+};
+
+// Fixed-capacity table of the nodes a gateway has heard from, so it can
+// subscribe once per node and reach it again on downlink.
+class DeviceTable
+{
+public:
+    DeviceTable() : count(0) {}
+
+    GatewayDevice *find(const char *name);
+
+    // Adds name, replacing the least recently seen device when the table is
+    // full; that device is copied to evicted and didEvict is set.
+    GatewayDevice *add(const char *name, uint32_t now, GatewayDevice &evicted, bool &didEvict);
+
+    // Removes one device not seen for maxAge ms, copying it to expired.
+    bool expire(uint32_t now, uint32_t maxAge, GatewayDevice &expired);
+
+    size_t size() const { return count; }
+    GatewayDevice &operator[](size_t index) { return devices[index]; }
+
+private:
+    GatewayDevice devices[GATEWAY_MAX_DEVICES];
+    size_t count;
+};
+
+#endif
@@ -0,0 +1,282 @@
+#include "LoRaDownlink.h"
+
+uint32_t loraPacketAirtimeUs(size_t length)
+{
+    const int sf = LORA_SPREADING_FACTOR;
+    const double symbolUs = (double)(1UL << sf) * 1e6 / LORA_SIGNAL_BANDWIDTH;
+    const int lowDataRate = symbolUs > 16000 ? 1 : 0;
+
+    // 28 + 16 for the CRC, with the explicit header the library uses.
+    int numerator = 8 * (int)length - 4 * sf + 28 + 16;
+    int denominator = 4 * (sf - 2 * lowDataRate);
+    int payloadSymbols = 8;
+    if (numerator > 0)
+    {
+        payloadSymbols += (numerator + denominator - 1) / denominator * LORA_CODING_RATE;
+    }
+    return (uint32_t)((LORA_PREAMBLE_LENGTH + 4.25 + payloadSymbols) * symbolUs);
+}
+
+uint32_t loraMessageAirtimeUs(size_t length)
+{
+    if (length <= LORA_MAX_PACKET_SIZE)
+    {
+        return loraPacketAirtimeUs(length);
+    }
+
+    size_t full = length / LORA_FRAGMENT_DATA_SIZE;
+    size_t rest = length % LORA_FRAGMENT_DATA_SIZE;
+    uint32_t airtime = full * loraPacketAirtimeUs(LORA_MAX_PACKET_SIZE);
+    if (rest > 0)
+    {
+        airtime += loraPacketAirtimeUs(LORA_FRAGMENT_HEADER_SIZE + rest);
+    }
+    return airtime;
+}
+
+void LoRaDutyCycle::refill(uint32_t now)
+{
+    // Every ms of wall time earns LORA_DUTY_CYCLE_PERMILLE us of airtime.
+    creditUs += (uint64_t)(now - refilledAt) * LORA_DUTY_CYCLE_PERMILLE;
+    if (creditUs > capacityUs())
+    {
+        creditUs = capacityUs();
+    }
+    refilledAt = now;
+}
+
+uint32_t LoRaDutyCycle::waitFor(uint32_t airtimeUs, uint32_t now)
+{
+    refill(now);
+    if (creditUs >= airtimeUs)
+    {
+        return 0;
+    }
+    return (airtimeUs - creditUs + LORA_DUTY_CYCLE_PERMILLE - 1) / LORA_DUTY_CYCLE_PERMILLE;
+}
+
+bool LoRaDownlinkQueue::enqueue(const char *device, JsonObjectConst update, uint32_t now, JsonDocument &superseded)
+{
+    Slot *slot = nullptr;
+    Slot *free = nullptr;
+    const char *request = requestOf(update);
+    for (Slot &candidate : slots)
+    {
+        if (candidate.used && strcmp(candidate.device, device) == 0 && strcmp(requestOf(candidate.update.as<JsonObjectConst>()), request) == 0)
+        {
+            slot = &candidate;
+            break;
+        }
+        if (!candidate.used && free == nullptr)
+        {
+            free = &candidate;
+        }
+    }
+
+    if (slot != nullptr)
+    {
+        // A redelivered update, including one merged already, must not
+        // bring back values a newer one has overwritten.
+        if (!update["id"].isNull() && (update["id"].as<String>() == slot->update["id"].as<String>() || wasMerged(*slot, update["id"].as<String>(), false)))
+        {
+            return true;
+        }
+        JsonDocument previous;
+        previous.set(slot->update["id"]);
+        if (merge(slot->update, update))
+        {
+            slot->mergedIds.add(previous.as<JsonVariantConst>());
+        }
+        else
+        {
+            superseded.add(previous.as<JsonVariantConst>());
+            for (JsonVariantConst id : slot->mergedIds.as<JsonArrayConst>())
+            {
+                superseded.add(id);
+            }
+            slot->mergedIds.clear();
+            replace(*slot, update);
+        }
+        coalesced++;
+        // An update already sent goes out again, under its new id, at once;
+        // one still waiting keeps its place in line.
+        if (slot->attempts > 0)
+        {
+            slot->attempts = 0;
+            slot->dueAt = now;
+        }
+    }
+    else if (free != nullptr)
+    {
+        slot = free;
+        strncpy(slot->device, device, sizeof(slot->device) - 1);
+        slot->device[sizeof(slot->device) - 1] = '\0';
+        replace(*slot, update);
+        slot->dueAt = now;
+        slot->attempts = 0;
+        slot->used = true;
+    }
+    else
+    {
+        dropped++;
+        return false;
+    }
+
+    // The node recognises retransmissions by id, so every distinct update
+    // needs one.
+    if (update["id"].isNull())
+    {
+        slot->update["id"] = "gw" + String(++sequence);
+    }
+    return true;
+}
+
+void LoRaDownlinkQueue::replace(Slot &slot, JsonObjectConst update)
+{
+    slot.update.set(update);
+    slot.update["Device"] = slot.device;
+}
+
+// The request an update carries, or "" for a parameter update. The node
+// ignores "request" next to "parameters", and so does the queue.
+const char *LoRaDownlinkQueue::requestOf(JsonObjectConst update)
+{
+    return update["parameters"].isNull() ? update["request"] | "" : "";
+}
+
+// Only parameter updates are merged, and only their parameters and id;
+// control fields never reach a pending update. Parameters named by ID
+// cannot be merged with ones named by key, so the newer update replaces the
+// pending one instead, as does a repeated request.
+bool LoRaDownlinkQueue::merge(JsonDocument &pending, JsonObjectConst update)
+{
+    if (update["parameters"].isNull() || strcmp(pending["keys"] | "", update["keys"] | "") != 0)
+    {
+        return false;
+    }
+
+    JsonObject parameters = pending["parameters"].is<JsonObject>() ? pending["parameters"].as<JsonObject>() : pending["parameters"].to<JsonObject>();
+    for (JsonPairConst parameter : update["parameters"].as<JsonObjectConst>())
+    {
+        parameters[parameter.key()] = parameter.value();
+    }
+    if (!update["id"].isNull())
+    {
+        pending["id"] = update["id"];
+    }
+    return true;
+}
+
+JsonDocument *LoRaDownlinkQueue::next(uint32_t now, uint32_t &wait)
+{
+    Slot *due = nullptr;
+    wait = UINT32_MAX;
+    for (Slot &slot : slots)
+    {
+        if (!slot.used)
+        {
+            continue;
+        }
+
+        int32_t until = (int32_t)(slot.dueAt - now);
+        if (until > 0)
+        {
+            if ((uint32_t)until < wait)
+            {
+                wait = until;
+            }
+        }
+        else if (slot.attempts > LORA_DOWNLINK_RETRIES)
+        {
+            vacate(slot);
+            failed++;
+        }
+        else if (due == nullptr || (int32_t)(slot.dueAt - due->dueAt) < 0)
+        {
+            due = &slot;
+        }
+    }
+    return due != nullptr ? &due->update : nullptr;
+}
+
+void LoRaDownlinkQueue::sent(JsonDocument *update, uint32_t now)
+{
+    Slot *slot = slotFor(update);
+    if (slot != nullptr)
+    {
+        slot->attempts++;
+        slot->dueAt = now + LORA_ACK_TIMEOUT_MS;
+    }
+}
+
+void LoRaDownlinkQueue::release(JsonDocument *update)
+{
+    Slot *slot = slotFor(update);
+    if (slot != nullptr)
+    {
+        vacate(*slot);
+    }
+}
+
+void LoRaDownlinkQueue::vacate(Slot &slot)
+{
+    slot.update.clear();
+    slot.mergedIds.clear();
+    slot.used = false;
+}
+
+bool LoRaDownlinkQueue::acknowledge(const char *device, const String &id, JsonDocument &coalesced)
+{
+    for (Slot &slot : slots)
+    {
+        if (!slot.used || strcmp(slot.device, device) != 0)
+        {
+            continue;
+        }
+        if (slot.attempts > 0 && slot.update["id"].as<String>() == id)
+        {
+            for (JsonVariantConst merged : slot.mergedIds.as<JsonArrayConst>())
+            {
+                coalesced.add(merged);
+            }
+            vacate(slot);
+            return true;
+        }
+        // An update sent before a newer one was merged into it has now been
+        // confirmed by the node itself.
+        if (wasMerged(slot, id, true))
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool LoRaDownlinkQueue::wasMerged(Slot &slot, const String &id, bool remove)
+{
+    JsonArray merged = slot.mergedIds.as<JsonArray>();
+    for (size_t i = 0; i < merged.size(); i++)
+    {
+        if (merged[i].as<String>() == id)
+        {
+            if (remove)
+            {
+                merged.remove(i);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+LoRaDownlinkQueue::Slot *LoRaDownlinkQueue::slotFor(JsonDocument *update)
+{
+    for (Slot &slot : slots)
+    {
+        if (&slot.update == update)
+        {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
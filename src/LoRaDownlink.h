@@ -0,0 +1,123 @@
+#ifndef LoRaDownlink_h
+#define LoRaDownlink_h
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "DeviceTable.h"
+#include "LoRaFragments.h"
+
+#ifndef LORA_DOWNLINK_SLOTS
+#define LORA_DOWNLINK_SLOTS GATEWAY_MAX_DEVICES
+#endif
+// Share of airtime the gateway may transmit, in thousandths, averaged over
+// LORA_DUTY_CYCLE_WINDOW_MS. The default is the 1% of the EU868 g band.
+#ifndef LORA_DUTY_CYCLE_PERMILLE
+#define LORA_DUTY_CYCLE_PERMILLE 10
+#endif
+#ifndef LORA_DUTY_CYCLE_WINDOW_MS
+#define LORA_DUTY_CYCLE_WINDOW_MS (60UL * 60 * 1000)
+#endif
+// Quiet time after an uplink before transmitting, so the rest of a
+// fragmented uplink is not talked over.
+#ifndef LORA_DOWNLINK_GUARD_MS
+#define LORA_DOWNLINK_GUARD_MS 200
+#endif
+// How long to wait for a node's acknowledgement before sending an update
+// again, and how many times to send it again.
+#ifndef LORA_ACK_TIMEOUT_MS
+#define LORA_ACK_TIMEOUT_MS 10000
+#endif
+#ifndef LORA_DOWNLINK_RETRIES
+#define LORA_DOWNLINK_RETRIES 3
+#endif
+
+// Time on air of one packet of length bytes with the radio settings in
+// LoRaFragments.h (explicit header, CRC on), per Semtech AN1200.13.
+uint32_t loraPacketAirtimeUs(size_t length);
+
+// Time on air of a message of length bytes, fragmented the way
+// LoRaFragmentWriter sends it.
+uint32_t loraMessageAirtimeUs(size_t length);
+
+// Token bucket of transmit airtime. It refills at LORA_DUTY_CYCLE_PERMILLE
+// of wall time and holds at most one window's worth, so a burst can use the
+// whole window's budget at once and then waits for it to refill.
+class LoRaDutyCycle
+{
+public:
+    LoRaDutyCycle() : creditUs(capacityUs()), refilledAt(0) {}
+
+    // 0 if airtimeUs may be spent now, otherwise how long to wait in ms.
+    uint32_t waitFor(uint32_t airtimeUs, uint32_t now);
+    void spend(uint32_t airtimeUs) { creditUs = creditUs > airtimeUs ? creditUs - airtimeUs : 0; }
+
+    static uint64_t capacityUs() { return (uint64_t)LORA_DUTY_CYCLE_WINDOW_MS * LORA_DUTY_CYCLE_PERMILLE; }
+
+private:
+    void refill(uint32_t now);
+
+    uint64_t creditUs;
+    uint32_t refilledAt;
+};
+
+// Pending parameter updates for LoRa nodes, at most one per device. An
+// update for a device that already has one waiting is merged into it, so
+// the node receives only the latest value of each parameter. Requests such
+// as {"request":"metrics"} wait in slots of their own, one per device and
+// request. A sent update stays in its slot until the node acknowledges its
+// id, and is sent again every LORA_ACK_TIMEOUT_MS up to
+// LORA_DOWNLINK_RETRIES times. The ids of updates merged into it are
+// handed back when it is acknowledged, so each can be confirmed.
+class LoRaDownlinkQueue
+{
+public:
+    LoRaDownlinkQueue() : sequence(0), coalesced(0), dropped(0), failed(0) {}
+
+    // Queues update for device, giving it an id if it has none; false when
+    // every slot holds another device. The ids of pending updates it
+    // replaces rather than merges with are added to superseded.
+    bool enqueue(const char *device, JsonObjectConst update, uint32_t now, JsonDocument &superseded);
+
+    // The update due longest ago, or nullptr with wait set to the ms until
+    // one is due. Updates out of retries are dropped here.
+    JsonDocument *next(uint32_t now, uint32_t &wait);
+    void sent(JsonDocument *update, uint32_t now);
+    void release(JsonDocument *update);
+
+    // Releases device's update if id is the one last sent to it, adding the
+    // ids of the updates merged into it to coalesced.
+    bool acknowledge(const char *device, const String &id, JsonDocument &coalesced);
+
+    uint32_t coalescedCount() const { return coalesced; }
+    uint32_t droppedCount() const { return dropped; }
+    uint32_t failedCount() const { return failed; }
+
+private:
+    struct Slot
+    {
+        char device[GATEWAY_DEVICE_NAME_SIZE];
+        JsonDocument update;
+        // Ids the update carried before newer ones were merged into it.
+        JsonDocument mergedIds;
+        uint32_t dueAt;
+        uint8_t attempts;
+        bool used;
+
+        Slot() : dueAt(0), attempts(0), used(false) { device[0] = '\0'; }
+    };
+
+    static const char *requestOf(JsonObjectConst update);
+    static bool merge(JsonDocument &pending, JsonObjectConst update);
+    static bool wasMerged(Slot &slot, const String &id, bool remove);
+    void replace(Slot &slot, JsonObjectConst update);
+    void vacate(Slot &slot);
+    Slot *slotFor(JsonDocument *update);
+
+    Slot slots[LORA_DOWNLINK_SLOTS];
+    uint32_t sequence;
+    uint32_t coalesced;
+    uint32_t dropped;
+    uint32_t failed;
+};
+
+#endif
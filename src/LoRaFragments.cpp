@@ -0,0 +1,209 @@
+#include "LoRaFragments.h"
+
+LoRaFragmentWriter::LoRaFragmentWriter(uint16_t source, uint16_t messageId, size_t length)
+    : source(source), messageId(messageId), length(length), index(0), packetFill(0), written(0), open(false), failed(false)
+{
+    size_t fragments = length <= LORA_MAX_PACKET_SIZE ? 1 : (length + LORA_FRAGMENT_DATA_SIZE - 1) / LORA_FRAGMENT_DATA_SIZE;
+    count = fragments > LORA_MAX_FRAGMENTS || length > LORA_MAX_MESSAGE_SIZE ? 0 : fragments;
+    failed = count == 0;
+}
+
+bool LoRaFragmentWriter::startPacket()
+{
+    if (!LoRa.beginPacket())
+    {
+        failed = true;
+        return false;
+    }
+    open = true;
+    packetFill = 0;
+    if (count > 1)
+    {
+        uint8_t header[LORA_FRAGMENT_HEADER_SIZE] = {LORA_FRAGMENT_MARKER, (uint8_t)(source & 0xff), (uint8_t)(source >> 8),
+                                                     (uint8_t)(messageId & 0xff), (uint8_t)(messageId >> 8), index, count};
+        LoRa.write(header, sizeof(header));
+    }
+    return true;
+}
+
+size_t LoRaFragmentWriter::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t LoRaFragmentWriter::write(const uint8_t *buffer, size_t size)
+{
+    size_t capacity = count > 1 ? LORA_FRAGMENT_DATA_SIZE : LORA_MAX_PACKET_SIZE;
+    size_t done = 0;
+    while (done < size && !failed && written < length)
+    {
+        if (!open && !startPacket())
+        {
+            break;
+        }
+
+        size_t chunk = size - done;
+        if (chunk > capacity - packetFill)
+        {
+            chunk = capacity - packetFill;
+        }
+        LoRa.write(buffer + done, chunk);
+        packetFill += chunk;
+        written += chunk;
+        done += chunk;
+
+        if (packetFill == capacity && written < length)
+        {
+            failed = !LoRa.endPacket() || failed;
+            open = false;
+            index++;
+        }
+    }
+    return done;
+}
+
+bool LoRaFragmentWriter::end()
+{
+    if (open)
+    {
+        failed = !LoRa.endPacket() || failed;
+        open = false;
+    }
+    return !failed && written == length;
+}
+
+LoRaReassembler::~LoRaReassembler()
+{
+    release();
+}
+
+void LoRaReassembler::release()
+{
+    for (size_t i = 0; i < slotCount; i++)
+    {
+        free(slots[i].buffer);
+    }
+    free(slots);
+    slots = nullptr;
+    slotCount = 0;
+}
+
+bool LoRaReassembler::begin(size_t slotCount)
+{
+    if (slots != nullptr)
+    {
+        return true;
+    }
+
+    slots = static_cast<Slot *>(calloc(slotCount, sizeof(Slot)));
+    if (slots == nullptr)
+    {
+        return false;
+    }
+    this->slotCount = slotCount;
+    for (size_t i = 0; i < slotCount; i++)
+    {
+        slots[i].buffer = static_cast<char *>(malloc(LORA_MAX_MESSAGE_SIZE));
+        if (slots[i].buffer == nullptr)
+        {
+            release();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LoRaReassembler::accept(const char *packet, size_t packetLength, uint32_t now, const char *&data, size_t &length)
+{
+    if (packetLength == 0 || (uint8_t)packet[0] != LORA_FRAGMENT_MARKER)
+    {
+        data = packet;
+        length = packetLength;
+        return packetLength > 0;
+    }
+    if (packetLength <= LORA_FRAGMENT_HEADER_SIZE || slots == nullptr)
+    {
+        return false;
+    }
+
+    uint16_t source = (uint8_t)packet[1] | ((uint8_t)packet[2] << 8);
+    uint16_t messageId = (uint8_t)packet[3] | ((uint8_t)packet[4] << 8);
+    uint8_t index = packet[5];
+    uint8_t count = packet[6];
+    size_t fragmentLength = packetLength - LORA_FRAGMENT_HEADER_SIZE;
+    size_t offset = (size_t)index * LORA_FRAGMENT_DATA_SIZE;
+    if (count < 2 || count > LORA_MAX_FRAGMENTS || index >= count || offset + fragmentLength > LORA_MAX_MESSAGE_SIZE ||
+        (index + 1 < count && fragmentLength != LORA_FRAGMENT_DATA_SIZE))
+    {
+        return false;
+    }
+
+    Slot *slot = slotFor(source, messageId, count, now);
+    memcpy(slot->buffer + offset, packet + LORA_FRAGMENT_HEADER_SIZE, fragmentLength);
+    slot->received |= 1UL << index;
+    if (index + 1 == count)
+    {
+        slot->length = offset + fragmentLength;
+    }
+
+    uint32_t all = count == 32 ? 0xffffffffUL : (1UL << count) - 1;
+    if (slot->received != all)
+    {
+        return false;
+    }
+
+    slot->active = false;
+    data = slot->buffer;
+    length = slot->length;
+    return true;
+}
+
+// Finds the slot collecting messageId from source, expiring stale ones on the
+// way. A new message takes a free slot or, failing that, the oldest one.
+LoRaReassembler::Slot *LoRaReassembler::slotFor(uint16_t source, uint16_t messageId, uint8_t count, uint32_t now)
+{
+    Slot *match = nullptr;
+    Slot *freeSlot = nullptr;
+    Slot *oldest = nullptr;
+    for (size_t i = 0; i < slotCount; i++)
+    {
+        Slot *slot = &slots[i];
+        if (slot->active && now - slot->startedAt > LORA_REASSEMBLY_TIMEOUT_MS)
+        {
+            slot->active = false;
+            timeouts++;
+        }
+        if (!slot->active)
+        {
+            freeSlot = freeSlot ? freeSlot : slot;
+            continue;
+        }
+        if (slot->source == source && slot->messageId == messageId && slot->count == count)
+        {
+            match = slot;
+        }
+        if (oldest == nullptr || now - slot->startedAt > now - oldest->startedAt)
+        {
+            oldest = slot;
+        }
+    }
+
+    if (match != nullptr)
+    {
+        return match;
+    }
+
+    Slot *slot = freeSlot ? freeSlot : oldest;
+    if (slot->active)
+    {
+        timeouts++;
+    }
+    slot->active = true;
+    slot->source = source;
+    slot->messageId = messageId;
+    slot->count = count;
+    slot->received = 0;
+    slot->length = 0;
+    slot->startedAt = now;
+    return slot;
+}
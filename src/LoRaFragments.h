@@ -0,0 +1,123 @@
+#ifndef LoRaFragments_h
+#define LoRaFragments_h
+
+#include <Arduino.h>
+#include <LoRa.h>
+
+#define LORA_MAX_PACKET_SIZE 255
+// Radio settings shared by nodes and the gateway; the defaults are the LoRa
+// library's own.
+#ifndef LORA_SPREADING_FACTOR
+#define LORA_SPREADING_FACTOR 7
+#endif
+#ifndef LORA_SIGNAL_BANDWIDTH
+#define LORA_SIGNAL_BANDWIDTH 125E3
+#endif
+#ifndef LORA_CODING_RATE
+#define LORA_CODING_RATE 5
+#endif
+#define LORA_PREAMBLE_LENGTH 8
+// A fragment is marker, source and message ID (both little endian), index
+// and count, then data. The source tells apart senders whose message IDs
+// collide. 0xF5 cannot start a JSON or MessagePack object, so packets that
+// fit in one frame are still sent bare.
+#define LORA_FRAGMENT_MARKER 0xF5
+#define LORA_FRAGMENT_HEADER_SIZE 7
+#define LORA_FRAGMENT_DATA_SIZE (LORA_MAX_PACKET_SIZE - LORA_FRAGMENT_HEADER_SIZE)
+#define LORA_MAX_FRAGMENTS 32
+#ifndef LORA_MAX_MESSAGE_SIZE
+#define LORA_MAX_MESSAGE_SIZE 2048
+#endif
+// Longest device name a gateway tracks; a node refuses to start with more.
+#define LORA_MAX_DEVICE_NAME 31
+#ifndef LORA_REASSEMBLY_TIMEOUT_MS
+#define LORA_REASSEMBLY_TIMEOUT_MS 5000
+#endif
+
+inline void configureLoRaRadio()
+{
+    LoRa.setSpreadingFactor(LORA_SPREADING_FACTOR);
+    LoRa.setSignalBandwidth(LORA_SIGNAL_BANDWIDTH);
+    LoRa.setCodingRate4(LORA_CODING_RATE);
+}
+
+// The fragment source of a sender: its name folded into 16 bits (FNV-1a).
+inline uint16_t loraSourceId(const char *name)
+{
+    uint32_t hash = 2166136261UL;
+    for (; *name != '\0'; name++)
+    {
+        hash = (hash ^ (uint8_t)*name) * 16777619UL;
+    }
+    return (uint16_t)(hash ^ (hash >> 16));
+}
+
+// Streams a message of known length into as many LoRa packets as it needs.
+class LoRaFragmentWriter : public Print
+{
+public:
+    LoRaFragmentWriter(uint16_t source, uint16_t messageId, size_t length);
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+
+    // Sends the last packet; false if any packet could not be sent.
+    bool end();
+
+private:
+    bool startPacket();
+
+    uint16_t source;
+    uint16_t messageId;
+    size_t length;
+    uint8_t count;
+    uint8_t index;
+    size_t packetFill;
+    size_t written;
+    bool open;
+    bool failed;
+};
+
+// Collects fragments into preallocated slots, one message per slot, and
+// drops messages that stay incomplete for LORA_REASSEMBLY_TIMEOUT_MS.
+class LoRaReassembler
+{
+public:
+    LoRaReassembler() : slots(nullptr), slotCount(0), timeouts(0) {}
+    ~LoRaReassembler();
+
+    bool begin(size_t slotCount);
+
+    // Returns true once packet completes a message, which is then available
+    // through data/length until the next call. Unfragmented packets are
+    // returned as they are.
+    bool accept(const char *packet, size_t packetLength, uint32_t now, const char *&data, size_t &length);
+
+    uint32_t timedOut() const { return timeouts; }
+
+private:
+    struct Slot
+    {
+        char *buffer;
+        bool active;
+        uint16_t source;
+        uint16_t messageId;
+        uint8_t count;
+        uint32_t received;
+        size_t length;
+        uint32_t startedAt;
+    };
+
+    LoRaReassembler(const LoRaReassembler &) = delete;
+    LoRaReassembler &operator=(const LoRaReassembler &) = delete;
+
+    Slot *slotFor(uint16_t source, uint16_t messageId, uint8_t count, uint32_t now);
+    void release();
+
+    Slot *slots;
+    size_t slotCount;
+    uint32_t timeouts;
+};
+
+#endif
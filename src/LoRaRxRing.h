@@ -0,0 +1,73 @@
+#ifndef LoRaRxRing_h
+#define LoRaRxRing_h
+
+#include <Arduino.h>
+#include <atomic>
+#include "LoRaFragments.h"
+
+#ifndef LORA_RX_RING_SLOTS
+#define LORA_RX_RING_SLOTS 8
+#endif
+
+struct LoRaRxPacket
+{
+    uint32_t timestamp;
+    int16_t rssi;
+    float snr;
+    uint16_t length;
+    char data[LORA_MAX_PACKET_SIZE];
+};
+
+// Single-producer/single-consumer ring of preallocated packet slots. The
+// producer is the LoRa receive interrupt, so its side never allocates, locks
+// or blocks: when every slot is in use the packet is dropped and counted.
+class LoRaRxRing
+{
+public:
+    LoRaRxRing() : head(0), tail(0), overruns(0) {}
+
+    // Producer: a free slot to fill, or nullptr when the ring is full.
+    LoRaRxPacket *IRAM_ATTR beginWrite()
+    {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= LORA_RX_RING_SLOTS)
+        {
+            overruns.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &slots[h % LORA_RX_RING_SLOTS];
+    }
+
+    void IRAM_ATTR commitWrite()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Consumer: the oldest filled slot, or nullptr when the ring is empty.
+    // The slot stays valid until pop().
+    LoRaRxPacket *peek()
+    {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+        return &slots[t % LORA_RX_RING_SLOTS];
+    }
+
+    void pop()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    uint32_t received() const { return head.load(std::memory_order_relaxed); }
+    uint32_t overrunCount() const { return overruns.load(std::memory_order_relaxed); }
+
+private:
+    LoRaRxPacket slots[LORA_RX_RING_SLOTS];
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    std::atomic<uint32_t> overruns;
+};
+
+#endif
@@ -0,0 +1,30 @@
+#include "LoRaToMqttGateway.h"
+
+const char *LoRaMqttGateway::wifiSSID;
+const char *LoRaMqttGateway::wifiPassword;
+
+AsyncMqttClient LoRaMqttGateway::mqttClient;
+LoRaRxRing LoRaMqttGateway::loraRing;
+SemaphoreHandle_t LoRaMqttGateway::loraReady;
+DeviceTable LoRaMqttGateway::devices;
+SemaphoreHandle_t LoRaMqttGateway::deviceMutex;
+LoRaReassembler LoRaMqttGateway::reassembler;
+uint16_t LoRaMqttGateway::loraMessageId;
+uint32_t LoRaMqttGateway::lastUplinkAt;
+
+PayloadAssembler LoRaMqttGateway::mqttPayload;
+LoRaDownlinkQueue LoRaMqttGateway::downlinks;
+LoRaDutyCycle LoRaMqttGateway::dutyCycle;
+SemaphoreHandle_t LoRaMqttGateway::downlinkMutex;
+uint32_t LoRaMqttGateway::downlinkCount;
+MessageIdCache LoRaMqttGateway::deliveredUpdates;
+
+LatencyHistogram LoRaMqttGateway::uplinkLatency;
+MetricCounter LoRaMqttGateway::wifiConnects(0);
+MetricCounter LoRaMqttGateway::mqttConnects(0);
+uint32_t LoRaMqttGateway::airtimeMs;
+uint32_t LoRaMqttGateway::metricsPublishedAt;
+
+TaskHandle_t LoRaMqttGateway::wifiGatewayConnectionTask;
+TaskHandle_t LoRaMqttGateway::mqttGatewayConnectionTask;
+TaskHandle_t LoRaMqttGateway::loraGatewayTask;
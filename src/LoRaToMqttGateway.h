@@ -7,6 +7,14 @@
 #include <WiFi.h>
 #include <string>
 #include <LoRa.h>
+#include "DeviceTable.h"
+#include "LoRaDownlink.h"
+#include "LoRaFragments.h"
+#include "LoRaRxRing.h"
+#include "MessageIdCache.h"
+#include "Metrics.h"
+#include "PayloadAssembler.h"
+#include "WireFormat.h"
 
 #define SCK 5   // GPIO5  -- SX1276's SCK
 #define MISO 19 // GPIO19 -- SX1276's MISO
@@ -17,20 +25,24 @@
 #define BAND 915E6
 #define DELAY_MS 5000
 #define REGISTRY_TOPIC "boards/registry"
+#define GATEWAY_CLIENT_ID "LoRaGatewayDevice"
+#define GATEWAY_METRICS_TOPIC "boards/" GATEWAY_CLIENT_ID METRICS_SUFFIX
+#define GATEWAY_STATUS_TOPIC "boards/" GATEWAY_CLIENT_ID "/status"
+#define GATEWAY_ONLINE "{\"Device\":\"" GATEWAY_CLIENT_ID "\",\"status\":\"online\"}"
+#define GATEWAY_OFFLINE "{\"Device\":\"" GATEWAY_CLIENT_ID "\",\"status\":\"offline\"}"
 #define MQTT_QOS_LEVEL 2
+#ifndef GATEWAY_DEVICE_TIMEOUT_MS
+#define GATEWAY_DEVICE_TIMEOUT_MS (60UL * 60 * 1000)
+#endif
+#define GATEWAY_SWEEP_MS 60000
+#define GATEWAY_DOWNLINK_FORMAT LORA_WIRE_FORMAT
+#ifndef LORA_REASSEMBLY_SLOTS
+#define LORA_REASSEMBLY_SLOTS 4
+#endif
 #define WIFI_EVENT_CONNECTED SYSTEM_EVENT_STA_GOT_IP
 #define WIFI_EVENT_DISCONNECTED SYSTEM_EVENT_STA_DISCONNECTED
 #define MQTT_SECURE true
 
-const char *wifiSSID;
-const char *wifiPassword;
-
-AsyncMqttClient mqttClient;
-QueueHandle_t loraQueue;
-
-TaskHandle_t wifiGatewayConnectionTask;
-TaskHandle_t mqttGatewayConnectionTask;
-
 class LoRaMqttGateway
 {
 public:
@@ -41,17 +53,28 @@ public:
         configMqttConnection(mqttHost, mqttPort, mqttUser, mqttPassword);
         WiFi.onEvent(WiFiEvent);
 
-        loraQueue = xQueueCreate(10, sizeof(char) * 256);
-        if (loraQueue == NULL)
+        loraReady = xSemaphoreCreateBinary();
+        deviceMutex = xSemaphoreCreateMutex();
+        downlinkMutex = xSemaphoreCreateMutex();
+        if (loraReady == NULL || deviceMutex == NULL || downlinkMutex == NULL)
         {
-            Serial.println("Error creating the queue");
+            Serial.println("Error creating the LoRa semaphore");
             while (1)
                 ;
         }
 
+        if (!reassembler.begin(LORA_REASSEMBLY_SLOTS))
+        {
+            Serial.println("Error allocating the LoRa reassembly buffers");
+        }
+        if (!mqttPayload.begin(LORA_MAX_MESSAGE_SIZE))
+        {
+            Serial.println("Error allocating the MQTT payload buffer");
+        }
+
         xTaskCreate(reconnectGatewayWifi, "WiFiReconnect", 4096, NULL, 1, &wifiGatewayConnectionTask);
         xTaskCreate(reconnectGatewayMqtt, "MqttReconnect", 4096, NULL, 1, &mqttGatewayConnectionTask);
-        xTaskCreate(loraTask, "LoRaTask", 4096, NULL, 1, NULL);
+        xTaskCreate(loraTask, "LoRaTask", 4096, NULL, 1, &loraGatewayTask);
         vTaskSuspend(mqttGatewayConnectionTask);
         initializeLoRaMqttGateway();
     }
@@ -63,35 +86,135 @@ public:
         Serial.println(message);
     }
 
-    static void onLoRaReceived(int packetSize)
+    // Runs in the DIO0 interrupt: copies the packet into the next ring slot
+    // and wakes loraTask, without allocating or printing.
+    static void IRAM_ATTR onLoRaReceived(int packetSize)
     {
+        LoRaRxPacket *packet = loraRing.beginWrite();
+        if (packet == nullptr)
+        {
+            return;
+        }
 
-        String message = "";
-
-        while (LoRa.available())
+        packet->length = 0;
+        while (LoRa.available() && packet->length < sizeof(packet->data))
         {
-            message += (char)LoRa.read();
+            packet->data[packet->length++] = (char)LoRa.read();
         }
-        Serial.print("Received packet: ");
-        Serial.println(message);
+        packet->rssi = LoRa.packetRssi();
+        packet->snr = LoRa.packetSnr();
+        packet->timestamp = millis();
+        loraRing.commitWrite();
+
+        BaseType_t woken = pdFALSE;
+        xSemaphoreGiveFromISR(loraReady, &woken);
+        if (woken)
+        {
+            portYIELD_FROM_ISR();
+        }
+    }
 
-        char *msg = strdup(message.c_str());
-        if (xQueueSendFromISR(loraQueue, &msg, NULL) != pdPASS)
+    // Copies what the gateway knows about a node; false if it has not been
+    // heard from or has expired.
+    static bool findDevice(const char *name, GatewayDevice &device)
+    {
+        xSemaphoreTake(deviceMutex, portMAX_DELAY);
+        GatewayDevice *entry = devices.find(name);
+        if (entry != nullptr)
         {
-            Serial.println("Failed to send to queue");
-            free(msg);
+            device = *entry;
         }
+        xSemaphoreGive(deviceMutex);
+        return entry != nullptr;
     }
 
-    static void publishToLoRa(String message)
+    static uint32_t loraPacketsReceived() { return loraRing.received(); }
+    static uint32_t loraOverruns() { return loraRing.overrunCount(); }
+    static uint32_t downlinksSent() { return downlinkCount; }
+    static uint32_t downlinksCoalesced() { return downlinks.coalescedCount(); }
+    static uint32_t downlinksDropped() { return downlinks.droppedCount(); }
+    static uint32_t downlinksUnacknowledged() { return downlinks.failedCount(); }
+
+    // Radio, queue and connection counters, published on
+    // GATEWAY_METRICS_TOPIC every METRICS_INTERVAL_MS.
+    static void writeMetrics(JsonDocument &doc)
     {
-        LoRa.beginPacket();
-        LoRa.print(message);
-        LoRa.endPacket();
-        LoRa.receive();
+        doc["Device"] = GATEWAY_CLIENT_ID;
+        doc["uptimeMs"] = millis();
+        doc["freeHeap"] = xPortGetFreeHeapSize();
+        doc["minFreeHeap"] = xPortGetMinimumEverFreeHeapSize();
+
+        xSemaphoreTake(deviceMutex, portMAX_DELAY);
+        size_t deviceCount = devices.size();
+        xSemaphoreGive(deviceMutex);
+
+        JsonObject counters = doc["counters"].to<JsonObject>();
+        counters["loraReceived"] = loraPacketsReceived();
+        counters["loraOverruns"] = loraOverruns();
+        counters["reassemblyTimeouts"] = reassembler.timedOut();
+        counters["devices"] = deviceCount;
+        counters["downlinksSent"] = downlinksSent();
+        counters["downlinksCoalesced"] = downlinksCoalesced();
+        counters["downlinksDropped"] = downlinksDropped();
+        counters["downlinksUnacknowledged"] = downlinksUnacknowledged();
+        counters["airtimeMs"] = airtimeMs;
+        counters["wifiConnects"] = wifiConnects.load();
+        counters["mqttConnects"] = mqttConnects.load();
+
+        JsonObject stackFree = doc["stackFree"].to<JsonObject>();
+        addStackHighWaterMark(stackFree, "WiFiReconnect", wifiGatewayConnectionTask);
+        addStackHighWaterMark(stackFree, "MqttReconnect", mqttGatewayConnectionTask);
+        addStackHighWaterMark(stackFree, "LoRaTask", loraGatewayTask);
+
+        LatencyHistogram::boundsToJson(doc["bucketsUs"].to<JsonArray>());
+        JsonObject latency = doc["latencyUs"].to<JsonObject>();
+        uplinkLatency.toJson(latency["uplinkPublish"].to<JsonObject>());
+    }
+
+    // Queues an update carrying "Device" for the downlink scheduler; false
+    // if it was not queued.
+    static bool publishToLoRa(String message)
+    {
+        JsonDocument doc;
+        DeserializationError error = deserializeJson(doc, message);
+        if (error || !doc["Device"].is<const char *>())
+        {
+            Serial.println("Downlink message needs a 'Device' key");
+            return false;
+        }
+        return queueDownlink(doc["Device"].as<String>(), doc.as<JsonObjectConst>());
     }
 
 private:
+    static const char *wifiSSID;
+    static const char *wifiPassword;
+
+    static AsyncMqttClient mqttClient;
+    static LoRaRxRing loraRing;
+    static SemaphoreHandle_t loraReady;
+    static DeviceTable devices;
+    static SemaphoreHandle_t deviceMutex;
+    static LoRaReassembler reassembler;
+    static uint16_t loraMessageId;
+    static uint32_t lastUplinkAt;
+
+    static PayloadAssembler mqttPayload;
+    static LoRaDownlinkQueue downlinks;
+    static LoRaDutyCycle dutyCycle;
+    static SemaphoreHandle_t downlinkMutex;
+    static uint32_t downlinkCount;
+    static MessageIdCache deliveredUpdates;
+
+    static LatencyHistogram uplinkLatency; // packet received -> published to MQTT
+    static MetricCounter wifiConnects;
+    static MetricCounter mqttConnects;
+    static uint32_t airtimeMs;
+    static uint32_t metricsPublishedAt;
+
+    static TaskHandle_t wifiGatewayConnectionTask;
+    static TaskHandle_t mqttGatewayConnectionTask;
+    static TaskHandle_t loraGatewayTask;
+
     static void initializeLoRaMqttGateway()
     {
         Serial.println("Initializing SPI...");
@@ -109,6 +232,8 @@ private:
         }
 
         Serial.println("Starting LoRa success!");
+        configureLoRaRadio();
+        loraMessageId = esp_random();
 
         Serial.println("Setting LoRa receive callback...");
         LoRa.onReceive(onLoRaReceived);
@@ -117,48 +242,364 @@ private:
         LoRa.receive();
     }
 
+    // Owns the radio: drains received packets, then sends whatever queued
+    // downlinks the duty cycle allows, sleeping until the next one is due or
+    // a packet or update arrives.
     static void loraTask(void *pvParameters)
     {
-        char *packet;
+        uint32_t wait = GATEWAY_SWEEP_MS;
         while (true)
         {
-            if (xQueueReceive(loraQueue, &packet, portMAX_DELAY))
+            xSemaphoreTake(loraReady, pdMS_TO_TICKS(wait));
+            while (LoRaRxPacket *packet = loraRing.peek())
+            {
+                lastUplinkAt = packet->timestamp;
+                handleLoRaPacket(*packet);
+                loraRing.pop();
+            }
+            expireDevices(millis());
+            wait = sendDownlinks();
+            uint32_t metricsDue = publishMetrics();
+            if (metricsDue < wait)
+            {
+                wait = metricsDue;
+            }
+        }
+    }
+
+    // Publishes metrics if they are due; returns the ms until they next are.
+    static uint32_t publishMetrics()
+    {
+        uint32_t elapsed = millis() - metricsPublishedAt;
+        if (elapsed < METRICS_INTERVAL_MS)
+        {
+            return METRICS_INTERVAL_MS - elapsed;
+        }
+
+        metricsPublishedAt = millis();
+        if (mqttClient.connected())
+        {
+            JsonDocument doc;
+            writeMetrics(doc);
+            String message;
+            serializeJson(doc, message);
+            mqttClient.publish(GATEWAY_METRICS_TOPIC, MQTT_QOS_LEVEL, false, message.c_str());
+        }
+        return METRICS_INTERVAL_MS;
+    }
+
+    // Sends queued updates, and those due to be sent again, oldest first.
+    // Returns how long to wait, in ms, before trying again.
+    static uint32_t sendDownlinks()
+    {
+        while (true)
+        {
+            uint32_t now = millis();
+            if (now - lastUplinkAt < LORA_DOWNLINK_GUARD_MS)
+            {
+                return LORA_DOWNLINK_GUARD_MS - (now - lastUplinkAt);
+            }
+
+            xSemaphoreTake(downlinkMutex, portMAX_DELAY);
+            uint32_t due;
+            JsonDocument *pending = downlinks.next(now, due);
+            if (pending == nullptr)
+            {
+                xSemaphoreGive(downlinkMutex);
+                return due < GATEWAY_SWEEP_MS ? due : GATEWAY_SWEEP_MS;
+            }
+
+            size_t length = measurePayload(*pending, GATEWAY_DOWNLINK_FORMAT);
+            uint32_t airtime = loraMessageAirtimeUs(length);
+            if (length > LORA_MAX_MESSAGE_SIZE || airtime > LoRaDutyCycle::capacityUs())
+            {
+                Serial.println("Downlink for " + (*pending)["Device"].as<String>() + " too large to send, discarding");
+                downlinks.release(pending);
+                xSemaphoreGive(downlinkMutex);
+                continue;
+            }
+
+            uint32_t wait = dutyCycle.waitFor(airtime, now);
+            if (wait > 0)
+            {
+                xSemaphoreGive(downlinkMutex);
+                return wait < GATEWAY_SWEEP_MS ? wait : GATEWAY_SWEEP_MS;
+            }
+
+            JsonDocument update(*pending);
+            downlinks.sent(pending, now);
+            xSemaphoreGive(downlinkMutex);
+
+            LoRaFragmentWriter writer(loraSourceId(GATEWAY_CLIENT_ID), loraMessageId++, length);
+            serializePayload(update, GATEWAY_DOWNLINK_FORMAT, writer);
+            bool sent = writer.end();
+            LoRa.receive();
+            dutyCycle.spend(airtime);
+            airtimeMs += airtime / 1000;
+            downlinkCount++;
+
+            Serial.println((sent ? "Sent downlink to " : "Could not send downlink to ") + update["Device"].as<String>() + " (" + String(airtime / 1000) + " ms on air)");
+        }
+    }
+
+    static bool queueDownlink(const String &device, JsonObjectConst update)
+    {
+        if (!update["parameters"].is<JsonObjectConst>() && !update["request"].is<const char *>())
+        {
+            return false;
+        }
+
+        GatewayDevice known;
+        if (!findDevice(device.c_str(), known))
+        {
+            Serial.println("Downlink for unknown device " + device + ", discarding");
+            return false;
+        }
+
+        bool delivered;
+        JsonDocument superseded;
+        xSemaphoreTake(downlinkMutex, portMAX_DELAY);
+        bool queued = deliveredUpdates.find(deliveryKey(device, update["id"]).c_str(), delivered) ||
+                      downlinks.enqueue(device.c_str(), update, millis(), superseded);
+        for (JsonVariantConst id : superseded.as<JsonArrayConst>())
+        {
+            deliveredUpdates.add(deliveryKey(device, id).c_str(), false);
+        }
+        xSemaphoreGive(downlinkMutex);
+        confirmSuperseded(device, superseded.as<JsonArrayConst>());
+        if (!queued)
+        {
+            Serial.println("Downlink queue full, discarding update for " + device);
+            return false;
+        }
+
+        xSemaphoreGive(loraReady);
+        return true;
+    }
+
+    static String deliveryKey(const String &device, JsonVariantConst id)
+    {
+        return id.isNull() ? String() : device + "/" + id.as<String>();
+    }
+
+    // Pending updates replaced by one that could not be merged with them,
+    // such as one naming parameters by key instead of ID, never reach the
+    // node; they are confirmed as superseded instead.
+    static void confirmSuperseded(const String &device, JsonArrayConst ids)
+    {
+        for (JsonVariantConst id : ids)
+        {
+            JsonDocument confirmation;
+            confirmation["id"] = id;
+            confirmation["Device"] = device;
+            confirmation["status"] = "superseded";
+            String message;
+            serializeJson(confirmation, message);
+            publishToMQTT(message);
+        }
+    }
+
+    // Updates merged into the one the node confirmed were applied with it,
+    // so each gets the same confirmation under its own id.
+    static void confirmCoalesced(JsonDocument &ack, JsonArrayConst ids)
+    {
+        String newest = ack["id"].as<String>();
+        for (JsonVariantConst id : ids)
+        {
+            ack["id"] = id;
+            ack["coalescedInto"] = newest;
+            String message;
+            serializeJson(ack, message);
+            publishToMQTT(message);
+        }
+    }
+
+    // A node acknowledges every update it receives, including ones it has
+    // already applied, by echoing its id with a "status". Only the first
+    // acknowledgement of an id is forwarded to MQTT; an update redelivered
+    // by the broker after that is not sent to the node again. The ids of
+    // updates merged into the acknowledged one are added to coalesced.
+    static bool noteAcknowledgement(const String &device, JsonObjectConst ack, JsonDocument &coalesced)
+    {
+        String key = deliveryKey(device, ack["id"]);
+        bool delivered;
+        xSemaphoreTake(downlinkMutex, portMAX_DELAY);
+        bool duplicate = deliveredUpdates.find(key.c_str(), delivered);
+        if (!duplicate)
+        {
+            bool updated = strcmp(ack["status"] | "", "updated") == 0;
+            downlinks.acknowledge(device.c_str(), ack["id"].as<String>(), coalesced);
+            deliveredUpdates.add(key.c_str(), updated);
+            for (JsonVariantConst id : coalesced.as<JsonArrayConst>())
             {
+                deliveredUpdates.add(deliveryKey(device, id).c_str(), updated);
+            }
+        }
+        xSemaphoreGive(downlinkMutex);
+        return !duplicate;
+    }
+
+    // Updates published on boards/<device> are queued for that node.
+    static void OnGatewayMqttMessage(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)
+    {
+        PayloadAssembler::Status status = mqttPayload.append(payload, len, index, total);
+        if (status == PayloadAssembler::REJECTED)
+        {
+            Serial.println("MQTT message too large or out of sequence, discarding");
+            return;
+        }
+        if (status == PayloadAssembler::INCOMPLETE)
+        {
+            return;
+        }
+
+        JsonDocument doc;
+        DeserializationError error = deserializePayload(doc, mqttPayload.data(), mqttPayload.size());
+        if (error)
+        {
+            Serial.print("deserializeJson() failed: ");
+            Serial.println(error.c_str());
+            return;
+        }
+
+        queueDownlink(extractDeviceName(topic), doc.as<JsonObjectConst>());
+    }
+
+    // Fragments are collected until their message is complete. Nodes may send
+    // JSON or MessagePack; either is forwarded to MQTT as JSON.
+    static void handleLoRaPacket(const LoRaRxPacket &packet)
+    {
+        const char *data;
+        size_t length;
+        if (!reassembler.accept(packet.data, packet.length, packet.timestamp, data, length))
+        {
+            return;
+        }
+
+        JsonDocument doc;
+        DeserializationError error = deserializePayload(doc, data, length);
+        if (error)
+        {
+            Serial.print("deserializeJson() failed: ");
+            Serial.println(error.c_str());
+            return;
+        }
 
-                Serial.println("Processing packet: " + String(packet));
-                JsonDocument doc;
-                DeserializationError error = deserializeJson(doc, packet);
-                if (error)
-                {
-                    Serial.print("deserializeJson() failed: ");
-                    Serial.println(error.c_str());
-                    continue;
-                }
-
-                if (!doc.containsKey("Device"))
-                {
-                    Serial.println("Received packet does not contain 'Device' key");
-                    continue;
-                }
-
-                String deviceName = doc["Device"].as<String>();
-                String topic = "boards/" + deviceName;
-                mqttClient.subscribe(topic.c_str(), MQTT_QOS_LEVEL);
-                publishToMQTT(packet);
-                free(packet);
+        if (!doc.containsKey("Device"))
+        {
+            Serial.println("Received packet does not contain 'Device' key");
+            return;
+        }
+
+        String message;
+        serializeJson(doc, message);
+        Serial.println("Processing packet (RSSI " + String((int)packet.rssi) + ", SNR " + String(packet.snr) + "): " + message);
+
+        String device = doc["Device"].as<String>();
+        noteDevice(device, packet);
+        JsonDocument coalesced;
+        if (doc["status"].is<const char *>() && !noteAcknowledgement(device, doc.as<JsonObjectConst>(), coalesced))
+        {
+            return;
+        }
+        if (strcmp(doc["status"] | "", "metrics") == 0)
+        {
+            mqttClient.publish((deviceTopic(device.c_str()) + METRICS_SUFFIX).c_str(), MQTT_QOS_LEVEL, false, message.c_str());
+        }
+        else
+        {
+            publishToMQTT(message);
+            confirmCoalesced(doc, coalesced.as<JsonArrayConst>());
+        }
+        uplinkLatency.record((millis() - packet.timestamp) * 1000);
+    }
+
+    static String deviceTopic(const char *name)
+    {
+        return "boards/" + String(name);
+    }
+
+    // Records an uplink and subscribes to the node's topic the first time it
+    // is heard from while MQTT is connected.
+    static void noteDevice(const String &name, const LoRaRxPacket &packet)
+    {
+        if (name.length() >= GATEWAY_DEVICE_NAME_SIZE)
+        {
+            Serial.println("Device name longer than " + String(LORA_MAX_DEVICE_NAME) + " characters, not subscribing or sending downlinks: " + name);
+            return;
+        }
+
+        xSemaphoreTake(deviceMutex, portMAX_DELAY);
+        GatewayDevice *device = devices.find(name.c_str());
+        if (device == nullptr)
+        {
+            GatewayDevice evicted;
+            bool didEvict;
+            device = devices.add(name.c_str(), packet.timestamp, evicted, didEvict);
+            if (didEvict && evicted.subscribed)
+            {
+                mqttClient.unsubscribe(deviceTopic(evicted.name).c_str());
             }
         }
+        device->lastSeen = packet.timestamp;
+        device->rssi = packet.rssi;
+        device->snr = packet.snr;
+        if (!device->subscribed && mqttClient.connected())
+        {
+            device->subscribed = mqttClient.subscribe(deviceTopic(device->name).c_str(), MQTT_QOS_LEVEL) != 0;
+        }
+        xSemaphoreGive(deviceMutex);
+    }
+
+    static void expireDevices(uint32_t now)
+    {
+        GatewayDevice expired;
+        xSemaphoreTake(deviceMutex, portMAX_DELAY);
+        while (devices.expire(now, GATEWAY_DEVICE_TIMEOUT_MS, expired))
+        {
+            if (expired.subscribed && mqttClient.connected())
+            {
+                mqttClient.unsubscribe(deviceTopic(expired.name).c_str());
+            }
+        }
+        xSemaphoreGive(deviceMutex);
+    }
+
+    // Subscriptions do not survive a reconnect, so every known node is
+    // subscribed again.
+    static void resubscribeDevices()
+    {
+        xSemaphoreTake(deviceMutex, portMAX_DELAY);
+        for (size_t i = 0; i < devices.size(); i++)
+        {
+            devices[i].subscribed = mqttClient.subscribe(deviceTopic(devices[i].name).c_str(), MQTT_QOS_LEVEL) != 0;
+        }
+        xSemaphoreGive(deviceMutex);
+    }
+
+    static void forgetSubscriptions()
+    {
+        xSemaphoreTake(deviceMutex, portMAX_DELAY);
+        for (size_t i = 0; i < devices.size(); i++)
+        {
+            devices[i].subscribed = false;
+        }
+        xSemaphoreGive(deviceMutex);
     }
 
     static void OnGatewayMqttConnect(bool sessionPresent)
     {
         vTaskSuspend(mqttGatewayConnectionTask);
         Serial.println("Connected to Mqtt");
+        mqttConnects++;
+        mqttClient.publish(GATEWAY_STATUS_TOPIC, 1, true, GATEWAY_ONLINE);
+        resubscribeDevices();
     }
 
     static void OnGatewayMqttDisconnect(AsyncMqttClientDisconnectReason reason)
     {
         Serial.println("Disconnected from MQTT.");
+        forgetSubscriptions();
         if (WiFi.isConnected())
         {
             vTaskResume(mqttGatewayConnectionTask);
@@ -171,21 +612,15 @@ private:
         return topic.substring(pos + 1);
     }
 
-    static void addDeviceNameToJson(String &jsonMessage, String deviceName)
-    {
-        JsonDocument doc;
-        deserializeJson(doc, jsonMessage);
-        doc["Device"] = deviceName;
-        serializeJson(doc, jsonMessage);
-    }
-
     static void configMqttConnection(const char *mqttHost, uint16_t mqttPort, const char *mqttUser, const char *mqttPassword)
     {
         mqttClient.onConnect(OnGatewayMqttConnect);
         mqttClient.onDisconnect(OnGatewayMqttDisconnect);
+        mqttClient.onMessage(OnGatewayMqttMessage);
         mqttClient.setServer(mqttHost, mqttPort);
         mqttClient.setCredentials(mqttUser, mqttPassword);
-        mqttClient.setClientId("LoRaGatewayDevice");
+        mqttClient.setClientId(GATEWAY_CLIENT_ID);
+        mqttClient.setWill(GATEWAY_STATUS_TOPIC, 1, true, GATEWAY_OFFLINE);
         mqttClient.setSecure(MQTT_SECURE);
     }
 
@@ -224,6 +659,7 @@ private:
         switch (event)
         {
         case WIFI_EVENT_CONNECTED:
+            wifiConnects++;
             Serial.println("WiFi connected");
             Serial.print("IP address: ");
             Serial.println(WiFi.localIP().toString());
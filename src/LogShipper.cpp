@@ -0,0 +1,189 @@
+#include "LogShipper.h"
+#include <ArduinoJson.h>
+
+// Rough JSON size of a record beyond its text, used to decide when a batch
+// is waiting.
+#define LOG_RECORD_OVERHEAD 40
+
+static const char *levelName(logging::LoggerLevel level)
+{
+    switch (level)
+    {
+    case logging::LoggerLevel::LOGGER_LEVEL_DEBUG:
+        return "debug";
+    case logging::LoggerLevel::LOGGER_LEVEL_WARN:
+        return "warn";
+    case logging::LoggerLevel::LOGGER_LEVEL_ERROR:
+        return "error";
+    default:
+        return "info";
+    }
+}
+
+LogShipper::LogShipper()
+    : queue(nullptr), topic(nullptr), device(nullptr), intervalMs(LOG_BATCH_INTERVAL_MS), batchSize(LOG_BATCH_SIZE), batch(nullptr),
+      first(0), next(0), pendingBytes(0), dropped(0), droppedShipped(0), mutex(nullptr), wakeSignal(nullptr), task(nullptr)
+{
+}
+
+bool LogShipper::begin(PublishQueue *queue, const char *topic, const char *device, uint32_t intervalMs, size_t batchSize)
+{
+    this->queue = queue;
+    this->topic = topic;
+    this->device = device;
+    this->intervalMs = intervalMs;
+    this->batchSize = batchSize;
+
+    if (mutex == nullptr)
+    {
+        mutex = xSemaphoreCreateMutex();
+        wakeSignal = xSemaphoreCreateBinary();
+        batch = static_cast<char *>(malloc(batchSize + 1));
+    }
+    if (mutex == nullptr || wakeSignal == nullptr || batch == nullptr)
+    {
+        return false;
+    }
+
+    if (task == nullptr && xTaskCreate(shipTask, "LogShipper", LOG_TASK_STACK, this, 1, &task) != pdPASS)
+    {
+        task = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void LogShipper::lock()
+{
+    if (mutex != nullptr)
+    {
+        xSemaphoreTake(mutex, portMAX_DELAY);
+    }
+}
+
+void LogShipper::unlock()
+{
+    if (mutex != nullptr)
+    {
+        xSemaphoreGive(mutex);
+    }
+}
+
+void LogShipper::add(logging::LoggerLevel level, const char *message)
+{
+    lock();
+    if (next - first == LOG_BUFFER_RECORDS)
+    {
+        pendingBytes -= records[first % LOG_BUFFER_RECORDS].length + LOG_RECORD_OVERHEAD;
+        first++;
+        dropped++;
+    }
+
+    Record &record = records[next % LOG_BUFFER_RECORDS];
+    size_t length = strnlen(message, sizeof(record.text) - 1);
+    memcpy(record.text, message, length);
+    record.text[length] = '\0';
+    record.length = length;
+    record.level = level;
+    record.timestamp = millis();
+    next++;
+    pendingBytes += length + LOG_RECORD_OVERHEAD;
+    bool full = pendingBytes >= batchSize;
+    unlock();
+
+    if (full)
+    {
+        wake();
+    }
+}
+
+void LogShipper::wake()
+{
+    if (wakeSignal != nullptr)
+    {
+        xSemaphoreGive(wakeSignal);
+    }
+}
+
+void LogShipper::shipTask(void *parameters)
+{
+    LogShipper *shipper = static_cast<LogShipper *>(parameters);
+    for (;;)
+    {
+        xSemaphoreTake(shipper->wakeSignal, pdMS_TO_TICKS(shipper->intervalMs));
+        if (shipper->queue->connected())
+        {
+            shipper->shipBatch();
+        }
+    }
+}
+
+// The batch is serialized under the lock but published outside it, so a
+// logging MQTT callback never waits on the publish. Records overwritten
+// meanwhile were already counted as dropped.
+void LogShipper::shipBatch()
+{
+    JsonDocument doc;
+    doc["Device"] = device;
+
+    lock();
+    uint32_t start = first;
+    uint32_t newDrops = dropped - droppedShipped;
+    if (start == next && newDrops == 0)
+    {
+        unlock();
+        return;
+    }
+    if (newDrops > 0)
+    {
+        doc["dropped"] = newDrops;
+    }
+
+    JsonArray logs = doc["logs"].to<JsonArray>();
+    size_t size = measureJson(doc);
+    uint32_t taken = 0;
+    while (start + taken != next)
+    {
+        const Record &record = records[(start + taken) % LOG_BUFFER_RECORDS];
+        JsonObject entry = logs.add<JsonObject>();
+        entry["t"] = record.timestamp;
+        entry["level"] = levelName(record.level);
+        entry["msg"] = record.text;
+        size_t entrySize = measureJson(entry) + (taken > 0 ? 1 : 0);
+        if (size + entrySize > batchSize)
+        {
+            logs.remove(logs.size() - 1);
+            if (taken == 0)
+            {
+                // Cannot fit in any batch.
+                taken = 1;
+                dropped++;
+            }
+            break;
+        }
+        size += entrySize;
+        taken++;
+    }
+    size_t length = serializeJson(doc, batch, batchSize + 1);
+    unlock();
+
+    if (!queue->enqueue(PUBLISH_LOG, topic, batch, length, false))
+    {
+        return;
+    }
+    queue->pump();
+
+    lock();
+    if ((int32_t)(first - (start + taken)) < 0)
+    {
+        // Only the records not overwritten since are still counted.
+        uint32_t kept = start + taken - first;
+        for (uint32_t i = 0; i < kept; i++)
+        {
+            pendingBytes -= records[(first + i) % LOG_BUFFER_RECORDS].length + LOG_RECORD_OVERHEAD;
+        }
+        first = start + taken;
+    }
+    droppedShipped += newDrops;
+    unlock();
+}
@@ -0,0 +1,79 @@
+#ifndef LogShipper_h
+#define LogShipper_h
+
+#include <Arduino.h>
+#include "PublishQueue.h"
+#include "logger.h"
+
+#ifndef LOG_BUFFER_RECORDS
+#define LOG_BUFFER_RECORDS 32
+#endif
+#ifndef LOG_RECORD_SIZE
+#define LOG_RECORD_SIZE 96
+#endif
+#ifndef LOG_BATCH_INTERVAL_MS
+#define LOG_BATCH_INTERVAL_MS 5000
+#endif
+#ifndef LOG_BATCH_SIZE
+#define LOG_BATCH_SIZE 1024
+#endif
+#define LOG_TASK_STACK 4096
+
+// Ships log lines to MQTT in batches. Records go into a fixed ring that
+// overwrites the oldest one when full; a task publishes up to a batch of
+// them as one message every interval, or sooner once a batch is waiting.
+// Batches go through the publish queue as PUBLISH_LOG; while MQTT is down or
+// the queue has no room for them, records stay in the ring, and after a
+// reconnect it is drained one batch per interval.
+class LogShipper
+{
+public:
+    LogShipper();
+
+    bool begin(PublishQueue *queue, const char *topic, const char *device, uint32_t intervalMs, size_t batchSize);
+    void add(logging::LoggerLevel level, const char *message);
+
+    // Sends a batch now if there is anything to send.
+    void wake();
+
+    uint32_t droppedCount() const { return dropped; }
+    uint32_t queued() const { return next - first; }
+
+private:
+    struct Record
+    {
+        uint32_t timestamp;
+        logging::LoggerLevel level;
+        uint16_t length;
+        char text[LOG_RECORD_SIZE];
+    };
+
+    LogShipper(const LogShipper &) = delete;
+    LogShipper &operator=(const LogShipper &) = delete;
+
+    static void shipTask(void *parameters);
+    void shipBatch();
+    void lock();
+    void unlock();
+
+    PublishQueue *queue;
+    const char *topic;
+    const char *device;
+    uint32_t intervalMs;
+    size_t batchSize;
+    char *batch;
+
+    // Records are numbered as written; first is the oldest still held.
+    Record records[LOG_BUFFER_RECORDS];
+    uint32_t first;
+    uint32_t next;
+    size_t pendingBytes;
+    uint32_t dropped;
+    uint32_t droppedShipped;
+
+    SemaphoreHandle_t mutex;
+    SemaphoreHandle_t wakeSignal;
+    TaskHandle_t task;
+};
+
+#endif
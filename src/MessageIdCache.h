@@ -0,0 +1,67 @@
+#ifndef MessageIdCache_h
+#define MessageIdCache_h
+
+#include <Arduino.h>
+
+#ifndef MESSAGE_ID_CACHE_SIZE
+#define MESSAGE_ID_CACHE_SIZE 16
+#endif
+#define MESSAGE_ID_KEY_SIZE 64
+
+// The last MESSAGE_ID_CACHE_SIZE message IDs seen and the result each got, so
+// a redelivered or retransmitted message can be answered without handling it
+// again. The oldest entry is overwritten first; IDs that do not fit in
+// MESSAGE_ID_KEY_SIZE are not remembered.
+class MessageIdCache
+{
+public:
+    MessageIdCache() : next(0)
+    {
+        for (Entry &entry : entries)
+        {
+            entry.id[0] = '\0';
+        }
+    }
+
+    bool find(const char *id, bool &result) const
+    {
+        if (id[0] == '\0')
+        {
+            return false;
+        }
+        for (const Entry &entry : entries)
+        {
+            if (strcmp(entry.id, id) == 0)
+            {
+                result = entry.result;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void add(const char *id, bool result)
+    {
+        size_t length = strlen(id);
+        if (length == 0 || length >= MESSAGE_ID_KEY_SIZE)
+        {
+            return;
+        }
+        Entry &entry = entries[next];
+        memcpy(entry.id, id, length + 1);
+        entry.result = result;
+        next = (next + 1) % MESSAGE_ID_CACHE_SIZE;
+    }
+
+private:
+    struct Entry
+    {
+        char id[MESSAGE_ID_KEY_SIZE];
+        bool result;
+    };
+
+    Entry entries[MESSAGE_ID_CACHE_SIZE];
+    size_t next;
+};
+
+#endif
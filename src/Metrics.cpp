@@ -0,0 +1,51 @@
+#include "Metrics.h"
+
+static const uint32_t BUCKET_BOUNDS_US[METRICS_BUCKETS - 1] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000};
+
+LatencyHistogram::LatencyHistogram() : samples(0), maxUs(0)
+{
+    for (std::atomic<uint32_t> &bucket : buckets)
+    {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::record(uint32_t micros)
+{
+    size_t index = 0;
+    while (index < METRICS_BUCKETS - 1 && micros > BUCKET_BOUNDS_US[index])
+    {
+        index++;
+    }
+    buckets[index].fetch_add(1, std::memory_order_relaxed);
+    samples.fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t seen = maxUs.load(std::memory_order_relaxed);
+    while (micros > seen && !maxUs.compare_exchange_weak(seen, micros, std::memory_order_relaxed))
+    {
+    }
+}
+
+void LatencyHistogram::toJson(JsonObject out) const
+{
+    out["count"] = count();
+    out["max"] = maxUs.load(std::memory_order_relaxed);
+    JsonArray counts = out["buckets"].to<JsonArray>();
+    for (size_t i = 0; i < METRICS_BUCKETS; i++)
+    {
+        counts.add(bucket(i));
+    }
+}
+
+const uint32_t *LatencyHistogram::bucketBoundsUs()
+{
+    return BUCKET_BOUNDS_US;
+}
+
+void LatencyHistogram::boundsToJson(JsonArray out)
+{
+    for (uint32_t bound : BUCKET_BOUNDS_US)
+    {
+        out.add(bound);
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef Metrics_h
+#define Metrics_h
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <atomic>
+
+#ifndef METRICS_INTERVAL_MS
+#define METRICS_INTERVAL_MS 60000
+#endif
+#define METRICS_SUFFIX "/metrics"
+#define METRICS_BUCKETS 12
+
+typedef std::atomic<uint32_t> MetricCounter;
+
+// Latency distribution over fixed buckets (see bucketBoundsUs()). Recording
+// is a few relaxed atomic increments, safe from any task and never
+// allocating.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(uint32_t micros);
+    void toJson(JsonObject out) const;
+
+    uint32_t count() const { return samples.load(std::memory_order_relaxed); }
+    uint32_t bucket(size_t index) const { return buckets[index].load(std::memory_order_relaxed); }
+
+    // Upper bound of each bucket but the last, which counts everything slower.
+    static const uint32_t *bucketBoundsUs();
+    static void boundsToJson(JsonArray out);
+
+private:
+    std::atomic<uint32_t> buckets[METRICS_BUCKETS];
+    std::atomic<uint32_t> samples;
+    std::atomic<uint32_t> maxUs;
+};
+
+inline void addStackHighWaterMark(JsonObject out, const char *name, TaskHandle_t task)
+{
+    // A null handle would report the calling task.
+    if (task != NULL)
+    {
+        out[name] = uxTaskGetStackHighWaterMark(task);
+    }
+}
+
+#endif
@@ -0,0 +1,251 @@
+#include "ParamNotifier.h"
+
+ParamNotifier::ParamNotifier() : listeners(nullptr), lastListener(nullptr), mutex(nullptr), wake(nullptr), runMutex(nullptr), task(nullptr)
+{
+}
+
+ParamNotifier::~ParamNotifier()
+{
+    release(pending);
+    Listener *listener = listeners.load();
+    while (listener != nullptr)
+    {
+        Listener *next = listener->next;
+        delete listener;
+        listener = next;
+    }
+}
+
+bool ParamNotifier::begin(UBaseType_t priority, BaseType_t core, uint32_t stackSize)
+{
+    if (mutex == nullptr)
+    {
+        mutex = xSemaphoreCreateMutex();
+        wake = xSemaphoreCreateBinary();
+        runMutex = xSemaphoreCreateMutex();
+    }
+    if (mutex == nullptr || wake == nullptr || runMutex == nullptr)
+    {
+        return false;
+    }
+
+    if (task == nullptr && xTaskCreatePinnedToCore(notifyTask, "ParamNotify", stackSize, this, priority, &task, core) != pdPASS)
+    {
+        task = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void ParamNotifier::lock()
+{
+    if (mutex != nullptr)
+    {
+        xSemaphoreTake(mutex, portMAX_DELAY);
+    }
+}
+
+void ParamNotifier::unlock()
+{
+    if (mutex != nullptr)
+    {
+        xSemaphoreGive(mutex);
+    }
+}
+
+void ParamNotifier::listen(std::initializer_list<ParamHandleBase> params, Callback callback)
+{
+    Listener *listener = new Listener();
+    for (const ParamHandleBase &param : params)
+    {
+        if (param)
+        {
+            listener->slots.push_back(param.snapshotSlot());
+        }
+    }
+    listener->callback = callback;
+    listener->next = nullptr;
+
+    lock();
+    if (lastListener != nullptr)
+    {
+        lastListener->next = listener;
+    }
+    else
+    {
+        listeners = listener;
+    }
+    lastListener = listener;
+    unlock();
+}
+
+bool ParamNotifier::watching(const ParamSnapshotStore::Slot *slot) const
+{
+    for (Listener *listener = listeners.load(); listener != nullptr; listener = listener->next)
+    {
+        for (const ParamSnapshotStore::Slot *watched : listener->slots)
+        {
+            if (watched == slot)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ParamNotifier::release(std::vector<ParamChanges::Entry> &entries)
+{
+    for (ParamChanges::Entry &entry : entries)
+    {
+        entry.slot->type->destroy(entry.before);
+        entry.slot->type->destroy(entry.after);
+    }
+    entries.clear();
+}
+
+// A parameter already waiting keeps the value it had before the first of the
+// merged updates and takes the newest one.
+void ParamNotifier::merge(const ParamChanges::Entry &change)
+{
+    for (ParamChanges::Entry &entry : pending)
+    {
+        if (entry.slot == change.slot)
+        {
+            if (change.changed)
+            {
+                entry.slot->type->destroy(entry.after);
+                entry.after = change.after;
+                entry.changed = true;
+            }
+            else
+            {
+                entry.slot->type->destroy(change.after);
+            }
+            entry.slot->type->destroy(change.before);
+            return;
+        }
+    }
+    pending.push_back(change);
+}
+
+// Group members an update left alone are added unchanged, so a group
+// callback can read every member from the same set.
+void ParamNotifier::record(const std::vector<ParamChanges::Entry> &changes)
+{
+    if (changes.empty())
+    {
+        return;
+    }
+
+    std::vector<ParamChanges::Entry> unchanged;
+    for (Listener *listener = listeners.load(); listener != nullptr; listener = listener->next)
+    {
+        if (listener->slots.size() < 2)
+        {
+            continue;
+        }
+        bool fires = false;
+        for (const ParamChanges::Entry &change : changes)
+        {
+            for (ParamSnapshotStore::Slot *slot : listener->slots)
+            {
+                fires = fires || slot == change.slot;
+            }
+        }
+        if (!fires)
+        {
+            continue;
+        }
+        for (ParamSnapshotStore::Slot *slot : listener->slots)
+        {
+            bool known = false;
+            for (const ParamChanges::Entry &change : changes)
+            {
+                known = known || change.slot == slot;
+            }
+            for (const ParamChanges::Entry &entry : unchanged)
+            {
+                known = known || entry.slot == slot;
+            }
+            if (!known)
+            {
+                // Both sides of the slot hold the current value while the
+                // writer runs.
+                unchanged.push_back({slot, slot->type->clone(slot->values[0]), slot->type->clone(slot->values[0]), false});
+            }
+        }
+    }
+
+    lock();
+    for (const ParamChanges::Entry &change : changes)
+    {
+        merge(change);
+    }
+    for (const ParamChanges::Entry &entry : unchanged)
+    {
+        merge(entry);
+    }
+    unlock();
+}
+
+void ParamNotifier::dispatch()
+{
+    if (task != nullptr)
+    {
+        xSemaphoreGive(wake);
+    }
+    else
+    {
+        run();
+    }
+}
+
+void ParamNotifier::notifyTask(void *parameters)
+{
+    ParamNotifier *notifier = static_cast<ParamNotifier *>(parameters);
+    for (;;)
+    {
+        xSemaphoreTake(notifier->wake, portMAX_DELAY);
+        notifier->run();
+    }
+}
+
+void ParamNotifier::run()
+{
+    if (runMutex != nullptr)
+    {
+        xSemaphoreTake(runMutex, portMAX_DELAY);
+    }
+
+    std::vector<ParamChanges::Entry> entries;
+    lock();
+    entries.swap(pending);
+    unlock();
+
+    if (!entries.empty())
+    {
+        ParamChanges changes(entries);
+        for (Listener *listener = listeners.load(); listener != nullptr; listener = listener->next)
+        {
+            bool fires = false;
+            for (const ParamChanges::Entry &entry : entries)
+            {
+                for (ParamSnapshotStore::Slot *slot : listener->slots)
+                {
+                    fires = fires || (entry.changed && slot == entry.slot);
+                }
+            }
+            if (fires)
+            {
+                listener->callback(changes);
+            }
+        }
+        release(entries);
+    }
+
+    if (runMutex != nullptr)
+    {
+        xSemaphoreGive(runMutex);
+    }
+}
@@ -0,0 +1,144 @@
+#ifndef ParamNotifier_h
+#define ParamNotifier_h
+
+#include <Arduino.h>
+#include <atomic>
+#include <functional>
+#include <initializer_list>
+#include <vector>
+#include "ParamSnapshot.h"
+
+#ifndef NOTIFY_TASK_PRIORITY
+#define NOTIFY_TASK_PRIORITY 1
+#endif
+#ifndef NOTIFY_TASK_CORE
+#define NOTIFY_TASK_CORE tskNO_AFFINITY
+#endif
+#ifndef NOTIFY_TASK_STACK
+#define NOTIFY_TASK_STACK 4096
+#endif
+
+// The parameters of one update as a change callback sees them. Members of a
+// group the update did not change have the same value before and after.
+class ParamChanges
+{
+public:
+    struct Entry
+    {
+        ParamSnapshotStore::Slot *slot;
+        void *before;
+        void *after;
+        bool changed;
+    };
+
+    explicit ParamChanges(const std::vector<Entry> &entries) : entries(entries) {}
+
+    template <typename T>
+    bool changed(const ParamHandle<T> &param) const
+    {
+        const Entry *entry = find(param.snapshotSlot());
+        return entry != nullptr && entry->changed;
+    }
+
+    template <typename T>
+    const T &before(const ParamHandle<T> &param) const
+    {
+        return value<T>(param.snapshotSlot(), true);
+    }
+
+    template <typename T>
+    const T &after(const ParamHandle<T> &param) const
+    {
+        return value<T>(param.snapshotSlot(), false);
+    }
+
+private:
+    const Entry *find(const ParamSnapshotStore::Slot *slot) const
+    {
+        for (const Entry &entry : entries)
+        {
+            if (entry.slot == slot)
+            {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    template <typename T>
+    const T &value(const ParamSnapshotStore::Slot *slot, bool old) const
+    {
+        static const T empty{};
+        const Entry *entry = find(slot);
+        if (entry == nullptr)
+        {
+            return empty;
+        }
+        return *static_cast<const T *>(old ? entry->before : entry->after);
+    }
+
+    const std::vector<Entry> &entries;
+};
+
+// Runs change callbacks on a worker task, away from the MQTT and LoRa
+// callbacks that apply updates. Each update is recorded as one set of
+// changes and every callback watching any of them runs once for it. If the
+// task falls behind, later updates are merged into the set still waiting:
+// each parameter keeps its oldest before and newest after value. Without
+// the task, callbacks run on the task that applied the update.
+class ParamNotifier
+{
+public:
+    typedef std::function<void(const ParamChanges &changes)> Callback;
+
+    ParamNotifier();
+    ~ParamNotifier();
+
+    bool begin(UBaseType_t priority, BaseType_t core, uint32_t stackSize);
+
+    // Callbacks run in the order they were added and are never removed.
+    // They may be added while updates arrive.
+    void listen(std::initializer_list<ParamHandleBase> params, Callback callback);
+
+    bool watching(const ParamSnapshotStore::Slot *slot) const;
+
+    // Called by the writer while the values cannot change; takes ownership
+    // of before and after, which are copies made with the slot's type.
+    void record(const std::vector<ParamChanges::Entry> &changes);
+
+    // Hands what was recorded to the task, or runs it here without one.
+    void dispatch();
+
+    TaskHandle_t taskHandle() const { return task; }
+
+private:
+    struct Listener
+    {
+        std::vector<ParamSnapshotStore::Slot *> slots;
+        Callback callback;
+        std::atomic<Listener *> next;
+    };
+
+    ParamNotifier(const ParamNotifier &) = delete;
+    ParamNotifier &operator=(const ParamNotifier &) = delete;
+
+    static void notifyTask(void *parameters);
+    static void release(std::vector<ParamChanges::Entry> &entries);
+    void merge(const ParamChanges::Entry &change);
+    void run();
+    void lock();
+    void unlock();
+
+    // Appended under the mutex, read without it.
+    std::atomic<Listener *> listeners;
+    Listener *lastListener;
+    std::vector<ParamChanges::Entry> pending;
+
+    SemaphoreHandle_t mutex;
+    SemaphoreHandle_t wake;
+    // Held while callbacks run so inline dispatches keep their order.
+    SemaphoreHandle_t runMutex;
+    TaskHandle_t task;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#include "ParamSnapshot.h"
+
+ParamSnapshotStore::~ParamSnapshotStore()
+{
+    for (Slot *slot : slots)
+    {
+        slot->type->destroy(slot->values[0]);
+        slot->type->destroy(slot->values[1]);
+        delete slot;
+    }
+}
+
+ParamSnapshotStore::Slot *ParamSnapshotStore::add(const ParamType *type, const void *value)
+{
+    Slot *slot = new Slot{type, {type->clone(value), type->clone(value)}};
+    slots.push_back(slot);
+    return slot;
+}
+
+// A reader that picked a side just before it stopped being active sees the
+// switch when it checks again and moves over, so once the writer has seen
+// the old side's count reach zero nobody can be reading it.
+uint8_t ParamSnapshotStore::enter() const
+{
+    for (;;)
+    {
+        uint8_t side = active.load();
+        readers[side].fetch_add(1);
+        if (active.load() == side)
+        {
+            return side;
+        }
+        readers[side].fetch_sub(1);
+    }
+}
+
+void ParamSnapshotStore::publish(const std::vector<Change> &changes)
+{
+    if (changes.empty())
+    {
+        return;
+    }
+
+    uint8_t old = active.load();
+    uint8_t next = old ^ 1;
+    for (const Change &change : changes)
+    {
+        change.first->type->assign(change.first->values[next], change.second);
+    }
+    active.store(next);
+
+    while (readers[old].load() != 0)
+    {
+        vTaskDelay(1);
+    }
+    for (const Change &change : changes)
+    {
+        change.first->type->assign(change.first->values[old], change.second);
+    }
+}
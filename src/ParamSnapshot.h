@@ -0,0 +1,129 @@
+#ifndef ParamSnapshot_h
+#define ParamSnapshot_h
+
+#include <Arduino.h>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include "ParamTraits.h"
+
+// Library-owned copies of every registered parameter, for the application to
+// read without locks while updates are applied on the network task. Every
+// value is kept twice. Readers use whichever side is active and only
+// announce themselves in a counter; the writer fills the other side, makes it
+// active, waits for the readers of the old side to leave and then brings
+// that side up to date as well. A reader never waits, and everything it
+// reads on one side belongs to the same update.
+class ParamSnapshotStore
+{
+public:
+    struct Slot
+    {
+        const ParamType *type;
+        void *values[2];
+    };
+
+    typedef std::pair<Slot *, const void *> Change;
+
+    ParamSnapshotStore() : active(0)
+    {
+        readers[0] = 0;
+        readers[1] = 0;
+    }
+    ~ParamSnapshotStore();
+
+    Slot *add(const ParamType *type, const void *value);
+
+    // Makes every change visible at once. Calls must not overlap.
+    void publish(const std::vector<Change> &changes);
+
+    // The side to read from, held until leave().
+    uint8_t enter() const;
+    void leave(uint8_t side) const { readers[side].fetch_sub(1); }
+
+private:
+    ParamSnapshotStore(const ParamSnapshotStore &) = delete;
+    ParamSnapshotStore &operator=(const ParamSnapshotStore &) = delete;
+
+    std::vector<Slot *> slots;
+    std::atomic<uint8_t> active;
+    mutable std::atomic<uint32_t> readers[2];
+};
+
+// The untyped part of a ParamHandle, for calls that take parameters of mixed
+// types.
+class ParamHandleBase
+{
+public:
+    ParamHandleBase() : store(nullptr), slot(nullptr) {}
+    ParamHandleBase(const ParamSnapshotStore *store, ParamSnapshotStore::Slot *slot) : store(store), slot(slot) {}
+
+    explicit operator bool() const { return slot != nullptr; }
+    ParamSnapshotStore::Slot *snapshotSlot() const { return slot; }
+
+protected:
+    const ParamSnapshotStore *store;
+    ParamSnapshotStore::Slot *slot;
+};
+
+// A parameter as returned by addParameter. get() reads the value of the last
+// update applied, never a half-written one.
+template <typename T>
+class ParamHandle : public ParamHandleBase
+{
+public:
+    typedef std::function<void(const T &before, const T &after)> Callback;
+
+    ParamHandle() {}
+    ParamHandle(const ParamSnapshotStore *store, ParamSnapshotStore::Slot *slot) : ParamHandleBase(store, slot) {}
+
+    T get() const;
+    operator T() const { return get(); }
+};
+
+// A coherent view of all parameters: values read through one snapshot come
+// from the same update, so a set such as PID gains is never seen half
+// changed. An update being applied meanwhile waits for the snapshot to be
+// destroyed before it can apply the next one, so keep it short-lived.
+class ParamSnapshot
+{
+public:
+    explicit ParamSnapshot(const ParamSnapshotStore &store) : store(&store), side(store.enter()) {}
+    ParamSnapshot(ParamSnapshot &&other) : store(other.store), side(other.side) { other.store = nullptr; }
+    ~ParamSnapshot()
+    {
+        if (store != nullptr)
+        {
+            store->leave(side);
+        }
+    }
+
+    // Valid while the snapshot lives.
+    template <typename T>
+    const T &get(const ParamHandle<T> &handle) const
+    {
+        static const T empty{};
+        ParamSnapshotStore::Slot *slot = handle.snapshotSlot();
+        return slot != nullptr ? *static_cast<const T *>(slot->values[side]) : empty;
+    }
+
+private:
+    ParamSnapshot(const ParamSnapshot &) = delete;
+    ParamSnapshot &operator=(const ParamSnapshot &) = delete;
+
+    const ParamSnapshotStore *store;
+    uint8_t side;
+};
+
+template <typename T>
+T ParamHandle<T>::get() const
+{
+    if (store == nullptr)
+    {
+        return T();
+    }
+    ParamSnapshot snapshot(*store);
+    return snapshot.get(*this);
+}
+
+#endif
@@ -0,0 +1,214 @@
+#include "ParamStore.h"
+
+ParamStore::ParamStore()
+    : preferences(nullptr), coalesceMs(PERSIST_COALESCE_MS), head(nullptr), tail(nullptr),
+      valueMutex(nullptr), writeMutex(nullptr), wake(nullptr), task(nullptr)
+{
+}
+
+bool ParamStore::begin(Preferences *preferences, uint32_t coalesceMs, UBaseType_t priority, BaseType_t core)
+{
+    this->preferences = preferences;
+    this->coalesceMs = coalesceMs;
+
+    if (valueMutex == nullptr)
+    {
+        valueMutex = xSemaphoreCreateMutex();
+        writeMutex = xSemaphoreCreateMutex();
+        wake = xSemaphoreCreateBinary();
+    }
+    if (valueMutex == nullptr || writeMutex == nullptr || wake == nullptr)
+    {
+        return false;
+    }
+
+    // Until now markDirty could only queue entries, as neither flush() nor
+    // the task could run. Write them before the task takes over.
+    flush();
+
+    // Without the task every update is written through synchronously.
+    if (task == nullptr && xTaskCreatePinnedToCore(persistTask, "ParamPersist", PERSIST_TASK_STACK, this, priority, &task, core) != pdPASS)
+    {
+        task = nullptr;
+        return false;
+    }
+    return true;
+}
+
+ParamStore::Entry *ParamStore::track(const std::string &key, const ParamType *type, void *param)
+{
+    Entry *entry = nullptr;
+    for (Entry *candidate : entries)
+    {
+        if (candidate->key == key)
+        {
+            entry = candidate;
+            break;
+        }
+    }
+
+    if (entry == nullptr)
+    {
+        entry = new Entry();
+        entry->key = key;
+        entry->stored = nullptr;
+        entry->dirtySince = 0;
+        entry->queued = false;
+        entry->next = nullptr;
+        entries.push_back(entry);
+    }
+
+    if (writeMutex != nullptr)
+    {
+        xSemaphoreTake(writeMutex, portMAX_DELAY);
+    }
+    lock();
+    if (entry->stored != nullptr)
+    {
+        entry->type->destroy(entry->stored);
+    }
+    entry->type = type;
+    entry->param = param;
+    entry->stored = type->clone(param);
+    unlock();
+    if (writeMutex != nullptr)
+    {
+        xSemaphoreGive(writeMutex);
+    }
+    return entry;
+}
+
+void ParamStore::markDirty(Entry *entry)
+{
+    bool wasIdle = false;
+
+    lock();
+    if (!entry->queued)
+    {
+        entry->queued = true;
+        entry->dirtySince = millis();
+        entry->next = nullptr;
+        wasIdle = head == nullptr;
+        if (tail != nullptr)
+        {
+            tail->next = entry;
+        }
+        else
+        {
+            head = entry;
+        }
+        tail = entry;
+    }
+    unlock();
+
+    if (task == nullptr)
+    {
+        flush();
+    }
+    else if (wasIdle)
+    {
+        xSemaphoreGive(wake);
+    }
+}
+
+void ParamStore::flush()
+{
+    if (writeMutex == nullptr)
+    {
+        return;
+    }
+
+    xSemaphoreTake(writeMutex, portMAX_DELAY);
+    TickType_t wait;
+    while (Entry *entry = takeNext(true, wait))
+    {
+        write(entry);
+    }
+    xSemaphoreGive(writeMutex);
+}
+
+void ParamStore::lock()
+{
+    if (valueMutex != nullptr)
+    {
+        xSemaphoreTake(valueMutex, portMAX_DELAY);
+    }
+}
+
+void ParamStore::unlock()
+{
+    if (valueMutex != nullptr)
+    {
+        xSemaphoreGive(valueMutex);
+    }
+}
+
+void ParamStore::persistTask(void *parameters)
+{
+    ParamStore *store = static_cast<ParamStore *>(parameters);
+
+    for (;;)
+    {
+        TickType_t wait = portMAX_DELAY;
+
+        xSemaphoreTake(store->writeMutex, portMAX_DELAY);
+        while (Entry *entry = store->takeNext(false, wait))
+        {
+            store->write(entry);
+        }
+        xSemaphoreGive(store->writeMutex);
+
+        xSemaphoreTake(store->wake, wait);
+    }
+}
+
+// The queue is ordered by the time each entry first became dirty, so only the
+// head has to be checked against the coalescing window.
+ParamStore::Entry *ParamStore::takeNext(bool force, TickType_t &wait)
+{
+    lock();
+    Entry *entry = head;
+    if (entry == nullptr)
+    {
+        wait = portMAX_DELAY;
+    }
+    else
+    {
+        uint32_t elapsed = millis() - entry->dirtySince;
+        if (force || elapsed >= coalesceMs)
+        {
+            head = entry->next;
+            if (head == nullptr)
+            {
+                tail = nullptr;
+            }
+            entry->queued = false;
+            entry->next = nullptr;
+        }
+        else
+        {
+            wait = pdMS_TO_TICKS(coalesceMs - elapsed) + 1;
+            entry = nullptr;
+        }
+    }
+    unlock();
+    return entry;
+}
+
+void ParamStore::write(Entry *entry)
+{
+    lock();
+    void *value = entry->type->clone(entry->param);
+    unlock();
+
+    if (preferences != nullptr && !entry->type->equals(value, entry->stored))
+    {
+        uint32_t startedAt = micros();
+        if (entry->type->store(*preferences, entry->key.c_str(), value))
+        {
+            entry->type->assign(entry->stored, value);
+        }
+        writes.record(micros() - startedAt);
+    }
+    entry->type->destroy(value);
+}
@@ -0,0 +1,76 @@
+#ifndef ParamStore_h
+#define ParamStore_h
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <string>
+#include <vector>
+#include "Metrics.h"
+#include "ParamTraits.h"
+
+#ifndef PERSIST_COALESCE_MS
+#define PERSIST_COALESCE_MS 2000
+#endif
+#ifndef PERSIST_TASK_PRIORITY
+#define PERSIST_TASK_PRIORITY 1
+#endif
+#ifndef PERSIST_TASK_CORE
+#define PERSIST_TASK_CORE tskNO_AFFINITY
+#endif
+#define PERSIST_TASK_STACK 4096
+
+// Write-behind NVS persistence for registered parameters. An update changes
+// the value in RAM and queues the parameter; a low-priority task writes it
+// once it has been dirty for the coalescing window, so a burst of updates to
+// one key costs one flash write. Values equal to what was last written are
+// skipped.
+class ParamStore
+{
+public:
+    struct Entry
+    {
+        std::string key;
+        const ParamType *type;
+        void *param;
+        void *stored;
+        uint32_t dirtySince;
+        bool queued;
+        Entry *next;
+    };
+
+    ParamStore();
+
+    // Entries marked dirty before begin() are queued and written by it.
+    bool begin(Preferences *preferences, uint32_t coalesceMs, UBaseType_t priority, BaseType_t core);
+    Entry *track(const std::string &key, const ParamType *type, void *param);
+    void markDirty(Entry *entry);
+    void flush();
+
+    // Guards parameter values against the persistence task copying them.
+    void lock();
+    void unlock();
+
+    const LatencyHistogram &writeLatency() const { return writes; }
+
+private:
+    ParamStore(const ParamStore &) = delete;
+    ParamStore &operator=(const ParamStore &) = delete;
+
+    static void persistTask(void *parameters);
+    Entry *takeNext(bool force, TickType_t &wait);
+    void write(Entry *entry);
+
+    Preferences *preferences;
+    uint32_t coalesceMs;
+    std::vector<Entry *> entries;
+    Entry *head;
+    Entry *tail;
+
+    SemaphoreHandle_t valueMutex;
+    SemaphoreHandle_t writeMutex;
+    SemaphoreHandle_t wake;
+    TaskHandle_t task;
+    LatencyHistogram writes;
+};
+
+#endif
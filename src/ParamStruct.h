@@ -0,0 +1,357 @@
+#ifndef ParamStruct_h
+#define ParamStruct_h
+
+#include <Arduino.h>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <vector>
+#include "ParamSnapshot.h"
+#include "ParamTraits.h"
+
+// Plain structs registered whole with addParameterStruct. Describe the
+// fields once, at file scope, after the struct:
+//
+//   struct MotorConfig { int maxRpm; float kp; float ki; bool reversed; };
+//   PARAM_STRUCT(MotorConfig, 1, maxRpm, kp, ki, reversed)
+//
+// The macro resolves every field's offset and type at compile time. Each
+// field becomes a parameter of its own, "<name>.<field>", while the struct
+// is stored as one NVS blob headed by the schema version (the second
+// argument) and a hash of the layout. Up to 32 fields of any type
+// addParameter accepts except String.
+
+// Identifies a field type in the layout hash.
+template <typename T>
+struct ParamKind;
+
+template <>
+struct ParamKind<int>
+{
+    static constexpr uint32_t code = 1;
+};
+
+template <>
+struct ParamKind<float>
+{
+    static constexpr uint32_t code = 2;
+};
+
+template <>
+struct ParamKind<double>
+{
+    static constexpr uint32_t code = 3;
+};
+
+template <>
+struct ParamKind<bool>
+{
+    static constexpr uint32_t code = 4;
+};
+
+template <typename T, size_t N>
+struct ParamKind<std::array<T, N>>
+{
+    static constexpr uint32_t code = 0x100 | ParamKind<T>::code;
+};
+
+template <size_t N>
+struct ParamKind<ParamBlob<N>>
+{
+    static constexpr uint32_t code = 0x200;
+};
+
+// FNV-1a over 32-bit words.
+constexpr uint32_t paramHashMix(uint32_t hash, uint32_t value)
+{
+    return (hash ^ value) * 16777619u;
+}
+
+constexpr uint32_t paramLayoutHash(uint32_t hash)
+{
+    return hash;
+}
+
+template <typename... Codes>
+constexpr uint32_t paramLayoutHash(uint32_t hash, uint32_t code, Codes... codes)
+{
+    return paramLayoutHash(paramHashMix(hash, code), codes...);
+}
+
+// Field names are left out, so renaming a field keeps the stored values.
+template <typename T>
+constexpr uint32_t paramFieldCode(size_t offset)
+{
+    return paramHashMix(paramHashMix(paramHashMix(2166136261u, offset), sizeof(T)), ParamKind<T>::code);
+}
+
+// Specialised by PARAM_STRUCT.
+template <typename S>
+struct ParamStructTraits
+{
+    static_assert(sizeof(S) == 0, "Describe the struct's fields with PARAM_STRUCT");
+};
+
+// PARAM_FOR_EACH(m, a, b, ...) expands to m(a) m(b) ...
+#define PARAM_EACH_1(m, x) m(x)
+#define PARAM_EACH_2(m, x, ...) m(x) PARAM_EACH_1(m, __VA_ARGS__)
+#define PARAM_EACH_3(m, x, ...) m(x) PARAM_EACH_2(m, __VA_ARGS__)
+#define PARAM_EACH_4(m, x, ...) m(x) PARAM_EACH_3(m, __VA_ARGS__)
+#define PARAM_EACH_5(m, x, ...) m(x) PARAM_EACH_4(m, __VA_ARGS__)
+#define PARAM_EACH_6(m, x, ...) m(x) PARAM_EACH_5(m, __VA_ARGS__)
+#define PARAM_EACH_7(m, x, ...) m(x) PARAM_EACH_6(m, __VA_ARGS__)
+#define PARAM_EACH_8(m, x, ...) m(x) PARAM_EACH_7(m, __VA_ARGS__)
+#define PARAM_EACH_9(m, x, ...) m(x) PARAM_EACH_8(m, __VA_ARGS__)
+#define PARAM_EACH_10(m, x, ...) m(x) PARAM_EACH_9(m, __VA_ARGS__)
+#define PARAM_EACH_11(m, x, ...) m(x) PARAM_EACH_10(m, __VA_ARGS__)
+#define PARAM_EACH_12(m, x, ...) m(x) PARAM_EACH_11(m, __VA_ARGS__)
+#define PARAM_EACH_13(m, x, ...) m(x) PARAM_EACH_12(m, __VA_ARGS__)
+#define PARAM_EACH_14(m, x, ...) m(x) PARAM_EACH_13(m, __VA_ARGS__)
+#define PARAM_EACH_15(m, x, ...) m(x) PARAM_EACH_14(m, __VA_ARGS__)
+#define PARAM_EACH_16(m, x, ...) m(x) PARAM_EACH_15(m, __VA_ARGS__)
+#define PARAM_EACH_17(m, x, ...) m(x) PARAM_EACH_16(m, __VA_ARGS__)
+#define PARAM_EACH_18(m, x, ...) m(x) PARAM_EACH_17(m, __VA_ARGS__)
+#define PARAM_EACH_19(m, x, ...) m(x) PARAM_EACH_18(m, __VA_ARGS__)
+#define PARAM_EACH_20(m, x, ...) m(x) PARAM_EACH_19(m, __VA_ARGS__)
+#define PARAM_EACH_21(m, x, ...) m(x) PARAM_EACH_20(m, __VA_ARGS__)
+#define PARAM_EACH_22(m, x, ...) m(x) PARAM_EACH_21(m, __VA_ARGS__)
+#define PARAM_EACH_23(m, x, ...) m(x) PARAM_EACH_22(m, __VA_ARGS__)
+#define PARAM_EACH_24(m, x, ...) m(x) PARAM_EACH_23(m, __VA_ARGS__)
+#define PARAM_EACH_25(m, x, ...) m(x) PARAM_EACH_24(m, __VA_ARGS__)
+#define PARAM_EACH_26(m, x, ...) m(x) PARAM_EACH_25(m, __VA_ARGS__)
+#define PARAM_EACH_27(m, x, ...) m(x) PARAM_EACH_26(m, __VA_ARGS__)
+#define PARAM_EACH_28(m, x, ...) m(x) PARAM_EACH_27(m, __VA_ARGS__)
+#define PARAM_EACH_29(m, x, ...) m(x) PARAM_EACH_28(m, __VA_ARGS__)
+#define PARAM_EACH_30(m, x, ...) m(x) PARAM_EACH_29(m, __VA_ARGS__)
+#define PARAM_EACH_31(m, x, ...) m(x) PARAM_EACH_30(m, __VA_ARGS__)
+#define PARAM_EACH_32(m, x, ...) m(x) PARAM_EACH_31(m, __VA_ARGS__)
+#define PARAM_EACH_SELECT(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, NAME, ...) NAME
+#define PARAM_FOR_EACH(m, ...) PARAM_EACH_SELECT(__VA_ARGS__, PARAM_EACH_32, PARAM_EACH_31, PARAM_EACH_30, PARAM_EACH_29, PARAM_EACH_28, PARAM_EACH_27, PARAM_EACH_26, PARAM_EACH_25, PARAM_EACH_24, PARAM_EACH_23, PARAM_EACH_22, PARAM_EACH_21, PARAM_EACH_20, PARAM_EACH_19, PARAM_EACH_18, PARAM_EACH_17, PARAM_EACH_16, PARAM_EACH_15, PARAM_EACH_14, PARAM_EACH_13, PARAM_EACH_12, PARAM_EACH_11, PARAM_EACH_10, PARAM_EACH_9, PARAM_EACH_8, PARAM_EACH_7, PARAM_EACH_6, PARAM_EACH_5, PARAM_EACH_4, PARAM_EACH_3, PARAM_EACH_2, PARAM_EACH_1)(m, __VA_ARGS__)
+
+#define PARAM_FIELD_CODE(field) , paramFieldCode<decltype(Type::field)>(offsetof(Type, field))
+#define PARAM_FIELD_VISIT(field) visitor(#field, &Type::field);
+
+#define PARAM_STRUCT(S, schemaVersion, ...)                                                                        \
+    template <>                                                                                                    \
+    struct ParamStructTraits<S>                                                                                    \
+    {                                                                                                              \
+        typedef S Type;                                                                                            \
+        static constexpr uint16_t version() { return schemaVersion; }                                              \
+        static constexpr uint32_t layoutHash()                                                                     \
+        {                                                                                                          \
+            return paramLayoutHash(paramHashMix(2166136261u, sizeof(S)) PARAM_FOR_EACH(PARAM_FIELD_CODE, __VA_ARGS__)); \
+        }                                                                                                          \
+        template <typename Visitor>                                                                                \
+        static void visit(Visitor &visitor) { PARAM_FOR_EACH(PARAM_FIELD_VISIT, __VA_ARGS__) }                     \
+    };
+
+// Heads a struct's NVS record, followed by the struct's bytes.
+struct ParamStructHeader
+{
+    uint16_t version;
+    uint16_t size;
+    uint32_t layoutHash;
+};
+
+// A record written under another version or layout, handed to a migration
+// callback with the bytes that followed its header.
+struct ParamStructRecord
+{
+    uint16_t version;
+    uint32_t layoutHash;
+    const uint8_t *data;
+    size_t size;
+};
+
+// The operations ParamStore needs to persist a struct as one record.
+template <typename S>
+struct ParamStructType
+{
+    static_assert(std::is_trivially_copyable<S>::value && std::is_standard_layout<S>::value, "Struct parameters must be plain data");
+    static_assert(sizeof(S) <= UINT16_MAX, "Struct parameters are limited to 64 KB");
+
+    static bool fromJson(JsonVariantConst src, void *param)
+    {
+        FieldsFromJson reader{src, static_cast<S *>(param), true};
+        ParamStructTraits<S>::visit(reader);
+        return reader.valid;
+    }
+
+    static void toJson(JsonVariant dst, const void *param)
+    {
+        FieldsToJson writer{dst.to<JsonObject>(), static_cast<const S *>(param)};
+        ParamStructTraits<S>::visit(writer);
+    }
+
+    // Leaves param alone unless the record matches the current layout.
+    static void load(Preferences &preferences, const char *key, void *param)
+    {
+        std::vector<uint8_t> record(sizeof(ParamStructHeader) + sizeof(S));
+        ParamStructHeader header;
+        if (preferences.getBytesLength(key) != record.size() || preferences.getBytes(key, record.data(), record.size()) != record.size())
+        {
+            return;
+        }
+        memcpy(&header, record.data(), sizeof(header));
+        if (header.version == ParamStructTraits<S>::version() && header.layoutHash == ParamStructTraits<S>::layoutHash() && header.size == sizeof(S))
+        {
+            memcpy(param, record.data() + sizeof(header), sizeof(S));
+        }
+    }
+
+    static bool store(Preferences &preferences, const char *key, const void *param)
+    {
+        std::vector<uint8_t> record(sizeof(ParamStructHeader) + sizeof(S));
+        ParamStructHeader header = {ParamStructTraits<S>::version(), (uint16_t)sizeof(S), ParamStructTraits<S>::layoutHash()};
+        memcpy(record.data(), &header, sizeof(header));
+        memcpy(record.data() + sizeof(header), param, sizeof(S));
+        return preferences.putBytes(key, record.data(), record.size()) == record.size();
+    }
+
+    static void *clone(const void *param) { return new S(*static_cast<const S *>(param)); }
+    static void assign(void *dst, const void *src) { *static_cast<S *>(dst) = *static_cast<const S *>(src); }
+
+    // Field by field, so padding never makes equal values differ.
+    static bool equals(const void *a, const void *b)
+    {
+        FieldsEqual comparer{static_cast<const S *>(a), static_cast<const S *>(b), true};
+        ParamStructTraits<S>::visit(comparer);
+        return comparer.equal;
+    }
+
+    static void destroy(void *param) { delete static_cast<S *>(param); }
+
+    static const ParamType type;
+
+private:
+    struct FieldsFromJson
+    {
+        JsonVariantConst src;
+        S *value;
+        bool valid;
+
+        template <typename T>
+        void operator()(const char *name, T S::*member)
+        {
+            JsonVariantConst field = src[name];
+            if (!field.isNull())
+            {
+                valid = valid && ParamTraits<T>::fromJson(field, value->*member);
+            }
+        }
+    };
+
+    struct FieldsToJson
+    {
+        JsonObject dst;
+        const S *value;
+
+        template <typename T>
+        void operator()(const char *name, T S::*member)
+        {
+            ParamTraits<T>::toJson(dst[name].template to<JsonVariant>(), value->*member);
+        }
+    };
+
+    struct FieldsEqual
+    {
+        const S *a;
+        const S *b;
+        bool equal;
+
+        template <typename T>
+        void operator()(const char *name, T S::*member)
+        {
+            equal = equal && a->*member == b->*member;
+        }
+    };
+};
+
+template <typename S>
+const ParamType ParamStructType<S>::type = {"struct", &ParamStructType<S>::fromJson, &ParamStructType<S>::toJson, &ParamStructType<S>::load, &ParamStructType<S>::store,
+                                            &ParamStructType<S>::clone, &ParamStructType<S>::assign, &ParamStructType<S>::equals, &ParamStructType<S>::destroy,
+                                            0, nullptr, nullptr};
+
+// A struct as returned by addParameterStruct. get() reads every described
+// field from the same update; field() gives the handle of one of them, for
+// onChange or a cheaper read.
+template <typename S>
+class ParamStructHandle
+{
+public:
+    // Returns true if it filled value from a record written under another
+    // version or layout; otherwise value keeps its compiled-in defaults.
+    typedef std::function<bool(const ParamStructRecord &stored, S &value)> Migration;
+
+    ParamStructHandle() : store(nullptr) {}
+
+    // Fields PARAM_STRUCT does not name are value-initialised.
+    S get() const
+    {
+        S value = S();
+        if (store == nullptr)
+        {
+            return value;
+        }
+        ParamSnapshot snapshot(*store);
+        FieldReader reader{this, &snapshot, &value, 0};
+        ParamStructTraits<S>::visit(reader);
+        return value;
+    }
+
+    template <typename T>
+    ParamHandle<T> field(T S::*member) const
+    {
+        FieldFinder<T> finder{member, 0, slots.size()};
+        ParamStructTraits<S>::visit(finder);
+        return finder.found < slots.size() ? ParamHandle<T>(store, slots[finder.found]) : ParamHandle<T>();
+    }
+
+private:
+    friend class AsyncParamUpdate;
+
+    struct FieldReader
+    {
+        const ParamStructHandle *handle;
+        const ParamSnapshot *snapshot;
+        S *value;
+        size_t index;
+
+        template <typename T>
+        void operator()(const char *name, T S::*member)
+        {
+            ParamHandle<T> param(handle->store, index < handle->slots.size() ? handle->slots[index] : nullptr);
+            value->*member = snapshot->get(param);
+            index++;
+        }
+    };
+
+    template <typename T>
+    struct FieldFinder
+    {
+        T S::*member;
+        size_t index;
+        size_t found;
+
+        void operator()(const char *name, T S::*candidate)
+        {
+            if (candidate == member)
+            {
+                found = index;
+            }
+            index++;
+        }
+
+        template <typename U>
+        void operator()(const char *name, U S::*candidate)
+        {
+            index++;
+        }
+    };
+
+    const ParamSnapshotStore *store;
+    // In the order PARAM_STRUCT lists the fields.
+    std::vector<ParamSnapshotStore::Slot *> slots;
+};
+
+#endif
@@ -0,0 +1,450 @@
+#ifndef ParamTraits_h
+#define ParamTraits_h
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+// Bytes of a ParamBlob that share one version in registry deltas.
+#ifndef PARAM_BLOB_UNIT
+#define PARAM_BLOB_UNIT 16
+#endif
+
+// Per-type operations for a registered parameter. addParameter<T> stores a
+// pointer to ParamTypeOf<T>::type, so applying, persisting or serializing a
+// value is one indirect call instead of a comparison against typeid names.
+struct ParamType
+{
+    const char *name;
+    bool (*fromJson)(JsonVariantConst src, void *param);
+    void (*toJson)(JsonVariant dst, const void *param);
+    void (*load)(Preferences &preferences, const char *key, void *param);
+    bool (*store)(Preferences &preferences, const char *key, const void *param);
+    void *(*clone)(const void *param);
+    void (*assign)(void *dst, const void *src);
+    bool (*equals)(const void *a, const void *b);
+    void (*destroy)(void *param);
+    // Arrays and blobs are patched in units: elements, or PARAM_BLOB_UNIT
+    // bytes. Scalars have none.
+    size_t units;
+    bool (*unitEquals)(const void *a, const void *b, size_t unit);
+    void (*unitsToJson)(JsonObject patch, const void *param, size_t begin, size_t end);
+};
+
+// Specialise ParamTraits<T> to make T usable with addParameter.
+template <typename T>
+struct ParamTraits
+{
+    static_assert(sizeof(T) == 0, "Unsupported parameter type: specialise ParamTraits<T>");
+};
+
+// Numbers arrive as JSON numbers, or as strings from older senders that
+// copied them from a registry which published every value as text; those
+// are still accepted. Anything else fails, so one bad key rejects the whole
+// update.
+// NaN and infinities are refused, and so are fractions for integral types
+// rather than being truncated.
+template <typename T>
+bool numberFromJson(JsonVariantConst src, T &value)
+{
+    if (src.is<const char *>())
+    {
+        const char *text = src.as<const char *>();
+        char *end;
+        double parsed = strtod(text, &end);
+        if (end == text || *end != '\0' || !std::isfinite(parsed) || parsed < std::numeric_limits<T>::lowest() || parsed > std::numeric_limits<T>::max())
+        {
+            return false;
+        }
+        if (std::is_integral<T>::value && parsed != std::trunc(parsed))
+        {
+            return false;
+        }
+        value = static_cast<T>(parsed);
+        return true;
+    }
+    if (!src.is<T>())
+    {
+        return false;
+    }
+    T parsed = src.as<T>();
+    if (!std::isfinite(static_cast<double>(parsed)))
+    {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+template <>
+struct ParamTraits<int>
+{
+    static constexpr const char *name = "int";
+    static bool fromJson(JsonVariantConst src, int &value) { return numberFromJson(src, value); }
+    static void toJson(JsonVariant dst, const int &value) { dst.set(value); }
+    static void load(Preferences &preferences, const char *key, int &value) { value = preferences.getInt(key, 0); }
+    static bool store(Preferences &preferences, const char *key, const int &value) { return preferences.putInt(key, value) > 0; }
+};
+
+template <>
+struct ParamTraits<float>
+{
+    static constexpr const char *name = "float";
+    static bool fromJson(JsonVariantConst src, float &value) { return numberFromJson(src, value); }
+    static void toJson(JsonVariant dst, const float &value) { dst.set(value); }
+    static void load(Preferences &preferences, const char *key, float &value) { value = preferences.getFloat(key, 0.0f); }
+    static bool store(Preferences &preferences, const char *key, const float &value) { return preferences.putFloat(key, value) > 0; }
+};
+
+template <>
+struct ParamTraits<double>
+{
+    static constexpr const char *name = "double";
+    static bool fromJson(JsonVariantConst src, double &value) { return numberFromJson(src, value); }
+    static void toJson(JsonVariant dst, const double &value) { dst.set(value); }
+    static void load(Preferences &preferences, const char *key, double &value) { value = preferences.getDouble(key, 0.0); }
+    static bool store(Preferences &preferences, const char *key, const double &value) { return preferences.putDouble(key, value) > 0; }
+};
+
+template <>
+struct ParamTraits<bool>
+{
+    static constexpr const char *name = "bool";
+    static bool fromJson(JsonVariantConst src, bool &value)
+    {
+        if (src.is<const char *>())
+        {
+            const char *text = src.as<const char *>();
+            if (strcmp(text, "true") != 0 && strcmp(text, "false") != 0)
+            {
+                return false;
+            }
+            value = text[0] == 't';
+            return true;
+        }
+        if (src.is<int>())
+        {
+            value = src.as<int>() != 0;
+            return true;
+        }
+        if (!src.is<bool>())
+        {
+            return false;
+        }
+        value = src.as<bool>();
+        return true;
+    }
+    static void toJson(JsonVariant dst, const bool &value) { dst.set(value); }
+    static void load(Preferences &preferences, const char *key, bool &value) { value = preferences.getBool(key, false); }
+    static bool store(Preferences &preferences, const char *key, const bool &value) { return preferences.putBool(key, value) > 0; }
+};
+
+template <>
+struct ParamTraits<String>
+{
+    static constexpr const char *name = "String";
+    static bool fromJson(JsonVariantConst src, String &value)
+    {
+        if (!src.is<const char *>() && !src.is<double>() && !src.is<bool>())
+        {
+            return false;
+        }
+        value = src.as<String>();
+        return true;
+    }
+    static void toJson(JsonVariant dst, const String &value) { dst.set(value); }
+    static void load(Preferences &preferences, const char *key, String &value) { value = preferences.getString(key, ""); }
+    static bool store(Preferences &preferences, const char *key, const String &value) { return preferences.putString(key, value.c_str()) == value.length(); }
+};
+
+// Fixed-size raw bytes, such as a key or a packed calibration record. Sent
+// as a hex string and stored as one NVS blob.
+template <size_t N>
+struct ParamBlob : std::array<uint8_t, N>
+{
+};
+
+// Reads a patch key: "17" for the part starting at element 17, "16:20" for
+// elements 16 to 19. end is 0 when the key has no end.
+inline bool parsePatchKey(const char *key, size_t size, size_t &begin, size_t &end)
+{
+    char *rest;
+    begin = strtoul(key, &rest, 10);
+    end = 0;
+    if (rest == key || begin >= size)
+    {
+        return false;
+    }
+    if (*rest == ':')
+    {
+        const char *endText = rest + 1;
+        end = strtoul(endText, &rest, 10);
+        if (rest == endText || end <= begin || end > size)
+        {
+            return false;
+        }
+    }
+    return *rest == '\0';
+}
+
+inline int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+inline bool bytesFromHex(const char *text, uint8_t *bytes, size_t count)
+{
+    if (text == nullptr || strlen(text) != count * 2)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        int high = hexValue(text[2 * i]);
+        int low = hexValue(text[2 * i + 1]);
+        if (high < 0 || low < 0)
+        {
+            return false;
+        }
+        bytes[i] = (uint8_t)(high << 4 | low);
+    }
+    return true;
+}
+
+inline String bytesToHex(const uint8_t *bytes, size_t count)
+{
+    static const char digits[] = "0123456789abcdef";
+    String text;
+    text.reserve(count * 2);
+    for (size_t i = 0; i < count; i++)
+    {
+        text += digits[bytes[i] >> 4];
+        text += digits[bytes[i] & 0x0F];
+    }
+    return text;
+}
+
+// A whole array is a JSON array of exactly N elements. An object patches
+// part of it, leaving the rest alone: {"17": 5} sets element 17,
+// {"16": [5, 6]} or {"16:18": [5, 6]} elements 16 and 17.
+template <typename T, size_t N>
+struct ParamTraits<std::array<T, N>>
+{
+    static_assert(std::is_arithmetic<T>::value, "Array parameters hold int, float, double or bool");
+
+    static constexpr const char *name = "array";
+
+    static bool fromJson(JsonVariantConst src, std::array<T, N> &value)
+    {
+        if (src.is<JsonArrayConst>())
+        {
+            return src.size() == N && elementsFromJson(src.as<JsonArrayConst>(), value, 0);
+        }
+        if (!src.is<JsonObjectConst>())
+        {
+            return false;
+        }
+        for (JsonPairConst kv : src.as<JsonObjectConst>())
+        {
+            size_t begin;
+            size_t end;
+            if (!parsePatchKey(kv.key().c_str(), N, begin, end))
+            {
+                return false;
+            }
+            JsonVariantConst patch = kv.value();
+            if (patch.is<JsonArrayConst>())
+            {
+                if ((end != 0 && patch.size() != end - begin) || begin + patch.size() > N || !elementsFromJson(patch.as<JsonArrayConst>(), value, begin))
+                {
+                    return false;
+                }
+            }
+            else if ((end != 0 && end != begin + 1) || !ParamTraits<T>::fromJson(patch, value[begin]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void toJson(JsonVariant dst, const std::array<T, N> &value)
+    {
+        JsonArray elements = dst.to<JsonArray>();
+        for (const T &element : value)
+        {
+            ParamTraits<T>::toJson(elements.add<JsonVariant>(), element);
+        }
+    }
+
+    // A record of another size was written by firmware with a different N;
+    // the value keeps its defaults until the next update rewrites it.
+    static void load(Preferences &preferences, const char *key, std::array<T, N> &value)
+    {
+        if (preferences.getBytesLength(key) == sizeof(value))
+        {
+            preferences.getBytes(key, value.data(), sizeof(value));
+        }
+    }
+
+    static bool store(Preferences &preferences, const char *key, const std::array<T, N> &value)
+    {
+        return preferences.putBytes(key, value.data(), sizeof(value)) == sizeof(value);
+    }
+
+    static constexpr size_t units = N;
+
+    static bool unitEquals(const std::array<T, N> &a, const std::array<T, N> &b, size_t unit) { return a[unit] == b[unit]; }
+
+    static void unitsToJson(JsonObject patch, const std::array<T, N> &value, size_t begin, size_t end)
+    {
+        JsonVariant dst = patch[String((unsigned long)begin)].to<JsonVariant>();
+        if (end == begin + 1)
+        {
+            ParamTraits<T>::toJson(dst, value[begin]);
+            return;
+        }
+        JsonArray elements = dst.to<JsonArray>();
+        for (size_t i = begin; i < end; i++)
+        {
+            ParamTraits<T>::toJson(elements.add<JsonVariant>(), value[i]);
+        }
+    }
+
+private:
+    static bool elementsFromJson(JsonArrayConst elements, std::array<T, N> &value, size_t begin)
+    {
+        size_t i = begin;
+        for (JsonVariantConst element : elements)
+        {
+            if (!ParamTraits<T>::fromJson(element, value[i++]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// A whole blob is a hex string of 2 * N digits. An object patches bytes:
+// {"4": "a0ff"} writes bytes 4 and 5, as does {"4:6": "a0ff"}.
+template <size_t N>
+struct ParamTraits<ParamBlob<N>>
+{
+    static constexpr const char *name = "blob";
+
+    static bool fromJson(JsonVariantConst src, ParamBlob<N> &value)
+    {
+        if (src.is<const char *>())
+        {
+            return bytesFromHex(src.as<const char *>(), value.data(), N);
+        }
+        if (!src.is<JsonObjectConst>())
+        {
+            return false;
+        }
+        for (JsonPairConst kv : src.as<JsonObjectConst>())
+        {
+            size_t begin;
+            size_t end;
+            const char *hex = kv.value().as<const char *>();
+            if (!parsePatchKey(kv.key().c_str(), N, begin, end) || hex == nullptr)
+            {
+                return false;
+            }
+            size_t count = end != 0 ? end - begin : strlen(hex) / 2;
+            if (begin + count > N || !bytesFromHex(hex, value.data() + begin, count))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void toJson(JsonVariant dst, const ParamBlob<N> &value) { dst.set(bytesToHex(value.data(), N)); }
+
+    static void load(Preferences &preferences, const char *key, ParamBlob<N> &value)
+    {
+        if (preferences.getBytesLength(key) == N)
+        {
+            preferences.getBytes(key, value.data(), N);
+        }
+    }
+
+    static bool store(Preferences &preferences, const char *key, const ParamBlob<N> &value)
+    {
+        return preferences.putBytes(key, value.data(), N) == N;
+    }
+
+    static constexpr size_t units = (N + PARAM_BLOB_UNIT - 1) / PARAM_BLOB_UNIT;
+
+    static bool unitEquals(const ParamBlob<N> &a, const ParamBlob<N> &b, size_t unit)
+    {
+        size_t begin = unit * PARAM_BLOB_UNIT;
+        return memcmp(a.data() + begin, b.data() + begin, std::min<size_t>(PARAM_BLOB_UNIT, N - begin)) == 0;
+    }
+
+    static void unitsToJson(JsonObject patch, const ParamBlob<N> &value, size_t begin, size_t end)
+    {
+        size_t first = begin * PARAM_BLOB_UNIT;
+        size_t last = std::min<size_t>(end * PARAM_BLOB_UNIT, N);
+        patch[String((unsigned long)first)] = bytesToHex(value.data() + first, last - first);
+    }
+};
+
+// Patch units of T; scalars are always sent whole.
+template <typename T, typename = void>
+struct ParamUnits
+{
+    static constexpr size_t count = 0;
+    static bool equals(const void *a, const void *b, size_t unit) { return true; }
+    static void toJson(JsonObject patch, const void *param, size_t begin, size_t end) {}
+};
+
+template <typename T>
+struct ParamUnits<T, decltype(void(ParamTraits<T>::units))>
+{
+    static constexpr size_t count = ParamTraits<T>::units;
+    static bool equals(const void *a, const void *b, size_t unit) { return ParamTraits<T>::unitEquals(*static_cast<const T *>(a), *static_cast<const T *>(b), unit); }
+    static void toJson(JsonObject patch, const void *param, size_t begin, size_t end) { ParamTraits<T>::unitsToJson(patch, *static_cast<const T *>(param), begin, end); }
+};
+
+template <typename T>
+struct ParamTypeOf
+{
+    static bool fromJson(JsonVariantConst src, void *param) { return ParamTraits<T>::fromJson(src, *static_cast<T *>(param)); }
+    static void toJson(JsonVariant dst, const void *param) { ParamTraits<T>::toJson(dst, *static_cast<const T *>(param)); }
+    static void load(Preferences &preferences, const char *key, void *param) { ParamTraits<T>::load(preferences, key, *static_cast<T *>(param)); }
+    static bool store(Preferences &preferences, const char *key, const void *param) { return ParamTraits<T>::store(preferences, key, *static_cast<const T *>(param)); }
+    static void *clone(const void *param) { return new T(*static_cast<const T *>(param)); }
+    static void assign(void *dst, const void *src) { *static_cast<T *>(dst) = *static_cast<const T *>(src); }
+    static bool equals(const void *a, const void *b) { return *static_cast<const T *>(a) == *static_cast<const T *>(b); }
+    static void destroy(void *param) { delete static_cast<T *>(param); }
+
+    static const ParamType type;
+};
+
+template <typename T>
+const ParamType ParamTypeOf<T>::type = {ParamTraits<T>::name, &ParamTypeOf<T>::fromJson, &ParamTypeOf<T>::toJson, &ParamTypeOf<T>::load, &ParamTypeOf<T>::store,
+                                      &ParamTypeOf<T>::clone, &ParamTypeOf<T>::assign, &ParamTypeOf<T>::equals, &ParamTypeOf<T>::destroy,
+                                      ParamUnits<T>::count, &ParamUnits<T>::equals, &ParamUnits<T>::toJson};
+
+#endif
@@ -0,0 +1,66 @@
+#include "PayloadAssembler.h"
+
+PayloadAssembler::~PayloadAssembler()
+{
+    free(buffer);
+}
+
+bool PayloadAssembler::begin(size_t maxPayloadSize)
+{
+    char *resized = static_cast<char *>(realloc(buffer, maxPayloadSize));
+    if (resized == nullptr && maxPayloadSize > 0)
+    {
+        return false;
+    }
+    buffer = resized;
+    capacity = maxPayloadSize;
+    received = 0;
+    discarding = false;
+    return true;
+}
+
+PayloadAssembler::Status PayloadAssembler::append(const char *fragment, size_t len, size_t index, size_t total)
+{
+    message = nullptr;
+    messageSize = 0;
+
+    if (index == 0)
+    {
+        received = 0;
+        discarding = total > capacity;
+        if (discarding)
+        {
+            return REJECTED;
+        }
+        if (len == total)
+        {
+            message = fragment;
+            messageSize = total;
+            return COMPLETE;
+        }
+    }
+
+    if (discarding)
+    {
+        return INCOMPLETE;
+    }
+
+    if (index != received || index + len > total || total > capacity)
+    {
+        // A fragment went missing; drop the rest of this message.
+        discarding = true;
+        return REJECTED;
+    }
+
+    memcpy(buffer + index, fragment, len);
+    received += len;
+    if (received < total)
+    {
+        return INCOMPLETE;
+    }
+
+    received = 0;
+    message = buffer;
+    messageSize = total;
+    return COMPLETE;
+}
@@ -0,0 +1,41 @@
+#ifndef PayloadAssembler_h
+#define PayloadAssembler_h
+
+#include <Arduino.h>
+
+// Reassembles an MQTT message that AsyncMqttClient delivers in index/total
+// fragments into one buffer allocated up front. A message that arrives in a
+// single fragment is handed back in place without copying.
+class PayloadAssembler
+{
+public:
+    enum Status
+    {
+        INCOMPLETE,
+        COMPLETE,
+        REJECTED
+    };
+
+    PayloadAssembler() : buffer(nullptr), capacity(0), received(0), discarding(false), message(nullptr), messageSize(0) {}
+    ~PayloadAssembler();
+
+    bool begin(size_t maxPayloadSize);
+    Status append(const char *fragment, size_t len, size_t index, size_t total);
+
+    const char *data() const { return message; }
+    size_t size() const { return messageSize; }
+    size_t maxPayloadSize() const { return capacity; }
+
+private:
+    PayloadAssembler(const PayloadAssembler &) = delete;
+    PayloadAssembler &operator=(const PayloadAssembler &) = delete;
+
+    char *buffer;
+    size_t capacity;
+    size_t received;
+    bool discarding;
+    const char *message;
+    size_t messageSize;
+};
+
+#endif
@@ -0,0 +1,312 @@
+#include "PublishQueue.h"
+
+PublishQueue::PublishQueue()
+    : client(nullptr), onSent(nullptr), freeSlots(nullptr), count(0), bytes(0), rejected(0), inFlightCount(0), earlyAckIndex(0),
+      mutex(nullptr), sendMutex(nullptr), pumpAgain(false)
+{
+    config[PUBLISH_ACK] = {PUBLISH_ACK_QOS, true};
+    config[PUBLISH_REGISTRY] = {PUBLISH_REGISTRY_QOS, true};
+    config[PUBLISH_METRICS] = {PUBLISH_METRICS_QOS, false};
+    config[PUBLISH_LOG] = {PUBLISH_LOG_QOS, false};
+
+    for (size_t i = 0; i < PUBLISH_QUEUE_SLOTS; i++)
+    {
+        slots[i].payload = nullptr;
+        slots[i].next = i + 1 < PUBLISH_QUEUE_SLOTS ? &slots[i + 1] : nullptr;
+    }
+    freeSlots = &slots[0];
+    for (size_t c = 0; c < PUBLISH_CLASSES; c++)
+    {
+        heads[c] = nullptr;
+        tails[c] = nullptr;
+    }
+    for (uint16_t &id : earlyAcks)
+    {
+        id = 0;
+    }
+}
+
+PublishQueue::~PublishQueue()
+{
+    for (Message &message : slots)
+    {
+        free(message.payload);
+    }
+}
+
+bool PublishQueue::begin(AsyncMqttClient *client, SentCallback onSent)
+{
+    this->client = client;
+    this->onSent = onSent;
+    if (mutex == nullptr)
+    {
+        mutex = xSemaphoreCreateMutex();
+        sendMutex = xSemaphoreCreateMutex();
+    }
+    return mutex != nullptr && sendMutex != nullptr;
+}
+
+void PublishQueue::configure(PublishClass cls, uint8_t qos, bool retain)
+{
+    lock();
+    config[cls] = {qos, retain};
+    unlock();
+}
+
+void PublishQueue::lock()
+{
+    if (mutex != nullptr)
+    {
+        xSemaphoreTake(mutex, portMAX_DELAY);
+    }
+}
+
+void PublishQueue::unlock()
+{
+    if (mutex != nullptr)
+    {
+        xSemaphoreGive(mutex);
+    }
+}
+
+// Class c may fill (PUBLISH_CLASSES - c) / PUBLISH_CLASSES of the slots and
+// of the byte budget, so the last room always goes to higher classes.
+bool PublishQueue::admits(PublishClass cls, size_t length) const
+{
+    size_t share = PUBLISH_CLASSES - cls;
+    return freeSlots != nullptr && count < PUBLISH_QUEUE_SLOTS * share / PUBLISH_CLASSES &&
+           bytes + length <= PUBLISH_QUEUE_BYTES * share / PUBLISH_CLASSES;
+}
+
+bool PublishQueue::hasRoom(PublishClass cls, size_t length)
+{
+    lock();
+    bool room = admits(cls, length);
+    unlock();
+    return room;
+}
+
+bool PublishQueue::enqueue(PublishClass cls, const char *topic, const char *payload, size_t length, bool retain, uint32_t tag)
+{
+    char *copy = static_cast<char *>(malloc(length + 1));
+    if (copy == nullptr)
+    {
+        lock();
+        rejected++;
+        unlock();
+        return false;
+    }
+    memcpy(copy, payload, length);
+    copy[length] = '\0';
+    return adopt(cls, topic, copy, length, retain, tag);
+}
+
+bool PublishQueue::adopt(PublishClass cls, const char *topic, char *payload, size_t length, bool retain, uint32_t tag)
+{
+    lock();
+    if (!admits(cls, length))
+    {
+        rejected++;
+        unlock();
+        free(payload);
+        return false;
+    }
+
+    Message *message = freeSlots;
+    freeSlots = message->next;
+    message->topic = topic;
+    message->payload = payload;
+    message->length = length;
+    message->tag = tag;
+    message->retain = retain;
+    message->next = nullptr;
+    if (tails[cls] != nullptr)
+    {
+        tails[cls]->next = message;
+    }
+    else
+    {
+        heads[cls] = message;
+    }
+    tails[cls] = message;
+    count++;
+    bytes += length;
+    unlock();
+    return true;
+}
+
+// Takes the oldest message of the highest non-empty class, or nothing when
+// that message needs a window slot and none is free. Lower classes never
+// overtake it, so a full window holds back logs behind a waiting ack.
+PublishQueue::Message *PublishQueue::takeNext(PublishClass &cls)
+{
+    for (size_t c = 0; c < PUBLISH_CLASSES; c++)
+    {
+        Message *message = heads[c];
+        if (message == nullptr)
+        {
+            continue;
+        }
+        if (config[c].qos > 0 && inFlightCount == PUBLISH_MAX_IN_FLIGHT)
+        {
+            return nullptr;
+        }
+        heads[c] = message->next;
+        if (heads[c] == nullptr)
+        {
+            tails[c] = nullptr;
+        }
+        cls = static_cast<PublishClass>(c);
+        return message;
+    }
+    return nullptr;
+}
+
+void PublishQueue::putBack(PublishClass cls, Message *message)
+{
+    message->next = heads[cls];
+    heads[cls] = message;
+    if (tails[cls] == nullptr)
+    {
+        tails[cls] = message;
+    }
+}
+
+void PublishQueue::release(Message *message)
+{
+    free(message->payload);
+    message->payload = nullptr;
+    count--;
+    bytes -= message->length;
+    message->next = freeSlots;
+    freeSlots = message;
+}
+
+// The broker may acknowledge on another task before publish() has returned
+// here; such an id is found in earlyAcks and never takes a window slot.
+bool PublishQueue::takeEarlyAck(uint16_t packetId)
+{
+    for (uint16_t &id : earlyAcks)
+    {
+        if (id == packetId)
+        {
+            id = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whoever holds sendMutex drains on behalf of the callers that found it
+// taken; pumpAgain is checked after giving it back, so a request made while
+// a drain was finishing is not lost.
+void PublishQueue::pump()
+{
+    if (sendMutex == nullptr || !connected())
+    {
+        return;
+    }
+
+    pumpAgain = true;
+    while (pumpAgain && xSemaphoreTake(sendMutex, 0) == pdTRUE)
+    {
+        pumpAgain = false;
+        drain();
+        xSemaphoreGive(sendMutex);
+    }
+}
+
+void PublishQueue::drain()
+{
+    for (;;)
+    {
+        lock();
+        PublishClass cls;
+        Message *message = takeNext(cls);
+        if (message == nullptr)
+        {
+            unlock();
+            break;
+        }
+        ClassConfig classConfig = config[cls];
+        if (classConfig.qos > 0)
+        {
+            // Reserved now so a concurrent acknowledged() sees a full window.
+            inFlight[inFlightCount++] = 0;
+        }
+        unlock();
+
+        // AsyncMqttClient returns 0 when the message does not fit in the TCP
+        // send buffer; it stays first in line until an ack or the next pump.
+        uint16_t packetId = client->publish(message->topic, classConfig.qos, message->retain && classConfig.retain, message->payload, message->length);
+
+        lock();
+        if (classConfig.qos > 0)
+        {
+            // acknowledged() may have moved the reservation meanwhile.
+            for (size_t i = 0; i < inFlightCount; i++)
+            {
+                if (inFlight[i] == 0)
+                {
+                    if (packetId == 0 || takeEarlyAck(packetId))
+                    {
+                        inFlight[i] = inFlight[--inFlightCount];
+                    }
+                    else
+                    {
+                        inFlight[i] = packetId;
+                    }
+                    break;
+                }
+            }
+        }
+        if (packetId == 0)
+        {
+            putBack(cls, message);
+            unlock();
+            break;
+        }
+        uint32_t tag = message->tag;
+        release(message);
+        unlock();
+
+        if (tag != 0 && onSent != nullptr)
+        {
+            onSent(tag, classConfig.qos > 0 ? packetId : 0);
+        }
+    }
+}
+
+void PublishQueue::acknowledged(uint16_t packetId)
+{
+    lock();
+    bool found = false;
+    for (size_t i = 0; i < inFlightCount; i++)
+    {
+        if (inFlight[i] == packetId)
+        {
+            inFlight[i] = inFlight[--inFlightCount];
+            found = true;
+            break;
+        }
+    }
+    if (!found)
+    {
+        earlyAcks[earlyAckIndex++ % PUBLISH_MAX_IN_FLIGHT] = packetId;
+    }
+    unlock();
+}
+
+// Unacknowledged messages are not sent again: the client starts a clean
+// session, and the acks and registry they carried are superseded by what
+// is published on connect.
+void PublishQueue::disconnected()
+{
+    lock();
+    inFlightCount = 0;
+    for (uint16_t &id : earlyAcks)
+    {
+        id = 0;
+    }
+    unlock();
+}
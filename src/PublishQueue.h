@@ -0,0 +1,141 @@
+#ifndef PublishQueue_h
+#define PublishQueue_h
+
+#include <Arduino.h>
+#include <AsyncMqttClient.h>
+#include <atomic>
+
+#ifndef PUBLISH_QUEUE_SLOTS
+#define PUBLISH_QUEUE_SLOTS 16
+#endif
+#ifndef PUBLISH_QUEUE_BYTES
+#define PUBLISH_QUEUE_BYTES 8192
+#endif
+// QoS 1/2 publishes the broker has not acknowledged yet.
+#ifndef PUBLISH_MAX_IN_FLIGHT
+#define PUBLISH_MAX_IN_FLIGHT 4
+#endif
+// QoS of each class; retained messages are allowed only where the
+// class's retain flag is set. See PublishQueue::configure().
+#ifndef PUBLISH_ACK_QOS
+#define PUBLISH_ACK_QOS 1
+#endif
+#ifndef PUBLISH_REGISTRY_QOS
+#define PUBLISH_REGISTRY_QOS 1
+#endif
+#ifndef PUBLISH_METRICS_QOS
+#define PUBLISH_METRICS_QOS 0
+#endif
+#ifndef PUBLISH_LOG_QOS
+#define PUBLISH_LOG_QOS 0
+#endif
+// How often a queue the client pushed back on is tried again.
+#define PUBLISH_RETRY_MS 100
+
+// Highest priority first.
+enum PublishClass
+{
+    PUBLISH_ACK,      // confirmations and presence
+    PUBLISH_REGISTRY, // registry snapshots and deltas
+    PUBLISH_METRICS,  // metrics and heartbeats
+    PUBLISH_LOG,
+    PUBLISH_CLASSES
+};
+
+// Outbound queue in front of AsyncMqttClient. Messages wait in one FIFO per
+// class and are sent highest class first, with at most
+// PUBLISH_MAX_IN_FLIGHT unacknowledged at a time. A publish the client
+// refuses, because its send buffer is full or it is offline, stays queued.
+// Each class may fill only part of the queue (all of it for acks, a quarter
+// for logs), so low-priority traffic cannot crowd out acknowledgements.
+class PublishQueue
+{
+public:
+    // tag is the value given to enqueue(), packetId the one publish returned,
+    // or 0 for a QoS 0 message, which is never acknowledged.
+    typedef void (*SentCallback)(uint32_t tag, uint16_t packetId);
+
+    PublishQueue();
+    ~PublishQueue();
+
+    bool begin(AsyncMqttClient *client, SentCallback onSent);
+
+    // A message is retained only if it asks to be and its class allows it.
+    void configure(PublishClass cls, uint8_t qos, bool retain);
+
+    // Queues a copy of payload. topic must outlive the message. tag, when
+    // not 0, is passed to the sent callback once the message is published.
+    bool enqueue(PublishClass cls, const char *topic, const char *payload, size_t length, bool retain, uint32_t tag = 0);
+    // Like enqueue(), but takes ownership of payload, a malloc'd buffer of
+    // length + 1 bytes, instead of copying it. It is freed if refused.
+    bool adopt(PublishClass cls, const char *topic, char *payload, size_t length, bool retain, uint32_t tag = 0);
+
+    // Whether a message of length bytes would be accepted now.
+    bool hasRoom(PublishClass cls, size_t length);
+
+    // Publishes as much as the window and the client allow. Never waits: if
+    // another task is pumping, that task goes round once more instead, so
+    // the MQTT task is not held up behind a publish from the application.
+    void pump();
+    void acknowledged(uint16_t packetId);
+    // The broker forgets unacknowledged publishes when the connection drops.
+    void disconnected();
+
+    bool connected() const { return client != nullptr && client->connected(); }
+    size_t queued() const { return count; }
+    uint32_t rejectedCount() const { return rejected; }
+
+private:
+    struct Message
+    {
+        const char *topic;
+        char *payload;
+        size_t length;
+        uint32_t tag;
+        bool retain;
+        Message *next;
+    };
+
+    struct ClassConfig
+    {
+        uint8_t qos;
+        bool retain;
+    };
+
+    PublishQueue(const PublishQueue &) = delete;
+    PublishQueue &operator=(const PublishQueue &) = delete;
+
+    bool admits(PublishClass cls, size_t length) const;
+    void drain();
+    Message *takeNext(PublishClass &cls);
+    void putBack(PublishClass cls, Message *message);
+    void release(Message *message);
+    bool takeEarlyAck(uint16_t packetId);
+    void lock();
+    void unlock();
+
+    AsyncMqttClient *client;
+    SentCallback onSent;
+    ClassConfig config[PUBLISH_CLASSES];
+
+    Message slots[PUBLISH_QUEUE_SLOTS];
+    Message *freeSlots;
+    Message *heads[PUBLISH_CLASSES];
+    Message *tails[PUBLISH_CLASSES];
+    size_t count;
+    size_t bytes;
+    uint32_t rejected;
+
+    uint16_t inFlight[PUBLISH_MAX_IN_FLIGHT];
+    size_t inFlightCount;
+    // Acknowledgements can arrive before publish() has returned the id.
+    uint16_t earlyAcks[PUBLISH_MAX_IN_FLIGHT];
+    size_t earlyAckIndex;
+
+    SemaphoreHandle_t mutex;
+    // Held while draining so messages reach the client in queue order.
+    SemaphoreHandle_t sendMutex;
+    std::atomic<bool> pumpAgain;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef WireFormat_h
+#define WireFormat_h
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Encoding of the documents a device sends. Incoming messages are accepted in
+// either encoding regardless of this setting.
+enum WireFormat
+{
+    WIRE_FORMAT_JSON,
+    WIRE_FORMAT_MSGPACK
+};
+
+#ifndef MQTT_WIRE_FORMAT
+#define MQTT_WIRE_FORMAT WIRE_FORMAT_JSON
+#endif
+#ifndef LORA_WIRE_FORMAT
+#define LORA_WIRE_FORMAT WIRE_FORMAT_MSGPACK
+#endif
+
+inline const char *wireFormatName(WireFormat format)
+{
+    return format == WIRE_FORMAT_MSGPACK ? "msgpack" : "json";
+}
+
+// Every message is an object: JSON text starts with '{' (possibly after
+// whitespace), a MessagePack map with a byte in 0x80-0x8f, 0xde or 0xdf.
+inline bool isMsgPackPayload(const char *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        uint8_t c = static_cast<uint8_t>(data[i]);
+        if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+        {
+            return (c & 0xf0) == 0x80 || c == 0xde || c == 0xdf;
+        }
+    }
+    return false;
+}
+
+inline DeserializationError deserializePayload(JsonDocument &doc, const char *data, size_t length)
+{
+    if (isMsgPackPayload(data, length))
+    {
+        return deserializeMsgPack(doc, data, length);
+    }
+    return deserializeJson(doc, data, length);
+}
+
+inline size_t measurePayload(const JsonDocument &doc, WireFormat format)
+{
+    return format == WIRE_FORMAT_MSGPACK ? measureMsgPack(doc) : measureJson(doc);
+}
+
+inline size_t serializePayload(const JsonDocument &doc, WireFormat format, char *buffer, size_t size)
+{
+    return format == WIRE_FORMAT_MSGPACK ? serializeMsgPack(doc, buffer, size) : serializeJson(doc, buffer, size);
+}
+
+inline size_t serializePayload(const JsonDocument &doc, WireFormat format, Print &output)
+{
+    return format == WIRE_FORMAT_MSGPACK ? serializeMsgPack(doc, output) : serializeJson(doc, output);
+}
+
+inline size_t serializePayload(const JsonDocument &doc, WireFormat format, String &output)
+{
+    return format == WIRE_FORMAT_MSGPACK ? serializeMsgPack(doc, output) : serializeJson(doc, output);
+}
+
+#endif